@@ -0,0 +1,29 @@
+#ifndef PURENES_ACCURACY_H
+#define PURENES_ACCURACY_H
+
+#include <cstdint>
+
+namespace purenes {
+
+// How the components of a System are synchronized. Each mode is a separate
+// instantiation of the run loops, so the hot paths carry no checks of it.
+//
+// There are only these two tiers. Neither times accesses within an
+// instruction: all of them happen on its last cycle, where the single
+// access of most instructions is, so the early write of a read-modify-write
+// instruction and the dummy read of an indexed one land there too.
+enum class Accuracy : uint8_t {
+  // The CPU runs in batches between scheduled events, and the PPU and APU
+  // catch up to the cycle of every access to their registers.
+  kInstruction,
+  // Like kInstruction, but the PPU only ever catches up in whole scanlines
+  // for register accesses: reads see the state at the start of the current
+  // scanline, and writes take effect from there. Mid-scanline effects such
+  // as a scroll split land on scanline boundaries, which is all that most
+  // games rely on.
+  kScanline,
+};
+
+}  // namespace purenes
+
+#endif //PURENES_ACCURACY_H
@@ -0,0 +1,114 @@
+#ifndef PURENES_APU_H
+#define PURENES_APU_H
+
+#include <array>
+#include <cstdint>
+
+#include "bus.h"
+#include "region.h"
+
+namespace purenes {
+
+class Cpu;
+class Scheduler;
+
+// The audio processing unit of the 2A03, as far as the CPU can observe it:
+// the frame counter and its IRQ, the length counters reported by $4015, and
+// the DMC's sample fetches, DMA stalls and IRQ. No sound is synthesized.
+//
+// Like the PPU, the APU catches up to the CPU's cycle counter only when it
+// is accessed and at its scheduled events, the frame counter steps
+// (Scheduler::kApuFrameCounter) and DMC sample fetches (Scheduler::kDmc),
+// which are the only points at which it can raise an IRQ. As in the PPU,
+// the region's timing tables are compiled into per-region instantiations.
+//
+// Map its registers, $4000-$4013, $4015 and $4017, with Bus::MapDevice().
+class Apu : public BusDevice {
+ public:
+  // All three have to outlive the APU. `bus` is where the DMC fetches its
+  // samples. Takes over the scheduler's kApuFrameCounter and kDmc slots.
+  Apu(Cpu& cpu, Scheduler& scheduler, CpuBus& bus,
+      Region region = Region::kNtsc);
+
+  Apu(const Apu&) = delete;
+  Apu& operator=(const Apu&) = delete;
+
+  // Resets as the console's reset button does: all channels are silenced as
+  // by writing 0 to $4015, and the frame counter restarts in the mode last
+  // written to $4017 with its IRQ cleared. Reschedules the APU's events, for
+  // after Scheduler::Reset().
+  void Reset();
+
+  // Runs the frame counter steps and DMC fetches before CPU cycle `cycle`.
+  void CatchUp(uint64_t cycle) { (this->*catch_up_)(cycle); }
+
+  uint8_t Read(uint16_t address) override;
+  void Write(uint16_t address, uint8_t data) override;
+
+  // Whether the APU holds the IRQ line asserted.
+  bool irq() const { return frame_irq_ || dmc_irq_; }
+
+ private:
+  static constexpr int kChannels = 4;
+
+  // Selects the instantiations for `kRegion`.
+  template <Region kRegion>
+  void SetUp();
+
+  template <Region kRegion>
+  void CatchUpIn(uint64_t cycle);
+  // Catches up to the cycle of a register access, the last one of the
+  // current instruction.
+  void Sync();
+  void UpdateIrq();
+  // Updates the IRQ line and schedules the next frame counter step and
+  // sample fetch.
+  void ScheduleEvents() { (this->*schedule_events_)(); }
+  template <Region kRegion>
+  void ScheduleEventsIn();
+
+  // Frame counter.
+  void RestartFrameCounter(uint64_t cycle);
+  template <Region kRegion>
+  void RunFrameStep();
+  void ClockLengthCounters();
+
+  // DMC.
+  void RestartSample();
+  template <Region kRegion>
+  void FetchSample();
+
+  Cpu& cpu_;
+  Scheduler& scheduler_;
+  CpuBus& bus_;
+  // CatchUpIn() and ScheduleEventsIn() of the region.
+  void (Apu::*catch_up_)(uint64_t) = nullptr;
+  void (Apu::*schedule_events_)() = nullptr;
+
+  // Cycle of the last $4017 write, from which the frame counter counts.
+  uint64_t frame_start_ = 0;
+  int frame_step_ = 0;
+  bool five_step_ = false;
+  bool frame_irq_inhibit_ = false;
+  bool frame_irq_ = false;
+
+  // Pulse 1, pulse 2, triangle and noise.
+  std::array<uint8_t, kChannels> length_counters_{};
+  std::array<bool, kChannels> length_halted_{};
+  uint8_t enabled_ = 0;
+
+  uint8_t dmc_rate_ = 0;
+  bool dmc_loop_ = false;
+  bool dmc_irq_enable_ = false;
+  bool dmc_irq_ = false;
+  uint16_t sample_start_ = 0xC000;
+  uint16_t sample_length_ = 1;
+  uint16_t sample_address_ = 0xC000;
+  uint16_t bytes_remaining_ = 0;
+  // Cycle of the next sample fetch, if bytes_remaining_ is not 0.
+  uint64_t next_fetch_ = 0;
+};
+
+}  // namespace purenes
+
+#endif //PURENES_APU_H
@@ -0,0 +1,98 @@
+#ifndef PURENES_BUS_H
+#define PURENES_BUS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu.h"
+
+namespace purenes {
+
+// A memory-mapped device on the CPU bus, such as the PPU registers or the
+// registers of a cartridge mapper.
+class BusDevice {
+ public:
+  virtual ~BusDevice() = default;
+
+  virtual uint8_t Read(uint16_t address) = 0;
+  virtual void Write(uint16_t address, uint8_t data) = 0;
+
+  // See CpuBus::HasReadSideEffects(). Registers usually have some, so
+  // devices have to opt out.
+  virtual bool HasReadSideEffects(uint16_t address) {
+    (void)address;
+    return true;
+  }
+  // See CpuBus::ReadStableUntil().
+  virtual uint64_t ReadStableUntil(uint16_t address) {
+    (void)address;
+    return 0;
+  }
+};
+
+// The CPU address space as a table of 256-byte pages. Each page is backed
+// by host memory, such as RAM or a PRG ROM bank, or by a device. The CPU
+// accesses memory pages through ReadPages() and WritePages() with one table
+// load and an indexed access, and only calls Read() and Write() for
+// devices. Mirroring is resolved when a range is mapped: the pages of a
+// mirrored range point at the same memory, and devices are handed addresses
+// already folded onto their registers. A bank switch maps the new bank over
+// the old one, which costs nothing per access.
+//
+// The 2KB internal RAM is mapped at $0000-$1FFF, mirrored four times. All
+// other pages start out unmapped: reads return the high byte of the address,
+// approximating open bus, and writes are dropped.
+class Bus : public CpuBus {
+ public:
+  static constexpr size_t kPageSize = 0x100;
+  static constexpr size_t kRamSize = 0x800;
+
+  Bus();
+
+  Bus(const Bus&) = delete;
+  Bus& operator=(const Bus&) = delete;
+
+  // Maps `size` bytes from `address` on to `memory`, repeating its
+  // `memory_size` bytes to fill the range. Writes change the memory if
+  // `writable` is set and otherwise go to the device mapped there before,
+  // like writes to the registers of a mapper in ROM space. Addresses and
+  // sizes are multiples of kPageSize.
+  void MapMemory(uint16_t address, size_t size, uint8_t* memory,
+                 size_t memory_size, bool writable);
+
+  // Sends all accesses to `size` bytes from `address` to `device`, with the
+  // address AND-ed with `mask`. A mask of $2007 on $2000-$3FFF, for
+  // example, hands the PPU one of its eight register addresses.
+  void MapDevice(uint16_t address, size_t size, BusDevice* device,
+                 uint16_t mask = 0xFFFF);
+
+  // Returns `size` bytes from `address` to the unmapped state.
+  void Unmap(uint16_t address, size_t size);
+
+  uint8_t Read(uint16_t address) override;
+  void Write(uint16_t address, uint8_t data) override;
+  bool HasReadSideEffects(uint16_t address) override;
+  uint64_t ReadStableUntil(uint16_t address) override;
+  const uint8_t* const* ReadPages() const override {
+    return read_pages_.data();
+  }
+  uint8_t* const* WritePages() const override { return write_pages_.data(); }
+
+  std::array<uint8_t, kRamSize>& ram() { return ram_; }
+
+ private:
+  void MapPages(uint16_t address, size_t size, BusDevice* device,
+                uint16_t mask);
+
+  std::array<const uint8_t*, 256> read_pages_{};
+  std::array<uint8_t*, 256> write_pages_{};
+  std::array<BusDevice*, 256> devices_{};
+  std::array<uint16_t, 256> masks_{};
+
+  std::array<uint8_t, kRamSize> ram_{};
+};
+
+}  // namespace purenes
+
+#endif //PURENES_BUS_H
@@ -0,0 +1,89 @@
+#ifndef PURENES_CARTRIDGE_H
+#define PURENES_CARTRIDGE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bus.h"
+#include "chr_memory.h"
+#include "ppu.h"
+#include "region.h"
+
+namespace purenes {
+
+class Cpu;
+
+// A game cartridge loaded from an iNES file, with one of the discrete
+// logic mappers: NROM (0), UxROM (2) or CNROM (3).
+//
+// Bank switches remap the CPU bus pages and the PPU's pattern memory
+// instead of translating every access, and tell the CPU's code cache which
+// bank is mapped where.
+class Cartridge : public BusDevice {
+ public:
+  static constexpr size_t kPrgBankSize = 0x4000;
+  static constexpr size_t kChrBankSize = 0x2000;
+  static constexpr size_t kPrgRamSize = 0x2000;
+
+  // Parses an iNES file. Returns null and sets `error` if the file is
+  // malformed or uses an unsupported mapper.
+  static std::unique_ptr<Cartridge> FromInes(const std::vector<uint8_t>& file,
+                                             std::string* error);
+
+  // The code bank id (see Cpu::SetCodeBank()) of 16KB PRG ROM bank `bank`,
+  // after the default id 0 that RAM keeps. Recompiled code has to be built
+  // with the same ids to be found.
+  static uint16_t PrgCodeBank(size_t bank) {
+    return static_cast<uint16_t>(bank + 1);
+  }
+
+  Cartridge(const Cartridge&) = delete;
+  Cartridge& operator=(const Cartridge&) = delete;
+
+  // Maps PRG ROM and PRG RAM ($6000-$7FFF) into `bus` and CHR memory into
+  // `ppu`, and takes the mapper registers in $8000-$FFFF. All three have to
+  // outlive the cartridge.
+  void Connect(Bus& bus, Cpu& cpu, Ppu& ppu);
+
+  // Mapper registers.
+  uint8_t Read(uint16_t address) override;
+  void Write(uint16_t address, uint8_t data) override;
+  bool HasReadSideEffects(uint16_t address) override;
+
+  int mapper() const { return mapper_; }
+  // PRG ROM, in 16KB banks.
+  const std::vector<uint8_t>& prg() const { return prg_; }
+  size_t prg_banks() const { return prg_.size() / kPrgBankSize; }
+  // Whether the mapper can map PRG ROM bank `bank` at `address`, $8000 or
+  // $C000. Recompiled code is generated for each such placement.
+  bool CanMapPrgBank(size_t bank, uint16_t address) const;
+  // The console the game was made for, per the header unless overridden.
+  Region region() const { return region_; }
+  void set_region(Region region) { region_ = region; }
+  std::vector<uint8_t>& prg_ram() { return prg_ram_; }
+
+ private:
+  Cartridge(int mapper, std::vector<uint8_t> prg, std::vector<uint8_t> chr,
+            bool chr_writable, Ppu::Mirroring mirroring, Region region);
+
+  // Maps 16KB PRG ROM bank `bank` at `address`.
+  void MapPrgBank(uint16_t address, size_t bank);
+  void MapChrBank(size_t bank);
+
+  int mapper_;
+  std::vector<uint8_t> prg_;
+  ChrMemory chr_;
+  Ppu::Mirroring mirroring_;
+  Region region_;
+  std::vector<uint8_t> prg_ram_;
+
+  Bus* bus_ = nullptr;
+  Cpu* cpu_ = nullptr;
+  Ppu* ppu_ = nullptr;
+};
+
+}  // namespace purenes
+
+#endif //PURENES_CARTRIDGE_H
@@ -0,0 +1,69 @@
+#ifndef PURENES_CHR_MEMORY_H
+#define PURENES_CHR_MEMORY_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace purenes {
+
+// A cartridge's CHR ROM or RAM, which holds the tiles that the PPU draws,
+// along with every tile decoded for drawing.
+//
+// A tile is 16 bytes: 8 rows of low bitplane bits, then 8 rows of high
+// bitplane bits. Assembling a pixel takes a bit from each, which renderers
+// would otherwise do for every pixel they draw. Instead, every row is kept
+// decoded to one 2-bit pixel per byte, and mirrored for horizontally
+// flipped sprites, along with masks of its opaque pixels for when only
+// sprite 0 hits matter. ROM is decoded once, up front. Writes to RAM mark their
+// tile dirty, and a dirty tile is decoded again the next time it is drawn,
+// so that uploading a tile byte by byte decodes it once.
+class ChrMemory {
+ public:
+  static constexpr size_t kTileSize = 16;
+
+  // A row of a tile, leftmost pixel first. In the masks, bit 7 - x is set
+  // if pixel x is not transparent, as in the bitplanes.
+  struct Row {
+    std::array<uint8_t, 8> pixels;
+    std::array<uint8_t, 8> flipped;
+    uint8_t opaque;
+    uint8_t opaque_flipped;
+  };
+
+  // Writes are dropped unless `writable`. `data` has to be a whole number
+  // of tiles.
+  ChrMemory(std::vector<uint8_t> data, bool writable);
+
+  ChrMemory(const ChrMemory&) = delete;
+  ChrMemory& operator=(const ChrMemory&) = delete;
+
+  uint8_t Read(size_t address) const { return data_[address]; }
+  void Write(size_t address, uint8_t value) {
+    if (!writable_) return;
+    data_[address] = value;
+    dirty_[address / kTileSize] = true;
+  }
+
+  // Row `y` (0-7) of tile `tile`, decoding the tile first if it is dirty.
+  const Row& DecodedRow(size_t tile, int y) {
+    if (dirty_[tile]) Decode(tile);
+    return rows_[tile * 8 + y];
+  }
+
+  size_t size() const { return data_.size(); }
+  bool writable() const { return writable_; }
+
+ private:
+  void Decode(size_t tile);
+
+  std::vector<uint8_t> data_;
+  bool writable_;
+  std::vector<Row> rows_;
+  std::vector<bool> dirty_;
+};
+
+}  // namespace purenes
+
+#endif //PURENES_CHR_MEMORY_H
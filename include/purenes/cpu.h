@@ -1,4 +1,582 @@
 #ifndef PURENES_CPU_H
 #define PURENES_CPU_H
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace purenes {
+
+class Jit;
+class OpcodePairProfile;
+class Scheduler;
+
+// Interface through which the CPU reaches memory and memory-mapped devices.
+class CpuBus {
+ public:
+  virtual ~CpuBus() = default;
+
+  virtual uint8_t Read(uint16_t address) = 0;
+  virtual void Write(uint16_t address, uint8_t data) = 0;
+
+  // Whether a read of `address` repeated right after another one can have a
+  // different result or effect before the CPU's next RunUntil() target, such
+  // as a controller shift register. Loops reading such addresses are only
+  // idle as far as ReadStableUntil() allows (see Cpu::SetIdleLoopSkipping()).
+  // Plain memory has none.
+  virtual bool HasReadSideEffects(uint16_t address) {
+    (void)address;
+    return false;
+  }
+
+  // For an address with read side effects, the cycle up to which a read
+  // repeated right after another one has the same result and effect after
+  // all, such as a status register whose next change is known: reads by
+  // instructions that end before it repeat. 0, the default, if there is no
+  // such cycle.
+  virtual uint64_t ReadStableUntil(uint16_t address) {
+    (void)address;
+    return 0;
+  }
+
+  // Optional direct access to plain memory: tables of 256 pointers, one per
+  // 256-byte page, to the bytes that reads of the page return and that
+  // writes to it change. A null entry sends accesses to that page through
+  // Read() or Write(). The tables must stay valid for the life of the bus,
+  // while their entries may change at any time, such as on bank switches.
+  // Null, the default, sends every access through Read() and Write().
+  virtual const uint8_t* const* ReadPages() const { return nullptr; }
+  virtual uint8_t* const* WritePages() const { return nullptr; }
+};
+
+// Bits of the processor status register (P).
+enum StatusFlag : uint8_t {
+  kCarry = 0x01,
+  kZero = 0x02,
+  kInterruptDisable = 0x04,
+  kDecimal = 0x08,
+  kBreak = 0x10,
+  kUnused = 0x20,
+  kOverflow = 0x40,
+  kNegative = 0x80,
+};
+
+// The 6502 core of the Ricoh 2A03.
+//
+// Instructions are executed whole: Step() fetches an opcode and makes a
+// single indexed call through a 256-entry table that is built at compile
+// time from the opcode list in opcodes.h. Each entry is a handler
+// specialized for its operation, addressing mode and access policy, with the
+// base cycle count built in, so the hot path has no decode branching at
+// all. Cycle counts are exact at instruction granularity. Decoded
+// instructions are kept in a small cache keyed by code bank and address, so
+// hot loops skip re-fetching opcodes and operands from memory. N, Z, C and V
+// are evaluated lazily from the last result so that instructions whose flags
+// are overwritten unread cost nothing extra. The 2A03 has no decimal mode;
+// the D flag can be set and cleared but does not affect arithmetic.
+class Cpu {
+ public:
+  static constexpr uint16_t kNmiVector = 0xFFFA;
+  static constexpr uint16_t kResetVector = 0xFFFC;
+  static constexpr uint16_t kIrqVector = 0xFFFE;
+
+  // Code bank id for pages whose contents can change without a CPU write,
+  // such as I/O registers. Instructions there are decoded on every fetch.
+  static constexpr uint16_t kUncachedBank = 0xFFFF;
+
+  // How RunUntil() executes code.
+  enum class Backend {
+    kInterpreter,
+    // Translates basic blocks to x86-64 machine code. Only available when
+    // built with PURENES_JIT on an x86-64 host.
+    kJit,
+  };
+
+  // Native code for a run of 6502 instructions starting at PC. It executes
+  // at least one instruction and returns once control leaves the code it
+  // was compiled from or RunUntil() has to regain control.
+  using CompiledFunction = void (*)(Cpu* cpu);
+
+  // Code compiled ahead of time from a ROM by the purenes_recompile tool
+  // (see purenes_add_recompiled_rom() in CMakeLists.txt).
+  struct CompiledBlock {
+    uint16_t bank;
+    uint16_t address;
+    CompiledFunction run;
+  };
+  struct CompiledCode {
+    // Sorted by bank, then address.
+    const CompiledBlock* blocks;
+    size_t count;
+  };
+
+  // Executes one instruction of the indexing opcode on behalf of compiled
+  // code. `argument` holds the instruction's operand in its low 16 bits and
+  // its length above them. Returns true if the caller has to return to
+  // RunUntil(): the deadline passed, an interrupt is pending, or code the
+  // caller may have been compiled from was written or banked out.
+  using InstructionEntry = bool (*)(Cpu* cpu, uint32_t argument);
+  static const InstructionEntry kInstructionEntries[256];
+  // kInstructionEntries[kOpcode] itself, defined inline in
+  // cpu_instructions.h. Recompiled code calls it directly, so that the
+  // compiler can optimize the instructions of a block as a unit.
+  template <uint8_t kOpcode>
+  static bool ExecuteEntry(Cpu* cpu, uint32_t argument);
+
+  explicit Cpu(CpuBus& bus);
+  ~Cpu();
+
+  Cpu(const Cpu&) = delete;
+  Cpu& operator=(const Cpu&) = delete;
+
+  // Selects the execution backend. Returns false, leaving the interpreter in
+  // place, if the backend is not available in this build or on this host.
+  bool SetBackend(Backend backend);
+
+  // Performs the reset sequence: S is decremented by three, I is set and PC
+  // is loaded from the reset vector. Takes 7 cycles.
+  void Reset();
+
+  // Services a pending interrupt or executes one instruction. Returns the
+  // number of cycles consumed.
+  int Step();
+
+  // Advances the CPU by a single cycle. An instruction takes effect on its
+  // first cycle and the remaining cycles idle. This is the slow path kept
+  // for lockstep and accuracy testing; prefer RunUntil().
+  void Tick();
+
+  // Executes whole instructions and services interrupts until cycles()
+  // reaches `target_cycle` or Yield() is called, and returns cycles(). The
+  // last instruction may overshoot the target.
+  //
+  // This is the hot loop: it stays inside the CPU for as long as possible so
+  // the compiler can keep its state in host registers. Depending on the
+  // PURENES_THREADED_DISPATCH build option it dispatches either through the
+  // instruction table or through direct-threaded code (a switch on compilers
+  // without labels-as-values). All variants, and the JIT backend, behave
+  // identically.
+  //
+  // With a scheduler attached, it stops at each scheduled event on the way
+  // to run its handler, and only there.
+  uint64_t RunUntil(uint64_t target_cycle);
+
+  // Makes RunUntil() return once the current instruction completes. Devices
+  // call this from a bus access, and event handlers from the scheduler,
+  // when they need the caller to handle an event before emulation
+  // continues.
+  void Yield();
+
+  // Halts the CPU for `cycles` cycles, as DMA does. Devices call this from a
+  // bus access, and the cycles follow the current instruction.
+  void Stall(int cycles) { cycles_ += cycles; }
+
+  // Attaches `scheduler`, whose due events RunUntil() and Step() run, or
+  // detaches the current one if null. Whichever of the two is destroyed
+  // first detaches them, but not during a RunUntil() call, whose events
+  // the scheduler runs.
+  void SetScheduler(Scheduler* scheduler);
+
+  // Latches an NMI. NMIs are edge triggered, so the request stays pending
+  // until it is serviced at the next instruction boundary.
+  void Nmi();
+
+  // Sets the level of the IRQ line. A low (asserted) line is serviced at each
+  // instruction boundary while the I flag is clear.
+  void SetIrq(bool asserted);
+
+  // Tells the decoded-instruction cache which bank is mapped into the 256-byte
+  // CPU page `page`. Cached instructions are keyed by (bank, address), so a
+  // bank switch that updates the ids of the affected pages retires the
+  // entries of the outgoing bank, and switching back finds them again. Ids
+  // must uniquely identify memory contents; every page starts out as bank 0.
+  void SetCodeBank(uint8_t page, uint16_t bank);
+  uint16_t code_bank(uint8_t page) const { return code_banks_[page]; }
+
+  // Drops every decoded instruction, e.g. after replacing the memory behind
+  // a bank id.
+  void InvalidateCodeCache();
+
+  // Enables skipping of idle loops: short loops that only read memory and
+  // leave all registers unchanged, such as `JMP *`, polling a flag that an
+  // interrupt handler sets, or polling a register for as long as the bus
+  // reports its reads as stable (CpuBus::ReadStableUntil()). Once one has
+  // gone around twice, RunUntil() charges the cycles of all remaining
+  // iterations before the target, or the polled register's change, at
+  // once. Results stay cycle-identical as long as the bus only changes the
+  // memory such loops read at RunUntil() targets, which are the caller's
+  // scheduled events. Off by default.
+  void SetIdleLoopSkipping(bool enabled);
+
+  // Makes Step() count every pair of consecutively executed opcodes in
+  // `profile`, or stops counting if null. RunUntil() does not count, to keep
+  // its loop free of the check.
+  void SetOpcodePairProfile(OpcodePairProfile* profile);
+
+  // Makes RunUntil() run `code` whenever PC is at one of its blocks, using
+  // the selected backend everywhere else. Bank ids are matched against those
+  // set with SetCodeBank(). Pass null to remove it. `code` must outlive its
+  // use.
+  void SetCompiledCode(const CompiledCode* code);
+
+  uint8_t a() const { return a_; }
+  uint8_t x() const { return x_; }
+  uint8_t y() const { return y_; }
+  uint8_t s() const { return s_; }
+  // Returns the status register, materialized from the lazily kept flags.
+  uint8_t p() const { return Status(); }
+  uint16_t pc() const { return pc_; }
+  uint64_t cycles() const { return cycles_; }
+  // Cycles that idle loop skipping charged without running the loops.
+  uint64_t skipped_cycles() const { return skipped_cycles_; }
+
+  void set_a(uint8_t value) { a_ = value; }
+  void set_x(uint8_t value) { x_ = value; }
+  void set_y(uint8_t value) { y_ = value; }
+  void set_s(uint8_t value) { s_ = value; }
+  void set_p(uint8_t value) { SetStatus(value); }
+  void set_pc(uint16_t value) { pc_ = value; }
+
+ private:
+  friend class Jit;
+  friend class Scheduler;
+
+  static constexpr uint16_t kStackBase = 0x0100;
+
+  // Addressing modes. Every opcode handler is instantiated for its mode, so
+  // effective addresses are computed inline without a runtime mode switch.
+  enum class Mode : uint8_t {
+    kImplied, kAccumulator, kImmediate, kZeroPage, kZeroPageX, kZeroPageY,
+    kAbsolute, kAbsoluteX, kAbsoluteY, kIndirect, kIndirectX, kIndirectY,
+    kRelative,
+  };
+
+  // How an operation uses its operand. The policy follows from the
+  // operation's signature, so each handler specializes on it:
+  //   void Op()                 uses no operand.
+  //   void Op(uint8_t value)    reads the value at the effective address, or
+  //                             the operand itself in immediate mode.
+  //   uint8_t Op(uint8_t value) modifies the value at the effective address,
+  //                             or A in accumulator mode, and returns the
+  //                             value to write back.
+  //   void Op(uint16_t address) writes to the effective address itself; jumps
+  //                             and branches go there.
+  // Only reads finish a cycle early when indexing stays within a page.
+  enum class Access : uint8_t { kRead, kModify, kWrite };
+  using ImpliedOperation = void (Cpu::*)();
+  using ReadOperation = void (Cpu::*)(uint8_t value);
+  using ModifyOperation = uint8_t (Cpu::*)(uint8_t value);
+  using WriteOperation = void (Cpu::*)(uint16_t address);
+
+  // Identifies operations for code that inspects instructions rather than
+  // executing them, such as the JIT and idle loop detection.
+  enum class Operation : uint8_t {
+    // Official.
+    kAdc, kAnd, kAsl, kBcc, kBcs, kBeq, kBit, kBmi, kBne, kBpl, kBrk, kBvc,
+    kBvs, kClc, kCld, kCli, kClv, kCmp, kCpx, kCpy, kDec, kDex, kDey, kEor,
+    kInc, kInx, kIny, kJmp, kJsr, kLda, kLdx, kLdy, kLsr, kNop, kOra, kPha,
+    kPhp, kPla, kPlp, kRol, kRor, kRti, kRts, kSbc, kSec, kSed, kSei, kSta,
+    kStx, kSty, kTax, kTay, kTsx, kTxa, kTxs, kTya,
+    // Unofficial.
+    kAhx, kAlr, kAnc, kArr, kAxs, kDcp, kIsc, kJam, kLas, kLax, kRla, kRra,
+    kSax, kShx, kShy, kSlo, kSre, kTas, kXaa,
+  };
+
+  struct Instruction {
+    // ExecuteOpcode<opcode>.
+    void (Cpu::*execute)(uint16_t operand, uint8_t length);
+    Operation operation;
+    Mode mode;
+    uint8_t cycles;
+    uint8_t operand_bytes;
+  };
+
+  // An instruction as fetched from memory, ready to execute without touching
+  // the bus again for its opcode or operand.
+  struct DecodedInstruction {
+    // Code bank in the upper 16 bits, address in the lower 16 bits.
+    uint32_t tag;
+    uint16_t operand;
+    uint8_t opcode;
+    // Length in bytes, including the opcode.
+    uint8_t length;
+    // What the threaded run loop executes: the opcode, or a superinstruction
+    // from PURENES_FUSIONS in opcodes.h numbered from 256, which also runs
+    // the next instruction described below.
+    uint16_t handler;
+    uint16_t next_operand;
+    uint8_t next_length;
+  };
+
+  // Direct-mapped by address. 1024 entries of 16 bytes cover the hot loops
+  // of a game while staying small enough to remain in L1/L2.
+  static constexpr int kCodeCacheSize = 1024;
+  // Most bytes a cache entry can describe: two fused 3-byte instructions.
+  static constexpr int kMaxDecodedBytes = 6;
+
+  // A loop closed by a backward branch or JMP, as seen by idle loop
+  // skipping.
+  struct IdleLoop {
+    // Code bank and address of the first instruction, as in the code cache.
+    uint32_t tag;
+    // Address following the instruction that jumps back.
+    uint16_t end;
+    // Cycles per iteration if the loop can be idle, 0 if it cannot.
+    uint8_t period;
+    // Whether the loop reads `polled`, an address with read side effects.
+    bool polls;
+    uint16_t polled;
+    // State at the previous arrival at the head.
+    uint8_t a, x, y, s, p;
+    uint64_t cycles;
+  };
+
+  // Longest loop body considered, in bytes, and number of loops remembered.
+  static constexpr int kMaxIdleLoopBytes = 16;
+  static constexpr int kIdleLoopCacheSize = 16;
+
+  static const Instruction kInstructions[256];
+
+  // RunUntil() up to deadline_, without looking at the scheduler.
+  uint64_t RunToDeadline();
+  // Lowers the deadline of a running RunUntil() to `cycle`, for an event
+  // that was just scheduled.
+  void Preempt(uint64_t cycle);
+
+  // Executes an instruction of opcode kOpcode that PC points to.
+  template <uint8_t kOpcode>
+  void ExecuteOpcode(uint16_t operand, uint8_t length);
+  // Runs kOperation in mode kMode with the access policy of its signature.
+  template <Mode kMode, ImpliedOperation kOperation>
+  void Perform(uint16_t operand);
+  template <Mode kMode, ReadOperation kOperation>
+  void Perform(uint16_t operand);
+  template <Mode kMode, ModifyOperation kOperation>
+  void Perform(uint16_t operand);
+  template <Mode kMode, WriteOperation kOperation>
+  void Perform(uint16_t operand);
+
+  // Memory pages that the bus exposes are accessed directly, anything else
+  // through its virtual functions.
+  uint8_t Read(uint16_t address) {
+    const uint8_t* const page = read_pages_[address >> 8];
+    return page ? page[address & 0xFF] : bus_.Read(address);
+  }
+  void Write(uint16_t address, uint8_t data) {
+    uint8_t* const page = write_pages_[address >> 8];
+    if (page) {
+      page[address & 0xFF] = data;
+    } else {
+      bus_.Write(address, data);
+    }
+    if (code_pages_[address >> 8]) InvalidateCodeAt(address);
+  }
+  // Read a little-endian word, with a single host load if both bytes are in
+  // the same page of plain memory. Read16() carries into the next page;
+  // ReadWrapped16() takes the high byte from the start of the same page,
+  // like zero page pointers and JMP ($xxFF).
+  uint16_t Read16(uint16_t address);
+  // Reads the little-endian word at `address` from the host memory of its
+  // page, which has to hold both bytes. Compilers turn the two byte loads
+  // into a single unaligned 16-bit load on little-endian hosts.
+  static uint16_t Load16(const uint8_t* page, uint16_t address);
+  uint16_t ReadWrapped16(uint16_t address);
+
+  void Push(uint8_t data);
+  uint8_t Pull();
+
+  // Returns the instruction at PC from the code cache, decoding it on a miss.
+  const DecodedInstruction& Decode();
+  // Turns `entry`, cached for the instruction at `address`, into a
+  // superinstruction if it and the next instruction form one.
+  void Fuse(uint16_t address, DecodedInstruction* entry);
+  void Fetch(uint16_t address, DecodedInstruction* decoded);
+  // Marks `page` and the pages that mirror it as holding cached code.
+  void MarkCodePage(uint8_t page);
+  // Drops cached instructions that the byte at `address`, or at any of its
+  // mirrors, belongs to.
+  void InvalidateCodeAt(uint16_t address);
+  // Drops cached instructions that the byte at `address` belongs to.
+  void InvalidateCodeOf(uint16_t address);
+  void Execute(const DecodedInstruction& decoded);
+  // Returns the block of the code set by SetCompiledCode() that starts at PC
+  // in its current bank, or null if there is none.
+  CompiledFunction FindCompiledBlock() const;
+  // Runs the compiled block starting at PC, whose instruction is `decoded`,
+  // or just that instruction if the block is gone.
+  void RunBlock(const DecodedInstruction& decoded);
+
+  // Called after a jump back to PC from the instruction ending at `end`.
+  // Skips the iterations of the loop left before the deadline if it is
+  // idle.
+  void SkipIdleLoop(uint16_t end);
+  // Works out the cycles per iteration of the loop from `head` to `end`
+  // if each iteration does nothing but read memory, and 0 otherwise. Of
+  // addresses with read side effects, it may only read one, which it then
+  // polls.
+  void AnalyzeIdleLoop(uint16_t head, uint16_t end, IdleLoop* loop);
+
+  bool InterruptPending() const;
+  // Services a pending NMI or unmasked IRQ. Returns whether one was taken.
+  bool PollInterrupts();
+  void Interrupt(uint16_t vector);
+
+  // Packs the lazily evaluated flags into the P register layout, and unpacks
+  // a P value into them. Only pushes of P and the public accessors need this.
+  uint8_t Status() const;
+  void SetStatus(uint8_t value);
+
+  void SetZn(uint8_t value);
+  void Branch(bool condition, uint16_t target);
+  void Compare(uint8_t reg, uint8_t value);
+
+  // Returns the effective address of `operand` in mode kMode, which runs
+  // after PC has moved past the instruction. Indexed reads that cross a
+  // page pay their extra cycle here.
+  template <Mode kMode, Access kAccess>
+  uint16_t Address(uint16_t operand);
+  template <Access kAccess>
+  uint16_t Indexed(uint16_t base, uint8_t index);
+
+  // Official operations.
+  void Adc(uint8_t value);
+  void And(uint8_t value);
+  uint8_t Asl(uint8_t value);
+  void Bcc(uint16_t address);
+  void Bcs(uint16_t address);
+  void Beq(uint16_t address);
+  void Bit(uint8_t value);
+  void Bmi(uint16_t address);
+  void Bne(uint16_t address);
+  void Bpl(uint16_t address);
+  void Brk();
+  void Bvc(uint16_t address);
+  void Bvs(uint16_t address);
+  void Clc();
+  void Cld();
+  void Cli();
+  void Clv();
+  void Cmp(uint8_t value);
+  void Cpx(uint8_t value);
+  void Cpy(uint8_t value);
+  uint8_t Dec(uint8_t value);
+  void Dex();
+  void Dey();
+  void Eor(uint8_t value);
+  uint8_t Inc(uint8_t value);
+  void Inx();
+  void Iny();
+  void Jmp(uint16_t address);
+  void Jsr(uint16_t address);
+  void Lda(uint8_t value);
+  void Ldx(uint8_t value);
+  void Ldy(uint8_t value);
+  uint8_t Lsr(uint8_t value);
+  void Nop(uint8_t value);
+  void Ora(uint8_t value);
+  void Pha();
+  void Php();
+  void Pla();
+  void Plp();
+  uint8_t Rol(uint8_t value);
+  uint8_t Ror(uint8_t value);
+  void Rti();
+  void Rts();
+  void Sbc(uint8_t value);
+  void Sec();
+  void Sed();
+  void Sei();
+  void Sta(uint16_t address);
+  void Stx(uint16_t address);
+  void Sty(uint16_t address);
+  void Tax();
+  void Tay();
+  void Tsx();
+  void Txa();
+  void Txs();
+  void Tya();
+
+  // Unofficial operations.
+  void Ahx(uint16_t address);
+  void Alr(uint8_t value);
+  void Anc(uint8_t value);
+  void Arr(uint8_t value);
+  void Axs(uint8_t value);
+  uint8_t Dcp(uint8_t value);
+  uint8_t Isc(uint8_t value);
+  void Jam();
+  void Las(uint8_t value);
+  void Lax(uint8_t value);
+  uint8_t Rla(uint8_t value);
+  uint8_t Rra(uint8_t value);
+  void Sax(uint16_t address);
+  void Shx(uint16_t address);
+  void Shy(uint16_t address);
+  uint8_t Slo(uint8_t value);
+  uint8_t Sre(uint8_t value);
+  void Tas(uint16_t address);
+  void Xaa(uint8_t value);
+
+  CpuBus& bus_;
+  // The bus's page tables, or tables without any page.
+  const uint8_t* const* read_pages_;
+  uint8_t* const* write_pages_;
+
+  uint8_t a_ = 0;
+  uint8_t x_ = 0;
+  uint8_t y_ = 0;
+  uint8_t s_ = 0;
+  uint16_t pc_ = 0;
+
+  // Status flags. Only I and D are kept in their P register positions.
+  // The arithmetic flags are stored in whatever form their producers compute
+  // for free and are decoded only when P is pushed or read:
+  //   N/Z: the last result. Z is set if the low byte is zero, N is bit 7 of
+  //        either byte (BIT uses the high byte to supply an independent N).
+  //   C:   0 or 1.
+  //   V:   bit 7 of the last overflow computation.
+  uint8_t p_ = kInterruptDisable;
+  uint16_t nz_result_ = 1;
+  uint8_t carry_ = 0;
+  uint8_t overflow_result_ = 0;
+
+  bool nmi_pending_ = false;
+  bool irq_asserted_ = false;
+
+  uint64_t cycles_ = 0;
+  // Cycle at which RunToDeadline() returns. Yield() clears it.
+  uint64_t deadline_ = 0;
+  bool yielded_ = false;
+  Scheduler* scheduler_ = nullptr;
+  // Cycles left of the instruction being stepped through by Tick().
+  int stall_cycles_ = 0;
+
+  std::array<DecodedInstruction, kCodeCacheSize> code_cache_;
+  // Code bank id per 256-byte page.
+  std::array<uint16_t, 256> code_banks_{};
+  // Pages holding at least one cached instruction; writes to them must
+  // invalidate overlapping entries.
+  std::array<bool, 256> code_pages_{};
+  // Decoding target for instructions that are not cached.
+  DecodedInstruction uncached_{};
+
+  OpcodePairProfile* pair_profile_ = nullptr;
+  bool idle_loop_skipping_ = false;
+  std::array<IdleLoop, kIdleLoopCacheSize> idle_loops_;
+  uint64_t skipped_cycles_ = 0;
+
+  // Block of the code set by SetCompiledCode() starting at the instruction
+  // in the same code cache slot, if there is one.
+  std::array<CompiledFunction, kCodeCacheSize> compiled_blocks_{};
+  // Null unless the JIT backend is selected.
+  std::unique_ptr<Jit> jit_;
+  const CompiledCode* compiled_code_ = nullptr;
+  // Set when cached code was overwritten or a code bank switched, so a
+  // compiled block stops before running stale instructions.
+  bool block_exit_ = false;
+};
+
+}  // namespace purenes
+
 #endif //PURENES_CPU_H
@@ -0,0 +1,80 @@
+#ifndef PURENES_OBSERVATION_H
+#define PURENES_OBSERVATION_H
+
+#include <cstdint>
+#include <vector>
+
+#include "ppu.h"
+
+namespace purenes {
+
+// Turns frames into the observations that reinforcement learning agents
+// usually take: grayscale, the brighter of the last two frames in every
+// pixel, which undoes sprite flicker, and scaled down, 84 by 84 unless
+// configured otherwise.
+//
+// Frames are taken as palette indices, straight from Ppu::frame(), and
+// never built as color. Luma comes from the same table as
+// PixelFormat::kGray8. Scaling averages the area that every observed pixel
+// covers, in integers, so results are the same on every host. Luma, the
+// maximum and the vertical half of scaling are vectorized.
+class Observation {
+ public:
+  static constexpr int kDefaultSize = 84;
+
+  // `simd` has to be supported by the host; all give the same result.
+  explicit Observation(int width = kDefaultSize, int height = kDefaultSize,
+                       Ppu::Simd simd = Ppu::HostSimd());
+
+  Observation(const Observation&) = delete;
+  Observation& operator=(const Observation&) = delete;
+
+  // Observes a completed frame of Ppu::kWidth by Ppu::kHeight pixels,
+  // numbered `number` as in Ppu::frame_count(). It is only pooled with the
+  // frame added before if that is number - 1, so with frame skipping the
+  // last two frames of every skip window have to be added for flicker to
+  // be undone; otherwise the observation is of the last frame alone.
+  void AddFrame(const uint16_t* frame, uint64_t number);
+  // Observes the frame following the one added before.
+  void AddFrame(const uint16_t* frame) { AddFrame(frame, number_ + 1); }
+  // Forgets the frames added so far, as at the start of an episode.
+  void Clear();
+
+  // width() * height() bytes of luma, row by row. All 0 until a frame is
+  // added.
+  const uint8_t* pixels() const { return pixels_.data(); }
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+ private:
+  // The source pixels along one axis that an observed pixel covers, with
+  // the length of each that it covers as the weight. Weights add up to the
+  // source length.
+  struct Span {
+    int first;
+    std::vector<uint32_t> weights;
+  };
+
+  static std::vector<Span> Spans(int source, int target);
+
+  int width_;
+  int height_;
+  Ppu::Simd simd_;
+  std::vector<Span> columns_;
+  std::vector<Span> rows_;
+
+  // Luma of the last two frames at full size, and their maximum.
+  std::vector<uint8_t> current_;
+  std::vector<uint8_t> previous_;
+  std::vector<uint8_t> pooled_;
+  // Number of the frame in current_.
+  uint64_t number_ = 0;
+  // Weighted sums of the pooled luma in every column over the rows that an
+  // observed row covers.
+  std::vector<uint16_t> column_sums_;
+  std::vector<uint8_t> pixels_;
+};
+
+}  // namespace purenes
+
+#endif //PURENES_OBSERVATION_H
@@ -0,0 +1,48 @@
+#ifndef PURENES_OPCODE_PAIR_PROFILE_H
+#define PURENES_OPCODE_PAIR_PROFILE_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace purenes {
+
+// Counts how often each opcode is executed directly after another, to pick
+// the superinstructions in PURENES_FUSIONS from a real workload. Attach it
+// with Cpu::SetOpcodePairProfile() and run the workload with Step().
+class OpcodePairProfile {
+ public:
+  struct Pair {
+    uint8_t first;
+    uint8_t second;
+    uint64_t count;
+  };
+
+  OpcodePairProfile();
+
+  // Records the execution of `opcode`.
+  void Record(uint8_t opcode);
+  // Records an interrupt, which separates the instructions around it.
+  void Interrupt();
+
+  uint64_t count(uint8_t first, uint8_t second) const {
+    return counts_[first << 8 | second];
+  }
+  uint64_t total() const { return total_; }
+
+  // Returns up to `limit` of the most frequent pairs, most frequent first.
+  std::vector<Pair> Top(size_t limit) const;
+
+  // Writes the `limit` most frequent pairs with their share of all pairs.
+  void Report(size_t limit, std::ostream& out) const;
+
+ private:
+  std::vector<uint64_t> counts_;
+  uint64_t total_ = 0;
+  // The opcode executed last, or -1 after an interrupt.
+  int previous_ = -1;
+};
+
+}  // namespace purenes
+
+#endif //PURENES_OPCODE_PAIR_PROFILE_H
@@ -0,0 +1,42 @@
+#ifndef PURENES_PIXEL_FORMAT_H
+#define PURENES_PIXEL_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ppu.h"
+
+namespace purenes {
+
+// Formats that the palette indices of Ppu::frame() convert to.
+enum class PixelFormat : uint8_t {
+  // Bytes R, G, B, A.
+  kRgba8888,
+  // Bytes B, G, R, A, which is 0xAARRGGBB as a little-endian uint32_t.
+  kBgra8888,
+  // A uint16_t with red in bits 11-15, green in 5-10 and blue in 0-4.
+  kRgb565,
+  // A byte of luma.
+  kGray8,
+  // The palette index itself as a uint16_t, as in Ppu::frame(), for callers
+  // that apply their own palette or need no colors at all.
+  kIndex16,
+};
+
+// Bytes that a pixel takes in `format`.
+size_t BytesPerPixel(PixelFormat format);
+
+// Converts `count` palette indices to `format` at `out`.
+//
+// Every color and emphasis combination has its entry in a 512-entry table
+// per format, so converting is a lookup per pixel, with AVX2 gathers where
+// the host has them. With SSSE3, kGray8 looks up 16 pixels that share
+// their emphasis bits with byte shuffles, 16 table entries at a time.
+// Emphasis dims the other two channels once per emphasized channel. `simd`
+// has to be supported by the host; all give the same result.
+void ConvertPixels(const uint16_t* pixels, size_t count, PixelFormat format,
+                   void* out, Ppu::Simd simd = Ppu::HostSimd());
+
+}  // namespace purenes
+
+#endif //PURENES_PIXEL_FORMAT_H
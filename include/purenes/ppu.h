@@ -0,0 +1,344 @@
+#ifndef PURENES_PPU_H
+#define PURENES_PPU_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "accuracy.h"
+#include "bus.h"
+#include "chr_memory.h"
+#include "region.h"
+
+namespace purenes {
+
+class Cpu;
+class Scheduler;
+struct ScanlineKernels;
+enum class PixelFormat : uint8_t;
+
+// The 2C02 picture processing unit, emulated dot by dot.
+//
+// The PPU does not run in lockstep with the CPU. It is a timestamped device
+// that catches up to the CPU's cycle counter only when its state can be
+// observed or changed: when the CPU accesses one of its registers, when the
+// cartridge switches pattern memory or mirroring, and at its scheduled
+// events. Everything in between runs as one tight loop over the dots. The
+// only event that the CPU can notice without an access is the VBlank NMI,
+// which the PPU schedules on the CPU's Scheduler (Scheduler::kPpu) so that
+// RunUntil() stops right after it to take the NMI. Since catching up in bulk
+// runs exactly the dots that lockstep would, frames are identical either
+// way.
+//
+// Scanlines that run from start to end within one catch-up, which is all
+// of them unless the CPU accesses the PPU in the middle of one, are not
+// emulated dot by dot: the whole scanline is fetched and rendered in one
+// call, with the same result. A scanline that an access splits runs dot by
+// dot, so that the access sees and changes the state at its exact dot.
+//
+// Whole scanlines are composed with vector instructions where the host
+// has them (see Simd), picked at runtime.
+//
+// The dot loop is instantiated for every Region, and the instantiation for
+// the PPU's region is picked once at construction.
+//
+// Map it with Bus::MapDevice(0x2000, 0x2000, &ppu, 0x2007).
+class Ppu : public BusDevice {
+ public:
+  static constexpr int kWidth = 256;
+  static constexpr int kHeight = 240;
+
+  static constexpr int kDotsPerScanline = 341;
+
+  enum class Mirroring { kHorizontal, kVertical };
+
+  // Instruction sets that whole scanlines can be composed with, each
+  // implying the ones before. All draw the same frames.
+  enum class Simd : uint8_t { kNone, kSsse3, kAvx2 };
+
+  // The best Simd that the host supports, which a new PPU uses. kNone on
+  // hosts other than x86.
+  static Simd HostSimd();
+
+  // Both have to outlive the PPU. Takes over the scheduler's kPpu slot.
+  Ppu(Cpu& cpu, Scheduler& scheduler, Region region = Region::kNtsc);
+
+  Ppu(const Ppu&) = delete;
+  Ppu& operator=(const Ppu&) = delete;
+
+  // Resets as the console's reset button does: PPUCTRL, PPUMASK, the scroll
+  // and address latch and the read buffer clear, while the timing, memory
+  // and PPUSTATUS carry on. Reschedules VBlank, for after
+  // Scheduler::Reset().
+  void Reset();
+
+  // Points pattern table accesses ($0000-$1FFF) at the 8KB of `chr` from
+  // `offset` on. `chr` has to stay valid until replaced. Writes through
+  // $2007 go to it, and change it if it is RAM.
+  void SetPatternMemory(ChrMemory* chr, size_t offset);
+  void SetMirroring(Mirroring mirroring);
+
+  // Selects how register accesses catch up (see Accuracy). Takes effect
+  // with the next access.
+  void SetAccuracy(Accuracy accuracy);
+  // Composes whole scanlines with `simd`, which the host has to support.
+  void SetSimd(Simd simd);
+  Simd simd() const { return simd_; }
+
+  // Without video output, whole scanlines are not drawn: only whether
+  // sprite 0 hits is worked out, from the opaque masks of the decoded
+  // tiles, and everything the CPU can observe stays the same. frame() then
+  // keeps stale pixels, except on scanlines that accesses split, which are
+  // still drawn. Takes effect with the next scanline.
+  void SetVideoOutput(bool enabled) { video_output_ = enabled; }
+  bool video_output() const { return video_output_; }
+
+  // Also writes every scanline, once drawn, to `pixels` in `format`, with
+  // row y at `pixels` + y * `stride` bytes, so that callers need not copy
+  // frames out of frame(). The buffer has to hold kHeight rows and stay
+  // valid until replaced; null stops the output. Frames run without video
+  // output leave it alone.
+  void SetOutput(void* pixels, ptrdiff_t stride, PixelFormat format);
+
+  // Runs the dots that happen before CPU cycle `cycle` starts. Never goes
+  // backwards.
+  void CatchUp(uint64_t cycle) { (this->*catch_up_)(cycle); }
+
+  // Registers, addressed as $2000-$2007.
+  uint8_t Read(uint16_t address) override;
+  void Write(uint16_t address, uint8_t data) override;
+  bool HasReadSideEffects(uint16_t address) override;
+  // Reads of PPUSTATUS repeat until VBlank starts or its flag clears, so
+  // that loops waiting for VBlank can be skipped. While rendering, they do
+  // not repeat as long as sprite evaluation can still set the sprite 0 hit
+  // or overflow flag before, which keeps polls for those running.
+  uint64_t ReadStableUntil(uint16_t address) override;
+
+  // The last 256 bytes an OAM DMA copies through $2004.
+  void WriteOam(uint8_t data);
+
+  // Pixels of the frame being drawn, row by row, as palette indices: the
+  // color (0-63) in bits 0-5 and the PPUMASK emphasis bits (red, green,
+  // blue) in bits 6-8. ConvertPixels() turns them into colors. The frame is
+  // complete when frame_count() increments at the start of VBlank.
+  const uint16_t* frame() const { return frame_.data(); }
+  // Number of frames completed.
+  uint64_t frame_count() const { return frame_count_; }
+  int scanline() const { return scanline_; }
+  int dot() const { return dot_; }
+  Region region() const { return region_; }
+
+ private:
+  // $2000 PPUCTRL.
+  enum Control : uint8_t {
+    kIncrement32 = 0x04,
+    kSpriteTable = 0x08,
+    kBackgroundTable = 0x10,
+    kTallSprites = 0x20,
+    kNmiEnable = 0x80,
+  };
+  // $2001 PPUMASK.
+  enum Mask : uint8_t {
+    kGrayscale = 0x01,
+    kBackgroundLeft = 0x02,
+    kSpritesLeft = 0x04,
+    kShowBackground = 0x08,
+    kShowSprites = 0x10,
+    kEmphasis = 0xE0,
+  };
+  // $2002 PPUSTATUS.
+  enum Status : uint8_t {
+    kSpriteOverflow = 0x20,
+    kSpriteZeroHit = 0x40,
+    kVblank = 0x80,
+  };
+
+  static constexpr int kMaxSpritesPerLine = 8;
+
+  // Tiles that a scanline's pixels come from: the two prefetched on the
+  // previous scanline and the 32 fetched while drawing. Scrolled by fine X,
+  // up to 33 are visible.
+  static constexpr int kScanlineTiles = 34;
+
+  // The sprites that sprite evaluation selects on a visible scanline.
+  struct SpriteList {
+    std::array<uint8_t, kMaxSpritesPerLine> sprites;
+    int count;
+    bool sprite_zero;
+    // Whether the search for a ninth sprite finds one.
+    bool overflow;
+  };
+
+  // A sprite selected for the next scanline, with its pattern row fetched
+  // and flipped as drawn.
+  struct LineSprite {
+    uint8_t x;
+    uint8_t attributes;
+    std::array<uint8_t, 8> pixels;
+    // As in ChrMemory::Row.
+    uint8_t opaque;
+  };
+
+  // Selects the instantiations for `kRegion`.
+  template <Region kRegion>
+  void SetUp();
+  template <Region kRegion>
+  void SelectSync(Accuracy accuracy);
+
+  template <Region kRegion>
+  void CatchUpIn(uint64_t cycle);
+  // Catches up to the cycle in which the CPU accesses a register: the last
+  // one of the current instruction, which cycles() already counts. With
+  // kScanline accuracy, only up to the start of that cycle's scanline.
+  template <Region kRegion, Accuracy kAccuracy>
+  void Sync();
+  // Runs the scanlines that end at or before dot `target`.
+  template <Region kRegion>
+  void RunScanlines(uint64_t target);
+  // Dots in the current scanline, one less for an odd frame's pre-render
+  // scanline that skips a dot.
+  template <Region kRegion>
+  int ScanlineDots() const;
+  // Runs the whole current scanline from dot 0 in one go.
+  template <Region kRegion>
+  void RunScanline();
+  // Schedules the event for the next start of VBlank.
+  template <Region kRegion>
+  void ScheduleVblank();
+  // ReadStableUntil() of PPUSTATUS.
+  template <Region kRegion>
+  uint64_t StatusStableUntil();
+
+  // Advances by one dot.
+  template <Region kRegion>
+  void Tick();
+  void RenderPixel();
+  // Converts the current scanline of frame_ to the output, if any.
+  void OutputScanline();
+  void FetchBackground();
+  void ReloadBackgroundShifters();
+
+  // Scanline counterparts of the above, for the visible scanlines.
+  void RenderScanline();
+  // Fetches and draws the pixels of a visible scanline while rendering.
+  void ComposeScanline();
+  // Whether sprite 0 hits on the current scanline, before its tiles are
+  // fetched.
+  bool SpriteZeroHits();
+  // The opaque mask of tile `tile` (0-33) of the current scanline, before
+  // its tiles are fetched.
+  uint8_t BackgroundOpaque(int tile);
+  // Fetches the tiles of dots 1-256 as the background pixels, palette
+  // index or 0, that RenderPixel() would shift out with no fine X scroll.
+  void FetchScanlineTiles(uint8_t* pixels);
+  // Moves v_ on as fetching the tiles of dots 1-256 would.
+  void SkipScanlineTiles();
+  // Fetches the two tiles of dots 321-337 into the shifters.
+  void PrefetchTiles();
+  // Fetches the attribute and pattern of next_tile_ and moves on to the
+  // next tile.
+  void FetchTile();
+  void EvaluateSprites();
+  // Rebuilds sprite_lists_ from OAM for sprites `height` rows tall.
+  void BuildSpriteLists(int height);
+  void FetchSprites();
+
+  void IncrementX();
+  void IncrementY();
+  uint16_t AttributeAddress() const;
+  uint8_t AttributeBits(uint8_t attribute) const;
+  uint16_t BackgroundPatternAddress() const;
+  // The decoded pattern row at `address`.
+  const ChrMemory::Row& PatternRow(uint16_t address);
+  bool rendering() const { return mask_ & (kShowBackground | kShowSprites); }
+  // The emphasis bits of frame() pixels.
+  uint16_t emphasis() const {
+    return static_cast<uint16_t>((mask_ & kEmphasis) << 1);
+  }
+  // Whether the current scanline fetches, visible or pre-render.
+  bool fetching_scanline() const {
+    return scanline_ < kHeight || scanline_ == pre_render_scanline_;
+  }
+
+  uint8_t ReadMemory(uint16_t address) const;
+  void WriteMemory(uint16_t address, uint8_t data);
+  uint16_t NametableIndex(uint16_t address) const;
+  static uint8_t PaletteIndex(uint16_t address);
+
+  Cpu& cpu_;
+  Scheduler& scheduler_;
+  const Region region_;
+  // The last scanline of the region's frames.
+  int pre_render_scanline_ = 0;
+  // CatchUpIn() of the region, and Sync() of the region and the selected
+  // accuracy.
+  void (Ppu::*catch_up_)(uint64_t) = nullptr;
+  void (Ppu::*sync_)() = nullptr;
+  Simd simd_ = Simd::kNone;
+  const ScanlineKernels* kernels_ = nullptr;
+  bool video_output_ = true;
+
+  uint8_t control_ = 0;
+  uint8_t mask_ = 0;
+  uint8_t status_ = 0;
+  // status_ as the last read of it left it.
+  uint8_t read_status_ = 0;
+  uint8_t oam_address_ = 0;
+  // The last value written to or read from a register.
+  uint8_t io_latch_ = 0;
+  uint8_t read_buffer_ = 0;
+
+  // Scroll registers: the current and temporary VRAM addresses, the fine X
+  // scroll and the shared write toggle of $2005 and $2006.
+  uint16_t v_ = 0;
+  uint16_t t_ = 0;
+  uint8_t fine_x_ = 0;
+  bool write_toggle_ = false;
+
+  // Background pipeline.
+  uint8_t next_tile_ = 0;
+  uint8_t next_attribute_ = 0;
+  uint8_t next_low_ = 0;
+  uint8_t next_high_ = 0;
+  uint16_t pattern_low_ = 0;
+  uint16_t pattern_high_ = 0;
+  uint16_t attribute_low_ = 0;
+  uint16_t attribute_high_ = 0;
+
+  // What sprite evaluation finds on each visible scanline, built from OAM
+  // when first needed after OAM or the sprite height changes. The height is
+  // that of the sprites they were built for, or 0 once OAM changes.
+  std::array<SpriteList, kHeight> sprite_lists_{};
+  int sprite_lists_height_ = 0;
+
+  // Sprites of the current scanline, and of the next one once evaluated.
+  std::array<LineSprite, kMaxSpritesPerLine> sprites_{};
+  int sprite_count_ = 0;
+  bool sprite_zero_on_line_ = false;
+  std::array<uint8_t, kMaxSpritesPerLine> next_sprites_{};
+  int next_sprite_count_ = 0;
+  bool sprite_zero_next_ = false;
+
+  int scanline_ = 0;
+  int dot_ = 0;
+  bool odd_frame_ = false;
+  // Dots run since power-on; CPU cycle c starts at dot 3c.
+  uint64_t dots_ = 0;
+  uint64_t frame_count_ = 0;
+
+  ChrMemory* chr_ = nullptr;
+  size_t chr_offset_ = 0;
+  Mirroring mirroring_ = Mirroring::kHorizontal;
+  std::array<uint8_t, 0x800> nametables_{};
+  std::array<uint8_t, 32> palette_{};
+  std::array<uint8_t, 256> oam_{};
+
+  std::array<uint16_t, kWidth * kHeight> frame_{};
+  uint8_t* output_ = nullptr;
+  ptrdiff_t output_stride_ = 0;
+  PixelFormat output_format_{};
+};
+
+}  // namespace purenes
+
+#endif //PURENES_PPU_H
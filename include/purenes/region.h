@@ -0,0 +1,59 @@
+#ifndef PURENES_REGION_H
+#define PURENES_REGION_H
+
+#include <cstdint>
+
+namespace purenes {
+
+// The console variants, which differ in their clocks and frame timing.
+enum class Region : uint8_t {
+  kNtsc,
+  kPal,
+  // The common Famiclone: PAL clocks with an NTSC-like picture.
+  kDendy,
+};
+
+// The timing of `kRegion` as compile-time constants. Components run their
+// loops as instantiations for each region, so the constants are immediates
+// there and the loops never branch on the region.
+template <Region kRegion>
+struct RegionTiming {
+  // Master clock cycles per CPU cycle and per PPU dot.
+  static constexpr int kCpuDivider =
+      kRegion == Region::kNtsc ? 12 : kRegion == Region::kPal ? 16 : 15;
+  static constexpr int kPpuDivider = kRegion == Region::kNtsc ? 4 : 5;
+
+  static constexpr int kScanlinesPerFrame =
+      kRegion == Region::kNtsc ? 262 : 312;
+  // The scanline on which VBlank starts. The Dendy draws its extra lines
+  // before VBlank, so that it keeps NTSC's VBlank length.
+  static constexpr int kVblankScanline = kRegion == Region::kDendy ? 291 : 241;
+  // Whether odd frames skip a dot of the pre-render scanline while
+  // rendering.
+  static constexpr bool kSkipsOddFrameDot = kRegion == Region::kNtsc;
+
+  // The first PPU dot that happens in CPU cycle `cycle` or later. Both
+  // start together at power-on.
+  static constexpr uint64_t FirstDot(uint64_t cycle) {
+    return (cycle * kCpuDivider + kPpuDivider - 1) / kPpuDivider;
+  }
+  // The CPU cycle that PPU dot `dot` happens in.
+  static constexpr uint64_t CycleOfDot(uint64_t dot) {
+    return dot * kPpuDivider / kCpuDivider;
+  }
+};
+
+template <Region kRegion>
+constexpr int RegionTiming<kRegion>::kCpuDivider;
+template <Region kRegion>
+constexpr int RegionTiming<kRegion>::kPpuDivider;
+template <Region kRegion>
+constexpr int RegionTiming<kRegion>::kScanlinesPerFrame;
+template <Region kRegion>
+constexpr int RegionTiming<kRegion>::kVblankScanline;
+template <Region kRegion>
+constexpr bool RegionTiming<kRegion>::kSkipsOddFrameDot;
+
+}  // namespace purenes
+
+#endif //PURENES_REGION_H
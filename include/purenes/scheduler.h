@@ -0,0 +1,82 @@
+#ifndef PURENES_SCHEDULER_H
+#define PURENES_SCHEDULER_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+namespace purenes {
+
+class Cpu;
+
+// Timed events of the devices around the CPU, in CPU cycles.
+//
+// Every event source owns one slot holding at most one pending event, so
+// the next event is the minimum of a handful of cycles. It is cached and
+// only recomputed when a slot changes, which keeps the check that the CPU
+// makes when it reaches a deadline cheap. Attached with Cpu::SetScheduler(),
+// the CPU runs uninterrupted instruction batches up to the next event and
+// calls the handlers of due events between them, instead of every device
+// being polled each cycle.
+class Scheduler {
+ public:
+  enum Slot : uint8_t {
+    // Dot-level events of the PPU, such as VBlank raising an NMI.
+    kPpu,
+    // The APU frame counter's steps and frame IRQ.
+    kApuFrameCounter,
+    // DMC sample fetches.
+    kDmc,
+    // Cartridge mapper IRQ counters.
+    kMapper,
+    kSlotCount,
+  };
+
+  static constexpr uint64_t kNever = UINT64_MAX;
+
+  // Called with the cycle the event was scheduled for, which the CPU may
+  // have passed by up to the length of an instruction.
+  using Handler = std::function<void(uint64_t cycle)>;
+
+  Scheduler();
+  // Detaches from the CPU it is attached to, which may outlive it.
+  ~Scheduler();
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  void SetHandler(Slot slot, Handler handler);
+
+  // Schedules the event of `slot` at `cycle`, replacing a pending one. The
+  // attached CPU stops at `cycle` to run it even while in the middle of a
+  // RunUntil() call, as when a device schedules an event from a bus access.
+  void Schedule(Slot slot, uint64_t cycle);
+  void Cancel(Slot slot);
+  // Cancels every pending event, keeping the handlers.
+  void Reset();
+
+  // Cycle of the event of `slot`, or kNever if none is pending.
+  uint64_t scheduled(Slot slot) const { return cycles_[slot]; }
+  // Cycle of the earliest pending event, or kNever.
+  uint64_t next() const { return next_; }
+
+  // Runs the handlers of all events due at `cycle`, earliest first. An
+  // event is unscheduled before its handler runs, which may schedule it
+  // again but has to do so after `cycle`.
+  void RunDue(uint64_t cycle);
+
+ private:
+  friend class Cpu;
+
+  void UpdateNext();
+
+  std::array<uint64_t, kSlotCount> cycles_;
+  std::array<Handler, kSlotCount> handlers_;
+  uint64_t next_ = kNever;
+  // Set by Cpu::SetScheduler().
+  Cpu* cpu_ = nullptr;
+};
+
+}  // namespace purenes
+
+#endif //PURENES_SCHEDULER_H
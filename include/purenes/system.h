@@ -0,0 +1,141 @@
+#ifndef PURENES_SYSTEM_H
+#define PURENES_SYSTEM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "accuracy.h"
+#include "apu.h"
+#include "bus.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "observation.h"
+#include "pixel_format.h"
+#include "ppu.h"
+#include "region.h"
+#include "scheduler.h"
+
+namespace purenes {
+
+// A complete NES: CPU, PPU, APU, controllers and a cartridge on one bus.
+//
+// The CPU runs ahead in batches up to the next scheduled event, and the PPU
+// and APU catch up to its cycle counter when their registers in
+// $2000-$401F are accessed or one of their events is due. Most CPU cycles
+// never touch them, so each component spends its time in its own tight
+// loop rather than interleaving with the others every cycle. SetAccuracy()
+// trades this for coarser catch-up.
+//
+// Loops that wait for an NMI or poll PPUSTATUS for VBlank are skipped
+// rather than run (see Cpu::SetIdleLoopSkipping()), with the same results.
+class System {
+ public:
+  // Standard controller buttons, in the order they are shifted out.
+  enum Button : uint8_t {
+    kButtonA = 0x01,
+    kButtonB = 0x02,
+    kButtonSelect = 0x04,
+    kButtonStart = 0x08,
+    kButtonUp = 0x10,
+    kButtonDown = 0x20,
+    kButtonLeft = 0x40,
+    kButtonRight = 0x80,
+  };
+
+  // Powers on with `cartridge` inserted, as a console of the cartridge's
+  // region.
+  explicit System(std::unique_ptr<Cartridge> cartridge);
+
+  System(const System&) = delete;
+  System& operator=(const System&) = delete;
+
+  // Presses the reset button, which resets the CPU, PPU and APU (see
+  // Ppu::Reset() and Apu::Reset()) but keeps memory. Also works between
+  // the instructions of a frame.
+  void Reset();
+
+  // Runs until the PPU completes a frame, at the start of VBlank. Unless
+  // `render`, the frame is not drawn and frame() keeps stale pixels, while
+  // everything the game can observe runs exactly as it would otherwise (see
+  // Ppu::SetVideoOutput()). For skipping frames that nobody looks at; an
+  // Observation that should undo flicker needs the last two frames of each
+  // skip window drawn.
+  void RunFrame(bool render = true) {
+    ppu_.SetVideoOutput(render);
+    (this->*run_frame_)();
+    if (render && observation_) {
+      observation_->AddFrame(frame(), ppu_.frame_count());
+    }
+  }
+
+  // Selects how the following frames are synchronized; switching between
+  // frames is seamless. The default is kInstruction.
+  void SetAccuracy(Accuracy accuracy);
+  Accuracy accuracy() const { return accuracy_; }
+
+  // Sets the buttons held on the controller in `port` (0 or 1).
+  void SetButtons(int port, uint8_t buttons) { buttons_[port] = buttons; }
+
+  // The last completed frame; see Ppu::frame().
+  const uint16_t* frame() const { return ppu_.frame(); }
+  // Adds every frame that RunFrame() draws to `observation`, which has to
+  // stay valid until replaced; null stops.
+  void SetObservation(Observation* observation) { observation_ = observation; }
+  // Has the frames written to `pixels` as well; see Ppu::SetOutput().
+  void SetOutput(void* pixels, ptrdiff_t stride, PixelFormat format) {
+    ppu_.SetOutput(pixels, stride, format);
+  }
+
+  Bus& bus() { return bus_; }
+  Cpu& cpu() { return cpu_; }
+  Ppu& ppu() { return ppu_; }
+  Apu& apu() { return apu_; }
+  Cartridge& cartridge() { return *cartridge_; }
+  Region region() const { return ppu_.region(); }
+
+ private:
+  // $4000-$401F: the APU, OAM DMA and the controller ports.
+  class Io : public BusDevice {
+   public:
+    explicit Io(System& system) : system_(system) {}
+
+    uint8_t Read(uint16_t address) override;
+    void Write(uint16_t address, uint8_t data) override;
+    bool HasReadSideEffects(uint16_t address) override;
+
+   private:
+    System& system_;
+  };
+
+  // RunFrame() at `kAccuracy`.
+  template <Accuracy kAccuracy>
+  void RunFrameAt();
+
+  // Copies page `page` to OAM and halts the CPU for the duration.
+  void OamDma(uint8_t page);
+
+  // Declared first so that the CPU can detach from it on destruction.
+  Scheduler scheduler_;
+  Bus bus_;
+  Cpu cpu_;
+  Ppu ppu_;
+  Apu apu_;
+  Io io_;
+  std::unique_ptr<Cartridge> cartridge_;
+
+  Accuracy accuracy_ = Accuracy::kInstruction;
+  void (System::*run_frame_)() = &System::RunFrameAt<Accuracy::kInstruction>;
+  Observation* observation_ = nullptr;
+
+  std::array<uint8_t, 2> buttons_{};
+  // Controller shift registers, reloaded from buttons_ while the strobe is
+  // high.
+  std::array<uint8_t, 2> shifters_{};
+  bool strobe_ = false;
+};
+
+}  // namespace purenes
+
+#endif //PURENES_SYSTEM_H
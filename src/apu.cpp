@@ -0,0 +1,251 @@
+#include "apu.h"
+
+#include "cpu.h"
+#include "scheduler.h"
+
+namespace purenes {
+
+namespace {
+
+// Row of the NTSC and the PAL timing in the tables below. The Dendy's
+// frame counter counts as the NTSC one does, while its DMC runs at the PAL
+// rates that match its clock.
+constexpr int FrameCounterTiming(Region region) {
+  return region == Region::kPal ? 1 : 0;
+}
+constexpr int DmcTiming(Region region) {
+  return region == Region::kNtsc ? 0 : 1;
+}
+
+// CPU cycles from the start of the frame counter's sequence to each of its
+// four steps, in the 4-step and the 5-step mode, and the length of the
+// sequence. The 5-step mode's silent step is left out.
+constexpr uint64_t kFrameSteps[2][2][4] = {
+    {{7457, 14913, 22371, 29829}, {7457, 14913, 22371, 37281}},
+    {{8313, 16627, 24939, 33252}, {8313, 16627, 24939, 41565}},
+};
+constexpr uint64_t kFramePeriods[2][2] = {{29830, 37282}, {33254, 41566}};
+
+constexpr uint8_t kLengths[32] = {
+    10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+    12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+// CPU cycles per bit of DMC output, by rate index.
+constexpr uint16_t kDmcPeriods[2][16] = {
+    {428, 380, 340, 320, 286, 254, 226, 214,
+     190, 160, 142, 128, 106, 84, 72, 54},
+    {398, 354, 316, 298, 276, 236, 210, 198,
+     176, 148, 132, 118, 98, 78, 66, 50},
+};
+
+// Cycles the CPU is halted for each DMC sample fetch.
+constexpr int kDmcStallCycles = 4;
+
+}  // namespace
+
+Apu::Apu(Cpu& cpu, Scheduler& scheduler, CpuBus& bus, Region region)
+    : cpu_(cpu), scheduler_(scheduler), bus_(bus) {
+  switch (region) {
+    case Region::kNtsc:
+      SetUp<Region::kNtsc>();
+      break;
+    case Region::kPal:
+      SetUp<Region::kPal>();
+      break;
+    case Region::kDendy:
+      SetUp<Region::kDendy>();
+      break;
+  }
+  RestartFrameCounter(cpu_.cycles());
+  ScheduleEvents();
+}
+
+template <Region kRegion>
+void Apu::SetUp() {
+  catch_up_ = &Apu::CatchUpIn<kRegion>;
+  schedule_events_ = &Apu::ScheduleEventsIn<kRegion>;
+  scheduler_.SetHandler(Scheduler::kApuFrameCounter, [this](uint64_t) {
+    CatchUpIn<kRegion>(cpu_.cycles());
+  });
+  scheduler_.SetHandler(Scheduler::kDmc, [this](uint64_t) {
+    CatchUpIn<kRegion>(cpu_.cycles());
+  });
+}
+
+template <Region kRegion>
+void Apu::CatchUpIn(uint64_t cycle) {
+  const uint64_t(&steps)[4] =
+      kFrameSteps[FrameCounterTiming(kRegion)][five_step_ ? 1 : 0];
+  for (;;) {
+    const uint64_t step = frame_start_ + steps[frame_step_];
+    const bool fetch_due = bytes_remaining_ > 0 && next_fetch_ < cycle;
+    if (fetch_due && next_fetch_ <= step) {
+      FetchSample<kRegion>();
+    } else if (step < cycle) {
+      RunFrameStep<kRegion>();
+    } else if (fetch_due) {
+      FetchSample<kRegion>();
+    } else {
+      break;
+    }
+  }
+  ScheduleEventsIn<kRegion>();
+}
+
+void Apu::Sync() {
+  if (cpu_.cycles() > 0) CatchUp(cpu_.cycles() - 1);
+}
+
+void Apu::UpdateIrq() { cpu_.SetIrq(irq()); }
+
+template <Region kRegion>
+void Apu::ScheduleEventsIn() {
+  UpdateIrq();
+  // Events run once the cycle they happen in has passed.
+  const uint64_t(&steps)[4] =
+      kFrameSteps[FrameCounterTiming(kRegion)][five_step_ ? 1 : 0];
+  scheduler_.Schedule(Scheduler::kApuFrameCounter,
+                      frame_start_ + steps[frame_step_] + 1);
+  if (bytes_remaining_ > 0) {
+    scheduler_.Schedule(Scheduler::kDmc, next_fetch_ + 1);
+  } else {
+    scheduler_.Cancel(Scheduler::kDmc);
+  }
+}
+
+void Apu::Reset() {
+  Sync();
+  enabled_ = 0;
+  length_counters_.fill(0);
+  bytes_remaining_ = 0;
+  dmc_irq_ = false;
+  frame_irq_ = false;
+  RestartFrameCounter(cpu_.cycles());
+  ScheduleEvents();
+}
+
+uint8_t Apu::Read(uint16_t address) {
+  if (address != 0x4015) return static_cast<uint8_t>(address >> 8);
+  Sync();
+  uint8_t status = 0;
+  for (int i = 0; i < kChannels; ++i) {
+    if (length_counters_[i] > 0) status |= 1 << i;
+  }
+  if (bytes_remaining_ > 0) status |= 0x10;
+  if (frame_irq_) status |= 0x40;
+  if (dmc_irq_) status |= 0x80;
+  frame_irq_ = false;
+  UpdateIrq();
+  return status;
+}
+
+void Apu::Write(uint16_t address, uint8_t data) {
+  Sync();
+  switch (address) {
+    case 0x4000:
+    case 0x4004:
+    case 0x400C:
+      length_halted_[(address - 0x4000) / 4] = data & 0x20;
+      break;
+    case 0x4008:
+      length_halted_[2] = data & 0x80;
+      break;
+    case 0x4003:
+    case 0x4007:
+    case 0x400B:
+    case 0x400F: {
+      const int channel = (address - 0x4000) / 4;
+      if (enabled_ & 1 << channel) {
+        length_counters_[channel] = kLengths[data >> 3];
+      }
+      break;
+    }
+    case 0x4010:
+      dmc_irq_enable_ = data & 0x80;
+      if (!dmc_irq_enable_) dmc_irq_ = false;
+      dmc_loop_ = data & 0x40;
+      dmc_rate_ = data & 0x0F;
+      break;
+    case 0x4012:
+      sample_start_ = static_cast<uint16_t>(0xC000 | data << 6);
+      break;
+    case 0x4013:
+      sample_length_ = static_cast<uint16_t>(data << 4 | 1);
+      break;
+    case 0x4015:
+      enabled_ = data & 0x0F;
+      for (int i = 0; i < kChannels; ++i) {
+        if (!(enabled_ & 1 << i)) length_counters_[i] = 0;
+      }
+      dmc_irq_ = false;
+      if (!(data & 0x10)) {
+        bytes_remaining_ = 0;
+      } else if (bytes_remaining_ == 0) {
+        RestartSample();
+        next_fetch_ = cpu_.cycles();
+      }
+      break;
+    case 0x4017:
+      five_step_ = data & 0x80;
+      frame_irq_inhibit_ = data & 0x40;
+      if (frame_irq_inhibit_) frame_irq_ = false;
+      RestartFrameCounter(cpu_.cycles());
+      break;
+    default:
+      break;
+  }
+  ScheduleEvents();
+}
+
+void Apu::RestartFrameCounter(uint64_t cycle) {
+  frame_start_ = cycle;
+  frame_step_ = 0;
+  // The 5-step mode clocks the length counters right away.
+  if (five_step_) ClockLengthCounters();
+}
+
+template <Region kRegion>
+void Apu::RunFrameStep() {
+  // Steps 2 and 4 are half frames.
+  if (frame_step_ & 1) ClockLengthCounters();
+  if (frame_step_ == 3) {
+    if (!five_step_ && !frame_irq_inhibit_) frame_irq_ = true;
+    frame_start_ +=
+        kFramePeriods[FrameCounterTiming(kRegion)][five_step_ ? 1 : 0];
+    frame_step_ = 0;
+  } else {
+    ++frame_step_;
+  }
+}
+
+void Apu::ClockLengthCounters() {
+  for (int i = 0; i < kChannels; ++i) {
+    if (length_counters_[i] > 0 && !length_halted_[i]) --length_counters_[i];
+  }
+}
+
+void Apu::RestartSample() {
+  sample_address_ = sample_start_;
+  bytes_remaining_ = sample_length_;
+}
+
+template <Region kRegion>
+void Apu::FetchSample() {
+  bus_.Read(sample_address_);
+  cpu_.Stall(kDmcStallCycles);
+  sample_address_ = sample_address_ == 0xFFFF
+                        ? 0x8000
+                        : static_cast<uint16_t>(sample_address_ + 1);
+  if (--bytes_remaining_ == 0) {
+    if (dmc_loop_) {
+      RestartSample();
+    } else if (dmc_irq_enable_) {
+      dmc_irq_ = true;
+    }
+  }
+  // The sample buffer empties once all 8 bits have been played.
+  next_fetch_ += 8 * kDmcPeriods[DmcTiming(kRegion)][dmc_rate_];
+}
+
+}  // namespace purenes
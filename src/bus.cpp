@@ -0,0 +1,76 @@
+#include "bus.h"
+
+#include <cassert>
+
+namespace purenes {
+
+constexpr size_t Bus::kPageSize;
+constexpr size_t Bus::kRamSize;
+
+Bus::Bus() {
+  MapMemory(0x0000, 0x2000, ram_.data(), ram_.size(), true);
+}
+
+void Bus::MapMemory(uint16_t address, size_t size, uint8_t* memory,
+                    size_t memory_size, bool writable) {
+  assert(address % kPageSize == 0 && size % kPageSize == 0);
+  assert(memory_size > 0 && memory_size % kPageSize == 0);
+  size_t offset = 0;
+  for (size_t page = address / kPageSize; page < (address + size) / kPageSize;
+       ++page) {
+    read_pages_[page] = memory + offset;
+    write_pages_[page] = writable ? memory + offset : nullptr;
+    offset = (offset + kPageSize) % memory_size;
+  }
+}
+
+void Bus::MapDevice(uint16_t address, size_t size, BusDevice* device,
+                    uint16_t mask) {
+  MapPages(address, size, device, mask);
+}
+
+void Bus::Unmap(uint16_t address, size_t size) {
+  MapPages(address, size, nullptr, 0xFFFF);
+}
+
+void Bus::MapPages(uint16_t address, size_t size, BusDevice* device,
+                   uint16_t mask) {
+  assert(address % kPageSize == 0 && size % kPageSize == 0);
+  for (size_t page = address / kPageSize; page < (address + size) / kPageSize;
+       ++page) {
+    read_pages_[page] = nullptr;
+    write_pages_[page] = nullptr;
+    devices_[page] = device;
+    masks_[page] = mask;
+  }
+}
+
+uint8_t Bus::Read(uint16_t address) {
+  const uint8_t page = address >> 8;
+  if (read_pages_[page]) return read_pages_[page][address & 0xFF];
+  if (devices_[page]) return devices_[page]->Read(address & masks_[page]);
+  return page;
+}
+
+void Bus::Write(uint16_t address, uint8_t data) {
+  const uint8_t page = address >> 8;
+  if (write_pages_[page]) {
+    write_pages_[page][address & 0xFF] = data;
+  } else if (devices_[page]) {
+    devices_[page]->Write(address & masks_[page], data);
+  }
+}
+
+bool Bus::HasReadSideEffects(uint16_t address) {
+  const uint8_t page = address >> 8;
+  if (read_pages_[page] || !devices_[page]) return false;
+  return devices_[page]->HasReadSideEffects(address & masks_[page]);
+}
+
+uint64_t Bus::ReadStableUntil(uint16_t address) {
+  const uint8_t page = address >> 8;
+  if (read_pages_[page] || !devices_[page]) return 0;
+  return devices_[page]->ReadStableUntil(address & masks_[page]);
+}
+
+}  // namespace purenes
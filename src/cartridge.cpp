@@ -0,0 +1,139 @@
+#include "cartridge.h"
+
+#include <utility>
+
+#include "cpu.h"
+
+namespace purenes {
+
+namespace {
+
+constexpr size_t kInesHeaderSize = 16;
+constexpr size_t kTrainerSize = 512;
+
+// The TV system of an iNES file: NES 2.0 files have two bits for it,
+// iNES 1.0 files only tell NTSC from PAL.
+Region InesRegion(const std::vector<uint8_t>& file) {
+  const bool nes2 = (file[7] & 0x0C) == 0x08;
+  if (!nes2) return file[9] & 0x01 ? Region::kPal : Region::kNtsc;
+  switch (file[12] & 0x03) {
+    case 1:
+      return Region::kPal;
+    case 3:
+      return Region::kDendy;
+    default:
+      // Multi-region games run as NTSC.
+      return Region::kNtsc;
+  }
+}
+
+}  // namespace
+
+constexpr size_t Cartridge::kPrgBankSize;
+constexpr size_t Cartridge::kChrBankSize;
+constexpr size_t Cartridge::kPrgRamSize;
+
+std::unique_ptr<Cartridge> Cartridge::FromInes(
+    const std::vector<uint8_t>& file, std::string* error) {
+  if (file.size() < kInesHeaderSize || file[0] != 'N' || file[1] != 'E' ||
+      file[2] != 'S' || file[3] != 0x1A) {
+    *error = "not an iNES file";
+    return nullptr;
+  }
+  const int mapper = (file[6] >> 4) | (file[7] & 0xF0);
+  if (mapper != 0 && mapper != 2 && mapper != 3) {
+    *error = "unsupported mapper " + std::to_string(mapper);
+    return nullptr;
+  }
+  const size_t prg_size = file[4] * kPrgBankSize;
+  const size_t chr_size = file[5] * kChrBankSize;
+  const size_t trainer_size = file[6] & 0x04 ? kTrainerSize : 0;
+  const size_t prg_start = kInesHeaderSize + trainer_size;
+  if (prg_size == 0 || file.size() < prg_start + prg_size + chr_size) {
+    *error = "truncated ROM";
+    return nullptr;
+  }
+
+  std::vector<uint8_t> prg(file.begin() + prg_start,
+                           file.begin() + prg_start + prg_size);
+  std::vector<uint8_t> chr(file.begin() + prg_start + prg_size,
+                           file.begin() + prg_start + prg_size + chr_size);
+  // Boards without CHR ROM have 8KB of CHR RAM.
+  const bool chr_writable = chr.empty();
+  if (chr_writable) chr.resize(kChrBankSize);
+  const Ppu::Mirroring mirroring = file[6] & 0x01
+                                       ? Ppu::Mirroring::kVertical
+                                       : Ppu::Mirroring::kHorizontal;
+  return std::unique_ptr<Cartridge>(
+      new Cartridge(mapper, std::move(prg), std::move(chr), chr_writable,
+                    mirroring, InesRegion(file)));
+}
+
+Cartridge::Cartridge(int mapper, std::vector<uint8_t> prg,
+                     std::vector<uint8_t> chr, bool chr_writable,
+                     Ppu::Mirroring mirroring, Region region)
+    : mapper_(mapper),
+      prg_(std::move(prg)),
+      chr_(std::move(chr), chr_writable),
+      mirroring_(mirroring),
+      region_(region),
+      prg_ram_(kPrgRamSize) {}
+
+void Cartridge::Connect(Bus& bus, Cpu& cpu, Ppu& ppu) {
+  bus_ = &bus;
+  cpu_ = &cpu;
+  ppu_ = &ppu;
+  bus.MapMemory(0x6000, kPrgRamSize, prg_ram_.data(), prg_ram_.size(), true);
+  bus.MapDevice(0x8000, 0x8000, this);
+  // UxROM switches $8000-$BFFF and fixes the last bank at $C000, which
+  // covers NROM and CNROM as well: a 16KB ROM appears in both halves.
+  MapPrgBank(0x8000, 0);
+  MapPrgBank(0xC000, prg_banks() - 1);
+  ppu.SetMirroring(mirroring_);
+  MapChrBank(0);
+}
+
+uint8_t Cartridge::Read(uint16_t address) {
+  // Only reached for pages that no bank covers, which never happens.
+  return static_cast<uint8_t>(address >> 8);
+}
+
+void Cartridge::Write(uint16_t address, uint8_t data) {
+  (void)address;
+  switch (mapper_) {
+    case 2:
+      MapPrgBank(0x8000, data % prg_banks());
+      break;
+    case 3:
+      MapChrBank(data % (chr_.size() / kChrBankSize));
+      break;
+    default:
+      break;
+  }
+}
+
+bool Cartridge::HasReadSideEffects(uint16_t address) {
+  (void)address;
+  return false;
+}
+
+bool Cartridge::CanMapPrgBank(size_t bank, uint16_t address) const {
+  if (address == 0xC000) return bank == prg_banks() - 1;
+  if (address != 0x8000) return false;
+  return mapper_ == 2 || bank == 0;
+}
+
+void Cartridge::MapPrgBank(uint16_t address, size_t bank) {
+  bus_->MapMemory(address, kPrgBankSize, &prg_[bank * kPrgBankSize],
+                  kPrgBankSize, false);
+  for (size_t page = 0; page < kPrgBankSize / Bus::kPageSize; ++page) {
+    cpu_->SetCodeBank(static_cast<uint8_t>((address >> 8) + page),
+                      PrgCodeBank(bank));
+  }
+}
+
+void Cartridge::MapChrBank(size_t bank) {
+  ppu_->SetPatternMemory(&chr_, bank * kChrBankSize);
+}
+
+}  // namespace purenes
@@ -0,0 +1,35 @@
+#include "chr_memory.h"
+
+#include <utility>
+
+namespace purenes {
+
+constexpr size_t ChrMemory::kTileSize;
+
+ChrMemory::ChrMemory(std::vector<uint8_t> data, bool writable)
+    : data_(std::move(data)),
+      writable_(writable),
+      rows_(data_.size() / kTileSize * 8),
+      dirty_(data_.size() / kTileSize) {
+  for (size_t tile = 0; tile < dirty_.size(); ++tile) Decode(tile);
+}
+
+void ChrMemory::Decode(size_t tile) {
+  const uint8_t* const planes = &data_[tile * kTileSize];
+  for (int y = 0; y < 8; ++y) {
+    Row& row = rows_[tile * 8 + y];
+    row.opaque = planes[y] | planes[y + 8];
+    row.opaque_flipped = 0;
+    for (int x = 0; x < 8; ++x) {
+      const int bit = 7 - x;
+      const uint8_t pixel = static_cast<uint8_t>(
+          (planes[y] >> bit & 1) | (planes[y + 8] >> bit & 1) << 1);
+      row.pixels[x] = pixel;
+      row.flipped[7 - x] = pixel;
+      if (pixel) row.opaque_flipped |= 1 << x;
+    }
+  }
+  dirty_[tile] = false;
+}
+
+}  // namespace purenes
@@ -0,0 +1,597 @@
+#include "cpu.h"
+
+#include <algorithm>
+#include <type_traits>
+
+#include "cpu_instructions.h"
+#include "jit.h"
+#include "opcode_pair_profile.h"
+#include "opcodes.h"
+#include "scheduler.h"
+
+// Direct-threaded dispatch relies on the labels-as-values extension. Other
+// compilers get a switch, which is the next best thing: the body of every
+// opcode is still inlined into the run loop.
+#if defined(PURENES_THREADED_DISPATCH) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define PURENES_COMPUTED_GOTO 1
+#endif
+
+namespace purenes {
+
+namespace {
+
+// Opcode column of the X-macro, used to verify at compile time that the list
+// is complete and sorted so that kInstructions[opcode] describes opcode.
+#define PURENES_OPCODE_NUMBER(opcode, operation, mode, cycles, penalty) opcode,
+constexpr uint8_t kOpcodeOrder[] = {PURENES_OPCODES(PURENES_OPCODE_NUMBER)};
+#undef PURENES_OPCODE_NUMBER
+
+constexpr bool IsOpcodeListSorted() {
+  for (int i = 0; i < 256; ++i) {
+    if (kOpcodeOrder[i] != i) return false;
+  }
+  return true;
+}
+
+static_assert(sizeof(kOpcodeOrder) == 256,
+              "opcodes.h must describe all 256 opcodes");
+static_assert(IsOpcodeListSorted(),
+              "opcodes.h must list the opcodes in ascending order");
+
+// Tag of an empty code cache entry. Lookups never produce it because the
+// uncached bank bypasses the cache.
+constexpr uint32_t kEmptyCodeTag = 0xFFFFFFFF;
+
+// Handler numbers following the 256 opcodes: the superinstructions, then
+// the start of a compiled block.
+#define PURENES_FUSION_HANDLER(name, first, second) kFused##name,
+enum Handler : uint16_t {
+  kLastOpcodeHandler = 0xFF,
+  PURENES_FUSIONS(PURENES_FUSION_HANDLER)
+  kRunBlock
+};
+#undef PURENES_FUSION_HANDLER
+
+// Returns the handler of the superinstruction `first` followed by `second`,
+// or `first` if there is none.
+uint16_t FusedHandlerOf(uint8_t first, uint8_t second) {
+#define PURENES_FUSION_MATCH(name, first_opcode, second_opcode) \
+  if (first == first_opcode && second == second_opcode) return kFused##name;
+  PURENES_FUSIONS(PURENES_FUSION_MATCH)
+#undef PURENES_FUSION_MATCH
+  return first;
+}
+
+// Whether `opcode` starts any superinstruction.
+bool StartsFusion(uint8_t opcode) {
+#define PURENES_FUSION_FIRST(name, first, second) \
+  if (opcode == first) return true;
+  PURENES_FUSIONS(PURENES_FUSION_FIRST)
+#undef PURENES_FUSION_FIRST
+  return false;
+}
+
+}  // namespace
+
+constexpr uint16_t Cpu::kNmiVector;
+constexpr uint16_t Cpu::kResetVector;
+constexpr uint16_t Cpu::kIrqVector;
+constexpr uint16_t Cpu::kUncachedBank;
+constexpr uint16_t Cpu::kStackBase;
+
+Cpu::Cpu(CpuBus& bus) : bus_(bus) {
+  static uint8_t* const kNoPages[256] = {};
+  read_pages_ = bus.ReadPages() ? bus.ReadPages() : kNoPages;
+  write_pages_ = bus.WritePages() ? bus.WritePages() : kNoPages;
+  InvalidateCodeCache();
+}
+
+Cpu::~Cpu() { SetScheduler(nullptr); }
+
+bool Cpu::SetBackend(Backend backend) {
+  if (backend == Backend::kInterpreter) {
+    jit_.reset();
+    InvalidateCodeCache();
+    return true;
+  }
+#if defined(PURENES_JIT_X64)
+  if (!jit_) {
+    jit_.reset(new Jit(*this));
+    if (!jit_->ok()) jit_.reset();
+    InvalidateCodeCache();
+  }
+  return jit_ != nullptr;
+#else
+  return false;
+#endif
+}
+
+void Cpu::Reset() {
+  s_ -= 3;
+  p_ |= kInterruptDisable;
+  pc_ = Read16(kResetVector);
+  nmi_pending_ = false;
+  cycles_ += 7;
+}
+
+int Cpu::Step() {
+  if (scheduler_) scheduler_->RunDue(cycles_);
+  // Idle loops are only skipped up to a RunUntil() target.
+  deadline_ = 0;
+  const uint64_t start = cycles_;
+  if (PollInterrupts()) {
+    if (pair_profile_) pair_profile_->Interrupt();
+  } else {
+    const DecodedInstruction& decoded = Decode();
+    if (pair_profile_) pair_profile_->Record(decoded.opcode);
+    Execute(decoded);
+  }
+  return static_cast<int>(cycles_ - start);
+}
+
+void Cpu::SetOpcodePairProfile(OpcodePairProfile* profile) {
+  pair_profile_ = profile;
+}
+
+#define PURENES_INSTRUCTION(opcode, operation, mode, cycles, penalty)    \
+  {&Cpu::ExecuteOpcode<opcode>, Operation::k##operation, Mode::k##mode, \
+   cycles, kOperandBytes##mode},
+const Cpu::Instruction Cpu::kInstructions[256] = {
+    PURENES_OPCODES(PURENES_INSTRUCTION)};
+#undef PURENES_INSTRUCTION
+
+void Cpu::Tick() {
+  if (stall_cycles_ == 0) stall_cycles_ = Step();
+  --stall_cycles_;
+}
+
+uint64_t Cpu::RunUntil(uint64_t target_cycle) {
+  if (!scheduler_) {
+    deadline_ = target_cycle;
+    return RunToDeadline();
+  }
+  // Instructions run in batches up to the next event, whose handlers run in
+  // between. A handler that yields ends the call like a device would.
+  yielded_ = false;
+  for (;;) {
+    scheduler_->RunDue(cycles_);
+    if (cycles_ >= target_cycle || yielded_) return cycles_;
+    deadline_ = std::min(target_cycle, scheduler_->next());
+    RunToDeadline();
+  }
+}
+
+void Cpu::SetScheduler(Scheduler* scheduler) {
+  if (scheduler_) scheduler_->cpu_ = nullptr;
+  scheduler_ = scheduler;
+  if (scheduler_) scheduler_->cpu_ = this;
+}
+
+void Cpu::Preempt(uint64_t cycle) { deadline_ = std::min(deadline_, cycle); }
+
+uint64_t Cpu::RunToDeadline() {
+  const DecodedInstruction* decoded;
+#if defined(PURENES_COMPUTED_GOTO)
+  // Every handler ends in its own copy of the dispatch sequence, giving the
+  // branch predictor one indirect jump per opcode instead of a single shared
+  // one.
+#define PURENES_LABEL_ADDRESS(opcode, operation, mode, base_cycles, penalty) \
+  &&execute_##opcode,
+#define PURENES_FUSED_LABEL_ADDRESS(name, first, second) &&execute_##name,
+  static const void* const kLabels[] = {
+      PURENES_OPCODES(PURENES_LABEL_ADDRESS)
+      PURENES_FUSIONS(PURENES_FUSED_LABEL_ADDRESS) &&run_block};
+#undef PURENES_FUSED_LABEL_ADDRESS
+#undef PURENES_LABEL_ADDRESS
+
+#define PURENES_DISPATCH()                    \
+  do {                                        \
+    if (cycles_ >= deadline_) return cycles_; \
+    if (InterruptPending()) goto poll;        \
+    decoded = &Decode();                      \
+    goto* kLabels[decoded->handler];          \
+  } while (0)
+
+#define PURENES_THREADED_HANDLER(opcode, operation, mode, base_cycles, penalty) \
+  execute_##opcode:                                                             \
+  ExecuteOpcode<opcode>(decoded->operand, decoded->length);                    \
+  PURENES_DISPATCH();
+
+  // A superinstruction stops after its first half wherever dispatch would
+  // have: at the deadline, for an interrupt, or when the first instruction
+  // overwrote the second.
+#define PURENES_FUSED_HANDLER(name, first, second)                   \
+  execute_##name:                                                    \
+  ExecuteOpcode<first>(decoded->operand, decoded->length);           \
+  if (cycles_ >= deadline_ || InterruptPending() ||                  \
+      decoded->tag == kEmptyCodeTag) {                               \
+    PURENES_DISPATCH();                                              \
+  }                                                                  \
+  ExecuteOpcode<second>(decoded->next_operand, decoded->next_length); \
+  PURENES_DISPATCH();
+
+poll:
+  if (cycles_ >= deadline_) return cycles_;
+  PollInterrupts();
+  PURENES_DISPATCH();
+
+  PURENES_OPCODES(PURENES_THREADED_HANDLER)
+  PURENES_FUSIONS(PURENES_FUSED_HANDLER)
+
+run_block:
+  RunBlock(*decoded);
+  PURENES_DISPATCH();
+
+#undef PURENES_FUSED_HANDLER
+#undef PURENES_THREADED_HANDLER
+#undef PURENES_DISPATCH
+#elif defined(PURENES_THREADED_DISPATCH)
+#define PURENES_SWITCH_CASE(opcode, operation, mode, base_cycles, penalty) \
+  case opcode:                                                             \
+    ExecuteOpcode<opcode>(decoded->operand, decoded->length);              \
+    break;
+
+#define PURENES_FUSED_SWITCH_CASE(name, first, second)                   \
+  case kFused##name:                                                     \
+    ExecuteOpcode<first>(decoded->operand, decoded->length);             \
+    if (cycles_ >= deadline_ || InterruptPending() ||                    \
+        decoded->tag == kEmptyCodeTag) {                                 \
+      break;                                                             \
+    }                                                                    \
+    ExecuteOpcode<second>(decoded->next_operand, decoded->next_length);  \
+    break;
+
+  while (cycles_ < deadline_) {
+    if (PollInterrupts()) continue;
+    decoded = &Decode();
+    switch (decoded->handler) {
+      PURENES_OPCODES(PURENES_SWITCH_CASE)
+      PURENES_FUSIONS(PURENES_FUSED_SWITCH_CASE)
+      case kRunBlock:
+        RunBlock(*decoded);
+        break;
+    }
+  }
+  return cycles_;
+
+#undef PURENES_FUSED_SWITCH_CASE
+#undef PURENES_SWITCH_CASE
+#else
+  while (cycles_ < deadline_) {
+    if (PollInterrupts()) continue;
+    decoded = &Decode();
+    if (decoded->handler == kRunBlock) {
+      RunBlock(*decoded);
+    } else {
+      Execute(*decoded);
+    }
+  }
+  return cycles_;
+#endif
+}
+
+#define PURENES_ENTRY_ADDRESS(opcode, operation, mode, base_cycles, penalty) \
+  &Cpu::ExecuteEntry<opcode>,
+const Cpu::InstructionEntry Cpu::kInstructionEntries[256] = {
+    PURENES_OPCODES(PURENES_ENTRY_ADDRESS)};
+#undef PURENES_ENTRY_ADDRESS
+
+void Cpu::Yield() {
+  deadline_ = 0;
+  yielded_ = true;
+}
+
+void Cpu::Nmi() { nmi_pending_ = true; }
+
+void Cpu::SetIrq(bool asserted) { irq_asserted_ = asserted; }
+
+void Cpu::SetCodeBank(uint8_t page, uint16_t bank) {
+  if (code_banks_[page] == bank) return;
+  code_banks_[page] = bank;
+  // Compiled code may be running from the outgoing bank.
+  block_exit_ = true;
+}
+
+void Cpu::SetCompiledCode(const CompiledCode* code) {
+  compiled_code_ = code;
+  // Cached instructions record whether compiled code starts at them.
+  InvalidateCodeCache();
+}
+
+Cpu::CompiledFunction Cpu::FindCompiledBlock() const {
+  if (!compiled_code_) return nullptr;
+  const uint16_t bank = code_banks_[pc_ >> 8];
+  const CompiledBlock* const end =
+      compiled_code_->blocks + compiled_code_->count;
+  const CompiledBlock* const block = std::lower_bound(
+      compiled_code_->blocks, end, CompiledBlock{bank, pc_, nullptr},
+      [](const CompiledBlock& a, const CompiledBlock& b) {
+        return a.bank != b.bank ? a.bank < b.bank : a.address < b.address;
+      });
+  if (block == end || block->bank != bank || block->address != pc_) {
+    return nullptr;
+  }
+  return block->run;
+}
+
+void Cpu::RunBlock(const DecodedInstruction& decoded) {
+  CompiledFunction block = compiled_blocks_[pc_ & (kCodeCacheSize - 1)];
+#if defined(PURENES_JIT_X64)
+  // Translations go stale when their pages are written, which the JIT checks
+  // in its own direct-mapped cache.
+  if (!block && jit_) block = jit_->Lookup(code_banks_[pc_ >> 8], pc_);
+#endif
+  if (!block) {
+    Execute(decoded);
+    return;
+  }
+  block_exit_ = false;
+  block(this);
+}
+
+void Cpu::SetIdleLoopSkipping(bool enabled) {
+  idle_loop_skipping_ = enabled;
+  // Compiled code may have inlined the branches that detect idle loops.
+  InvalidateCodeCache();
+}
+
+void Cpu::InvalidateCodeCache() {
+  for (DecodedInstruction& entry : code_cache_) entry.tag = kEmptyCodeTag;
+  for (IdleLoop& loop : idle_loops_) loop.tag = kEmptyCodeTag;
+  code_pages_.fill(false);
+#if defined(PURENES_JIT_X64)
+  if (jit_) jit_->Flush();
+#endif
+}
+
+const Cpu::DecodedInstruction& Cpu::Decode() {
+  const uint16_t bank = code_banks_[pc_ >> 8];
+  const uint32_t tag = static_cast<uint32_t>(bank) << 16 | pc_;
+  DecodedInstruction& entry = code_cache_[pc_ & (kCodeCacheSize - 1)];
+  if (entry.tag == tag) return entry;
+
+  Fetch(pc_, &uncached_);
+  // Instructions that straddle a page boundary could be split across two
+  // banks, so only those within a single page are cached.
+  const bool fits_in_page = (pc_ & 0xFF) + uncached_.length <= 0x100;
+  if (bank == kUncachedBank || !fits_in_page) return uncached_;
+
+  entry = uncached_;
+  entry.tag = tag;
+  MarkCodePage(pc_ >> 8);
+  // Blocks are looked up once per cached instruction rather than each time
+  // it runs, so that only their first instructions leave the run loop.
+  CompiledFunction& block = compiled_blocks_[pc_ & (kCodeCacheSize - 1)];
+  block = FindCompiledBlock();
+  bool translated = false;
+#if defined(PURENES_JIT_X64)
+  translated = !block && jit_ && jit_->Lookup(bank, pc_);
+#endif
+  if (block || translated) {
+    entry.handler = kRunBlock;
+    return entry;
+  }
+  Fuse(pc_, &entry);
+  return entry;
+}
+
+void Cpu::Fuse(uint16_t address, DecodedInstruction* entry) {
+  if (!StartsFusion(entry->opcode)) return;
+  // Both instructions have to be in the same page, and so the same bank.
+  const uint16_t next = static_cast<uint16_t>(address + entry->length);
+  if ((next & 0xFF) == 0) return;
+  DecodedInstruction second;
+  Fetch(next, &second);
+  if ((next & 0xFF) + second.length > 0x100) return;
+  entry->handler = FusedHandlerOf(entry->opcode, second.opcode);
+  entry->next_operand = second.operand;
+  entry->next_length = second.length;
+}
+
+void Cpu::Fetch(uint16_t address, DecodedInstruction* decoded) {
+  decoded->opcode = Read(address);
+  decoded->handler = decoded->opcode;
+  const uint8_t operand_bytes = kInstructions[decoded->opcode].operand_bytes;
+  decoded->length = static_cast<uint8_t>(1 + operand_bytes);
+  const uint16_t operand_address = static_cast<uint16_t>(address + 1);
+  if (operand_bytes == 2) {
+    decoded->operand = Read16(operand_address);
+  } else if (operand_bytes == 1) {
+    decoded->operand = Read(operand_address);
+  } else {
+    decoded->operand = 0;
+  }
+}
+
+void Cpu::MarkCodePage(uint8_t page) {
+  if (code_pages_[page]) return;
+  code_pages_[page] = true;
+  // Writes through a mirror of the page, such as one of internal RAM,
+  // change the same bytes.
+  const uint8_t* const memory = write_pages_[page];
+  if (!memory) return;
+  for (int other = 0; other < 256; ++other) {
+    if (write_pages_[other] == memory) code_pages_[other] = true;
+  }
+}
+
+void Cpu::InvalidateCodeAt(uint16_t address) {
+  // Code cached at any mirror of the written byte is just as stale.
+  const uint8_t* const memory = write_pages_[address >> 8];
+  if (!memory) {
+    InvalidateCodeOf(address);
+    return;
+  }
+  for (int page = 0; page < 256; ++page) {
+    if (write_pages_[page] == memory) {
+      InvalidateCodeOf(static_cast<uint16_t>(page << 8 | (address & 0xFF)));
+    }
+  }
+}
+
+void Cpu::InvalidateCodeOf(uint16_t address) {
+  // The written byte can belong to an entry starting up to five bytes
+  // earlier, if that is a superinstruction.
+  for (int offset = 0; offset < kMaxDecodedBytes; ++offset) {
+    const uint16_t start = static_cast<uint16_t>(address - offset);
+    DecodedInstruction& entry = code_cache_[start & (kCodeCacheSize - 1)];
+    if ((entry.tag & 0xFFFF) == start) entry.tag = kEmptyCodeTag;
+  }
+  for (IdleLoop& loop : idle_loops_) {
+    const uint16_t head = loop.tag & 0xFFFF;
+    if (loop.tag != kEmptyCodeTag && address >= head && address < loop.end) {
+      loop.tag = kEmptyCodeTag;
+    }
+  }
+#if defined(PURENES_JIT_X64)
+  if (jit_) {
+    jit_->InvalidatePage(address >> 8);
+    block_exit_ = true;
+  }
+#endif
+}
+
+void Cpu::SkipIdleLoop(uint16_t end) {
+  const uint16_t bank = code_banks_[pc_ >> 8];
+  if (bank == kUncachedBank) return;
+  const uint32_t tag = static_cast<uint32_t>(bank) << 16 | pc_;
+  IdleLoop& loop = idle_loops_[pc_ & (kIdleLoopCacheSize - 1)];
+  const uint8_t status = Status();
+  if (loop.tag != tag || loop.end != end) {
+    loop = {tag, end, 0, false, 0, a_, x_, y_, s_, status, cycles_};
+    AnalyzeIdleLoop(pc_, end, &loop);
+    // Rewriting the loop has to drop it like a cached instruction.
+    MarkCodePage(pc_ >> 8);
+    MarkCodePage((end - 1) >> 8);
+    return;
+  }
+  if (loop.period == 0) return;
+
+  // The loop is idle if a whole iteration, and nothing else, ran since the
+  // previous arrival and left every register as it was: all further
+  // iterations up to the next event then repeat it exactly.
+  const bool idle = cycles_ == loop.cycles + loop.period && a_ == loop.a &&
+                    x_ == loop.x && y_ == loop.y && s_ == loop.s &&
+                    status == loop.p;
+  loop.a = a_;
+  loop.x = x_;
+  loop.y = y_;
+  loop.s = s_;
+  loop.p = status;
+  loop.cycles = cycles_;
+  if (!idle || InterruptPending()) return;
+  // A polled register has to keep reading the same all the way.
+  const uint64_t limit =
+      loop.polls ? std::min(deadline_, bus_.ReadStableUntil(loop.polled))
+                 : deadline_;
+  if (cycles_ >= limit) return;
+
+  // Stop at the last arrival before the limit, so that RunUntil() returns
+  // at the same instruction boundary as without skipping.
+  const uint64_t skipped = (limit - 1 - cycles_) / loop.period * loop.period;
+  cycles_ += skipped;
+  skipped_cycles_ += skipped;
+  loop.cycles = cycles_;
+}
+
+void Cpu::AnalyzeIdleLoop(uint16_t head, uint16_t end, IdleLoop* loop) {
+  if (end <= head || end - head > kMaxIdleLoopBytes) return;
+  int period = 0;
+  DecodedInstruction decoded;
+  for (uint16_t address = head; address != end; address += decoded.length) {
+    Fetch(address, &decoded);
+    const Instruction& instruction = kInstructions[decoded.opcode];
+    const Operation operation = instruction.operation;
+    const Mode mode = instruction.mode;
+    const bool back_edge = address + decoded.length == end;
+
+    // Only instructions whose effect is the same every time they run with
+    // the same registers, and that do not write memory.
+    const bool pure =
+        operation == Operation::kLda || operation == Operation::kLdx ||
+        operation == Operation::kLdy || operation == Operation::kBit ||
+        operation == Operation::kCmp || operation == Operation::kCpx ||
+        operation == Operation::kCpy || operation == Operation::kAnd ||
+        operation == Operation::kOra || operation == Operation::kNop ||
+        operation == Operation::kTax || operation == Operation::kTay ||
+        operation == Operation::kTxa || operation == Operation::kTya ||
+        operation == Operation::kClc || operation == Operation::kSec ||
+        operation == Operation::kClv || mode == Mode::kRelative ||
+        (operation == Operation::kJmp && mode == Mode::kAbsolute);
+    if (!pure) return;
+    if (mode == Mode::kZeroPage || mode == Mode::kAbsolute) {
+      if (operation != Operation::kJmp &&
+          bus_.HasReadSideEffects(decoded.operand)) {
+        if (loop->polls && loop->polled != decoded.operand) return;
+        loop->polls = true;
+        loop->polled = decoded.operand;
+      }
+    } else if (mode != Mode::kImplied && mode != Mode::kImmediate &&
+               mode != Mode::kRelative) {
+      return;
+    }
+
+    if (back_edge) {
+      // The loop has to be closed by this instruction jumping to the head.
+      const int8_t offset = static_cast<int8_t>(decoded.operand);
+      const uint16_t target = mode == Mode::kRelative
+                                  ? static_cast<uint16_t>(end + offset)
+                                  : decoded.operand;
+      if (target != head) return;
+      period += mode == Mode::kRelative ? 3 + ((end ^ head) >> 8 != 0) : 3;
+    } else if (operation == Operation::kJmp) {
+      return;
+    } else {
+      // Branches inside the body have to fall through to stay in the loop.
+      period += instruction.cycles;
+    }
+  }
+  loop->period = static_cast<uint8_t>(period);
+}
+
+void Cpu::Execute(const DecodedInstruction& decoded) {
+  (this->*kInstructions[decoded.opcode].execute)(decoded.operand,
+                                                 decoded.length);
+}
+
+bool Cpu::PollInterrupts() {
+  if (nmi_pending_) {
+    nmi_pending_ = false;
+    Interrupt(kNmiVector);
+    return true;
+  }
+  if (irq_asserted_ && !(p_ & kInterruptDisable)) {
+    Interrupt(kIrqVector);
+    return true;
+  }
+  return false;
+}
+
+void Cpu::Interrupt(uint16_t vector) {
+  Push(pc_ >> 8);
+  Push(pc_ & 0xFF);
+  Push(Status() & ~kBreak);
+  p_ |= kInterruptDisable;
+  pc_ = Read16(vector);
+  cycles_ += 7;
+}
+
+uint8_t Cpu::Status() const {
+  const uint8_t negative = (nz_result_ | nz_result_ >> 8) & kNegative;
+  const uint8_t zero = (nz_result_ & 0xFF) == 0 ? kZero : 0;
+  const uint8_t overflow = (overflow_result_ & 0x80) >> 1;
+  return static_cast<uint8_t>((p_ & (kInterruptDisable | kDecimal)) |
+                              kUnused | carry_ | zero | overflow | negative);
+}
+
+void Cpu::SetStatus(uint8_t value) {
+  p_ = value & (kInterruptDisable | kDecimal);
+  carry_ = value & kCarry;
+  overflow_result_ = static_cast<uint8_t>((value & kOverflow) << 1);
+  // Bit 15 alone carries N, while a zero low byte alone means Z.
+  nz_result_ = static_cast<uint16_t>((value & kNegative) << 8 |
+                                     (value & kZero ? 0 : 1));
+}
+
+}  // namespace purenes
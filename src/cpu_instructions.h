@@ -0,0 +1,512 @@
+#ifndef PURENES_CPU_INSTRUCTIONS_H
+#define PURENES_CPU_INSTRUCTIONS_H
+
+// The semantics of every instruction, defined inline so that both the run
+// loops in cpu.cpp and code generated by purenes_recompile can inline them.
+
+#include <type_traits>
+
+#include "cpu.h"
+#include "opcodes.h"
+
+namespace purenes {
+
+// Executes one opcode with its operation, addressing mode and access policy
+// known at compile time, so that all of them can be inlined into the run
+// loop. The page-cross penalty column of opcodes.h is implied by the access
+// policy and only checked here.
+#define PURENES_EXECUTE_OPCODE(opcode, operation, mode, base_cycles, penalty) \
+  template <>                                                                 \
+  inline void Cpu::ExecuteOpcode<opcode>(uint16_t operand, uint8_t length) {  \
+    static_assert(                                                            \
+        penalty == (std::is_same<decltype(&Cpu::operation),                   \
+                                 ReadOperation>::value &&                     \
+                    (Mode::k##mode == Mode::kAbsoluteX ||                     \
+                     Mode::k##mode == Mode::kAbsoluteY ||                     \
+                     Mode::k##mode == Mode::kIndirectY)),                     \
+        "page-cross penalty disagrees with the access of " #operation);       \
+    pc_ += length;                                                            \
+    cycles_ += base_cycles;                                                   \
+    Perform<Mode::k##mode, &Cpu::operation>(operand);                         \
+  }
+PURENES_OPCODES(PURENES_EXECUTE_OPCODE)
+#undef PURENES_EXECUTE_OPCODE
+
+#define PURENES_ENTRY(opcode, operation, mode, base_cycles, penalty)       \
+  template <>                                                            \
+  inline bool Cpu::ExecuteEntry<opcode>(Cpu * cpu, uint32_t argument) {  \
+    cpu->ExecuteOpcode<opcode>(argument & 0xFFFF, argument >> 16);       \
+    return cpu->cycles_ >= cpu->deadline_ || cpu->InterruptPending() ||  \
+           cpu->block_exit_;                                             \
+  }
+PURENES_OPCODES(PURENES_ENTRY)
+#undef PURENES_ENTRY
+
+inline bool Cpu::InterruptPending() const {
+  return nmi_pending_ || (irq_asserted_ && !(p_ & kInterruptDisable));
+}
+
+inline uint16_t Cpu::Load16(const uint8_t* page, uint16_t address) {
+  const uint8_t* const bytes = page + (address & 0xFF);
+  return static_cast<uint16_t>(bytes[0] | bytes[1] << 8);
+}
+
+inline uint16_t Cpu::Read16(uint16_t address) {
+  const uint8_t* const page = read_pages_[address >> 8];
+  if (page && (address & 0xFF) != 0xFF) return Load16(page, address);
+  const uint8_t lo = Read(address);
+  const uint8_t hi = Read(static_cast<uint16_t>(address + 1));
+  return static_cast<uint16_t>(lo | hi << 8);
+}
+
+inline uint16_t Cpu::ReadWrapped16(uint16_t address) {
+  const uint8_t* const page = read_pages_[address >> 8];
+  if (page && (address & 0xFF) != 0xFF) return Load16(page, address);
+  const uint8_t lo = Read(address);
+  const uint8_t hi = Read((address & 0xFF00) | ((address + 1) & 0x00FF));
+  return static_cast<uint16_t>(lo | hi << 8);
+}
+
+inline void Cpu::Push(uint8_t data) { Write(kStackBase | s_--, data); }
+
+inline uint8_t Cpu::Pull() { return Read(kStackBase | ++s_); }
+
+inline void Cpu::SetZn(uint8_t value) { nz_result_ = value; }
+
+inline void Cpu::Branch(bool condition, uint16_t target) {
+  if (!condition) return;
+  cycles_ += 1 + ((pc_ ^ target) >> 8 != 0);
+  const uint16_t end = pc_;
+  pc_ = target;
+  if (idle_loop_skipping_ && target < end) SkipIdleLoop(end);
+}
+
+inline void Cpu::Compare(uint8_t reg, uint8_t value) {
+  carry_ = reg >= value;
+  SetZn(static_cast<uint8_t>(reg - value));
+}
+
+// Access policies. kMode is a constant in each instantiation, so the tests
+// on it fold away and only the code for one mode remains.
+
+template <Cpu::Mode kMode, Cpu::ImpliedOperation kOperation>
+inline void Cpu::Perform(uint16_t) {
+  (this->*kOperation)();
+}
+
+template <Cpu::Mode kMode, Cpu::ReadOperation kOperation>
+inline void Cpu::Perform(uint16_t operand) {
+  // Immediate operands were fetched with the opcode and need no bus access.
+  // Implied NOPs read nothing.
+  uint8_t value = static_cast<uint8_t>(operand);
+  if (kMode != Mode::kImmediate && kMode != Mode::kImplied) {
+    value = Read(Address<kMode, Access::kRead>(operand));
+  }
+  (this->*kOperation)(value);
+}
+
+template <Cpu::Mode kMode, Cpu::ModifyOperation kOperation>
+inline void Cpu::Perform(uint16_t operand) {
+  if (kMode == Mode::kAccumulator) {
+    a_ = (this->*kOperation)(a_);
+    return;
+  }
+  const uint16_t address = Address<kMode, Access::kModify>(operand);
+  Write(address, (this->*kOperation)(Read(address)));
+}
+
+template <Cpu::Mode kMode, Cpu::WriteOperation kOperation>
+inline void Cpu::Perform(uint16_t operand) {
+  (this->*kOperation)(Address<kMode, Access::kWrite>(operand));
+}
+
+// Addressing modes
+
+template <Cpu::Mode kMode, Cpu::Access kAccess>
+inline uint16_t Cpu::Address(uint16_t operand) {
+  switch (kMode) {
+    case Mode::kImplied:
+    case Mode::kAccumulator:
+      return 0;
+    case Mode::kImmediate:
+      // PC has already moved past the instruction, so the operand byte is
+      // the one just before it.
+      return static_cast<uint16_t>(pc_ - 1);
+    case Mode::kZeroPage:
+    case Mode::kAbsolute:
+      return operand;
+    case Mode::kZeroPageX:
+      return static_cast<uint8_t>(operand + x_);
+    case Mode::kZeroPageY:
+      return static_cast<uint8_t>(operand + y_);
+    case Mode::kAbsoluteX:
+      return Indexed<kAccess>(operand, x_);
+    case Mode::kAbsoluteY:
+      return Indexed<kAccess>(operand, y_);
+    case Mode::kIndirect:
+      // The pointer's high byte is fetched without carrying into the page,
+      // so JMP ($xxFF) wraps around within the page.
+      return ReadWrapped16(operand);
+    case Mode::kIndirectX:
+      return ReadWrapped16(static_cast<uint8_t>(operand + x_));
+    case Mode::kIndirectY:
+      return Indexed<kAccess>(ReadWrapped16(static_cast<uint8_t>(operand)),
+                              y_);
+    case Mode::kRelative:
+      return static_cast<uint16_t>(pc_ + static_cast<int8_t>(operand));
+  }
+  return 0;
+}
+
+template <Cpu::Access kAccess>
+inline uint16_t Cpu::Indexed(uint16_t base, uint8_t index) {
+  const uint16_t address = static_cast<uint16_t>(base + index);
+  // Writes and read-modify-writes always spend the cycle that fixes up the
+  // high byte, so it is part of their base count.
+  if (kAccess == Access::kRead) cycles_ += (base ^ address) >> 8 != 0;
+  return address;
+}
+
+// Official operations
+
+inline void Cpu::Adc(uint8_t value) {
+  const unsigned sum = a_ + value + carry_;
+  const uint8_t result = static_cast<uint8_t>(sum);
+  carry_ = static_cast<uint8_t>(sum >> 8);
+  overflow_result_ = static_cast<uint8_t>(~(a_ ^ value) & (a_ ^ result));
+  a_ = result;
+  SetZn(a_);
+}
+
+inline void Cpu::And(uint8_t value) {
+  a_ &= value;
+  SetZn(a_);
+}
+
+inline uint8_t Cpu::Asl(uint8_t value) {
+  carry_ = value >> 7;
+  value = static_cast<uint8_t>(value << 1);
+  SetZn(value);
+  return value;
+}
+
+inline void Cpu::Bcc(uint16_t address) { Branch(!carry_, address); }
+
+inline void Cpu::Bcs(uint16_t address) { Branch(carry_, address); }
+
+inline void Cpu::Beq(uint16_t address) {
+  Branch((nz_result_ & 0xFF) == 0, address);
+}
+
+inline void Cpu::Bit(uint8_t value) {
+  // Z comes from A & M but N from bit 7 of M itself, which the high byte of
+  // the N/Z result supplies.
+  nz_result_ = static_cast<uint16_t>((a_ & value) | (value & kNegative) << 8);
+  overflow_result_ = static_cast<uint8_t>(value << 1);
+}
+
+inline void Cpu::Bmi(uint16_t address) {
+  Branch((nz_result_ | nz_result_ >> 8) & kNegative, address);
+}
+
+inline void Cpu::Bne(uint16_t address) {
+  Branch((nz_result_ & 0xFF) != 0, address);
+}
+
+inline void Cpu::Bpl(uint16_t address) {
+  Branch(!((nz_result_ | nz_result_ >> 8) & kNegative), address);
+}
+
+inline void Cpu::Brk() {
+  // BRK skips a padding byte, so the pushed return address is PC + 2.
+  ++pc_;
+  Push(pc_ >> 8);
+  Push(pc_ & 0xFF);
+  Push(Status() | kBreak);
+  p_ |= kInterruptDisable;
+  pc_ = Read16(kIrqVector);
+}
+
+inline void Cpu::Bvc(uint16_t address) {
+  Branch(!(overflow_result_ & 0x80), address);
+}
+
+inline void Cpu::Bvs(uint16_t address) {
+  Branch(overflow_result_ & 0x80, address);
+}
+
+inline void Cpu::Clc() { carry_ = 0; }
+
+inline void Cpu::Cld() { p_ &= ~kDecimal; }
+
+inline void Cpu::Cli() { p_ &= ~kInterruptDisable; }
+
+inline void Cpu::Clv() { overflow_result_ = 0; }
+
+inline void Cpu::Cmp(uint8_t value) { Compare(a_, value); }
+
+inline void Cpu::Cpx(uint8_t value) { Compare(x_, value); }
+
+inline void Cpu::Cpy(uint8_t value) { Compare(y_, value); }
+
+inline uint8_t Cpu::Dec(uint8_t value) {
+  --value;
+  SetZn(value);
+  return value;
+}
+
+inline void Cpu::Dex() { SetZn(--x_); }
+
+inline void Cpu::Dey() { SetZn(--y_); }
+
+inline void Cpu::Eor(uint8_t value) {
+  a_ ^= value;
+  SetZn(a_);
+}
+
+inline uint8_t Cpu::Inc(uint8_t value) {
+  ++value;
+  SetZn(value);
+  return value;
+}
+
+inline void Cpu::Inx() { SetZn(++x_); }
+
+inline void Cpu::Iny() { SetZn(++y_); }
+
+inline void Cpu::Jmp(uint16_t address) {
+  const uint16_t end = pc_;
+  pc_ = address;
+  if (idle_loop_skipping_ && address < end) SkipIdleLoop(end);
+}
+
+inline void Cpu::Jsr(uint16_t address) {
+  const uint16_t return_address = static_cast<uint16_t>(pc_ - 1);
+  Push(return_address >> 8);
+  Push(return_address & 0xFF);
+  pc_ = address;
+}
+
+inline void Cpu::Lda(uint8_t value) {
+  a_ = value;
+  SetZn(a_);
+}
+
+inline void Cpu::Ldx(uint8_t value) {
+  x_ = value;
+  SetZn(x_);
+}
+
+inline void Cpu::Ldy(uint8_t value) {
+  y_ = value;
+  SetZn(y_);
+}
+
+inline uint8_t Cpu::Lsr(uint8_t value) {
+  carry_ = value & 0x01;
+  value >>= 1;
+  SetZn(value);
+  return value;
+}
+
+// The unofficial NOPs with an operand read it like LDA, which their access
+// policy takes care of.
+inline void Cpu::Nop(uint8_t) {}
+
+inline void Cpu::Ora(uint8_t value) {
+  a_ |= value;
+  SetZn(a_);
+}
+
+inline void Cpu::Pha() { Push(a_); }
+
+inline void Cpu::Php() { Push(Status() | kBreak); }
+
+inline void Cpu::Pla() {
+  a_ = Pull();
+  SetZn(a_);
+}
+
+inline void Cpu::Plp() { SetStatus(Pull()); }
+
+inline uint8_t Cpu::Rol(uint8_t value) {
+  const uint8_t carry_in = carry_;
+  carry_ = value >> 7;
+  value = static_cast<uint8_t>(value << 1 | carry_in);
+  SetZn(value);
+  return value;
+}
+
+inline uint8_t Cpu::Ror(uint8_t value) {
+  const uint8_t carry_in = static_cast<uint8_t>(carry_ << 7);
+  carry_ = value & 0x01;
+  value = static_cast<uint8_t>(value >> 1 | carry_in);
+  SetZn(value);
+  return value;
+}
+
+inline void Cpu::Rti() {
+  Plp();
+  const uint8_t lo = Pull();
+  const uint8_t hi = Pull();
+  pc_ = static_cast<uint16_t>(lo | hi << 8);
+}
+
+inline void Cpu::Rts() {
+  const uint8_t lo = Pull();
+  const uint8_t hi = Pull();
+  pc_ = static_cast<uint16_t>((lo | hi << 8) + 1);
+}
+
+inline void Cpu::Sbc(uint8_t value) { Adc(static_cast<uint8_t>(~value)); }
+
+inline void Cpu::Sec() { carry_ = 1; }
+
+inline void Cpu::Sed() { p_ |= kDecimal; }
+
+inline void Cpu::Sei() { p_ |= kInterruptDisable; }
+
+inline void Cpu::Sta(uint16_t address) { Write(address, a_); }
+
+inline void Cpu::Stx(uint16_t address) { Write(address, x_); }
+
+inline void Cpu::Sty(uint16_t address) { Write(address, y_); }
+
+inline void Cpu::Tax() {
+  x_ = a_;
+  SetZn(x_);
+}
+
+inline void Cpu::Tay() {
+  y_ = a_;
+  SetZn(y_);
+}
+
+inline void Cpu::Tsx() {
+  x_ = s_;
+  SetZn(x_);
+}
+
+inline void Cpu::Txa() {
+  a_ = x_;
+  SetZn(a_);
+}
+
+inline void Cpu::Txs() { s_ = x_; }
+
+inline void Cpu::Tya() {
+  a_ = y_;
+  SetZn(a_);
+}
+
+// Unofficial operations. The unstable high-byte stores (AHX, SHX, SHY, TAS)
+// follow the commonly emulated behaviour of AND-ing the stored value with the
+// high byte of the base address plus one.
+
+inline void Cpu::Ahx(uint16_t address) {
+  const uint8_t high = static_cast<uint8_t>(((address - y_) >> 8) + 1);
+  Write(address, a_ & x_ & high);
+}
+
+inline void Cpu::Alr(uint8_t value) { a_ = Lsr(a_ & value); }
+
+inline void Cpu::Anc(uint8_t value) {
+  a_ &= value;
+  SetZn(a_);
+  carry_ = a_ >> 7;
+}
+
+inline void Cpu::Arr(uint8_t value) {
+  a_ = Ror(a_ & value);
+  carry_ = (a_ >> 6) & 0x01;
+  overflow_result_ = static_cast<uint8_t>((a_ << 1) ^ (a_ << 2));
+}
+
+inline void Cpu::Axs(uint8_t value) {
+  const uint8_t masked = a_ & x_;
+  carry_ = masked >= value;
+  x_ = static_cast<uint8_t>(masked - value);
+  SetZn(x_);
+}
+
+inline uint8_t Cpu::Dcp(uint8_t value) {
+  --value;
+  Compare(a_, value);
+  return value;
+}
+
+inline uint8_t Cpu::Isc(uint8_t value) {
+  ++value;
+  Adc(static_cast<uint8_t>(~value));
+  return value;
+}
+
+inline void Cpu::Jam() {
+  // The processor locks up; re-executing the opcode forever has the same
+  // observable effect while still letting the caller's cycle budget expire.
+  --pc_;
+}
+
+inline void Cpu::Las(uint8_t value) {
+  a_ = x_ = s_ = value & s_;
+  SetZn(a_);
+}
+
+inline void Cpu::Lax(uint8_t value) {
+  a_ = x_ = value;
+  SetZn(a_);
+}
+
+inline uint8_t Cpu::Rla(uint8_t value) {
+  value = Rol(value);
+  a_ &= value;
+  SetZn(a_);
+  return value;
+}
+
+inline uint8_t Cpu::Rra(uint8_t value) {
+  value = Ror(value);
+  Adc(value);
+  return value;
+}
+
+inline void Cpu::Sax(uint16_t address) { Write(address, a_ & x_); }
+
+inline void Cpu::Shx(uint16_t address) {
+  const uint8_t high = static_cast<uint8_t>(((address - y_) >> 8) + 1);
+  Write(address, x_ & high);
+}
+
+inline void Cpu::Shy(uint16_t address) {
+  const uint8_t high = static_cast<uint8_t>(((address - x_) >> 8) + 1);
+  Write(address, y_ & high);
+}
+
+inline uint8_t Cpu::Slo(uint8_t value) {
+  value = Asl(value);
+  a_ |= value;
+  SetZn(a_);
+  return value;
+}
+
+inline uint8_t Cpu::Sre(uint8_t value) {
+  value = Lsr(value);
+  a_ ^= value;
+  SetZn(a_);
+  return value;
+}
+
+inline void Cpu::Tas(uint16_t address) {
+  s_ = a_ & x_;
+  const uint8_t high = static_cast<uint8_t>(((address - y_) >> 8) + 1);
+  Write(address, s_ & high);
+}
+
+inline void Cpu::Xaa(uint8_t value) {
+  a_ = (a_ | 0xEE) & x_ & value;
+  SetZn(a_);
+}
+
+}  // namespace purenes
+
+#endif //PURENES_CPU_INSTRUCTIONS_H
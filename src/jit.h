@@ -0,0 +1,116 @@
+#ifndef PURENES_JIT_H
+#define PURENES_JIT_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "cpu.h"
+
+// The recompiler targets x86-64 hosts only. Elsewhere the CPU reports the
+// JIT backend as unavailable and keeps interpreting.
+#if defined(PURENES_JIT) && (defined(__x86_64__) || defined(_M_X64))
+#define PURENES_JIT_X64 1
+#endif
+
+namespace purenes {
+
+// Translates basic blocks of 6502 code into x86-64 machine code.
+//
+// A block runs from its entry address up to and including the first
+// control-flow instruction, and never crosses a 256-byte page so that one
+// code bank id describes all of it. Simple register instructions are
+// emitted inline; everything else becomes a direct call to a per-opcode
+// thunk with the predecoded operand as an immediate. Conditional branches
+// are emitted inline too, and one that loops back into its own block jumps
+// there directly instead of returning to the dispatcher. After every
+// instruction the generated code leaves the block if the cycle deadline has
+// passed, an interrupt is pending or the block's page was written, so
+// timing is identical to the interpreter while decode and dispatch are gone.
+class Jit {
+ public:
+  // Generated code for one block. Runs at least one instruction.
+  using Block = Cpu::CompiledFunction;
+
+  explicit Jit(Cpu& cpu);
+#if defined(PURENES_JIT_X64)
+  ~Jit();
+#else
+  // Never constructed, but Cpu's unique_ptr needs a destructor to link.
+  ~Jit() = default;
+#endif
+
+  Jit(const Jit&) = delete;
+  Jit& operator=(const Jit&) = delete;
+
+  // Whether executable memory could be allocated.
+  bool ok() const { return code_ != nullptr; }
+
+  // Returns the block for PC in the current code bank, translating it on a
+  // miss. Returns null when the instruction at PC cannot be translated, in
+  // which case the caller interprets it.
+  Block Lookup(uint16_t bank, uint16_t address);
+
+  // Discards every block in the 256-byte page `page`.
+  void InvalidatePage(uint8_t page) { ++page_generations_[page]; }
+
+  // Discards all blocks.
+  void Flush();
+
+ private:
+  struct Entry {
+    Block block;
+    uint32_t tag;
+    uint32_t generation;
+  };
+
+  static constexpr int kBlockCacheSize = 1024;
+  static constexpr size_t kCodeSize = 256 * 1024;
+  // Upper bound of the code emitted for one block, which bounds the block's
+  // instruction count.
+  static constexpr size_t kMaxBlockCode = 4096;
+  static constexpr int kMaxBlockInstructions = 64;
+
+  Block Translate(uint16_t address);
+
+  // Machine code emission.
+  void Emit8(uint8_t byte) { block_code_.push_back(byte); }
+  void EmitBytes(std::initializer_list<uint8_t> bytes);
+  void Emit16(uint16_t value);
+  void Emit32(uint32_t value);
+  void Emit64(uint64_t value);
+  // Emits `opcode` with a ModRM byte addressing [rbx + disp32].
+  void EmitMemory(std::initializer_list<uint8_t> opcode, uint8_t reg,
+                  std::ptrdiff_t displacement);
+  // Emits a 32-bit jump-if-condition to the block exit.
+  void EmitExitJump(uint8_t condition);
+  void EmitAdvance(uint8_t length, uint8_t cycles);
+  void EmitDeadlineCheck();
+  void EmitStoreNz();  // stores AL, zero-extended, as the N/Z result
+  bool EmitInline(uint8_t opcode, uint16_t operand, uint8_t length,
+                  uint8_t cycles);
+  // Emits a conditional branch at `address`; false for other opcodes.
+  bool EmitBranch(uint8_t opcode, uint16_t operand, uint16_t address);
+  void EmitThunkCall(uint8_t opcode, uint32_t argument);
+
+  std::ptrdiff_t OffsetOf(const void* member) const;
+
+  Cpu& cpu_;
+  uint8_t* code_ = nullptr;
+  size_t code_used_ = 0;
+
+  std::vector<uint8_t> block_code_;
+  std::vector<size_t> exit_jumps_;
+  // 6502 address and code offset of each instruction in the current block.
+  std::vector<std::pair<uint16_t, size_t>> instruction_offsets_;
+
+  std::array<Entry, kBlockCacheSize> blocks_{};
+  std::array<uint32_t, 256> page_generations_{};
+};
+
+}  // namespace purenes
+
+#endif //PURENES_JIT_H
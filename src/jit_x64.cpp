@@ -0,0 +1,352 @@
+#include "jit.h"
+
+#if defined(PURENES_JIT_X64)
+
+#include <cstring>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace purenes {
+
+namespace {
+
+// x86-64 encoding constants.
+constexpr uint8_t kRegisterAl = 0;
+constexpr uint8_t kConditionAboveOrEqual = 0x83;
+constexpr uint8_t kConditionZero = 0x84;
+constexpr uint8_t kConditionNotZero = 0x85;
+
+#if defined(_WIN32)
+// Microsoft x64 calling convention: arguments in RCX and EDX, 32 bytes of
+// shadow space reserved by the caller.
+constexpr uint8_t kMovRbxFirstArgument[] = {0x48, 0x89, 0xCB};  // mov rbx, rcx
+constexpr uint8_t kMovFirstArgumentRbx[] = {0x48, 0x89, 0xD9};  // mov rcx, rbx
+constexpr uint8_t kMovSecondArgumentImm32 = 0xBA;               // mov edx, imm
+constexpr uint8_t kShadowSpace = 32;
+#else
+// System V AMD64: arguments in RDI and ESI.
+constexpr uint8_t kMovRbxFirstArgument[] = {0x48, 0x89, 0xFB};  // mov rbx, rdi
+constexpr uint8_t kMovFirstArgumentRbx[] = {0x48, 0x89, 0xDF};  // mov rdi, rbx
+constexpr uint8_t kMovSecondArgumentImm32 = 0xBE;               // mov esi, imm
+constexpr uint8_t kShadowSpace = 0;
+#endif
+
+uint8_t* AllocateExecutable(size_t size) {
+#if defined(_WIN32)
+  return static_cast<uint8_t*>(VirtualAlloc(nullptr, size,
+                                            MEM_COMMIT | MEM_RESERVE,
+                                            PAGE_EXECUTE_READWRITE));
+#else
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return memory == MAP_FAILED ? nullptr : static_cast<uint8_t*>(memory);
+#endif
+}
+
+void FreeExecutable(uint8_t* memory, size_t size) {
+#if defined(_WIN32)
+  (void)size;
+  VirtualFree(memory, 0, MEM_RELEASE);
+#else
+  munmap(memory, size);
+#endif
+}
+
+}  // namespace
+
+Jit::Jit(Cpu& cpu) : cpu_(cpu), code_(AllocateExecutable(kCodeSize)) {
+  block_code_.reserve(kMaxBlockCode);
+}
+
+Jit::~Jit() {
+  if (code_) FreeExecutable(code_, kCodeSize);
+}
+
+Jit::Block Jit::Lookup(uint16_t bank, uint16_t address) {
+  const uint32_t tag = static_cast<uint32_t>(bank) << 16 | address;
+  const uint32_t generation = page_generations_[address >> 8];
+  Entry& entry = blocks_[address & (kBlockCacheSize - 1)];
+  if (entry.block && entry.tag == tag && entry.generation == generation) {
+    return entry.block;
+  }
+
+  const Block block = Translate(address);
+  if (block) entry = {block, tag, generation};
+  return block;
+}
+
+void Jit::Flush() {
+  code_used_ = 0;
+  for (Entry& entry : blocks_) entry.block = nullptr;
+}
+
+Jit::Block Jit::Translate(uint16_t address) {
+  if (code_used_ + kMaxBlockCode > kCodeSize) Flush();
+
+  block_code_.clear();
+  exit_jumps_.clear();
+  instruction_offsets_.clear();
+
+  Emit8(0x53);  // push rbx
+  for (uint8_t byte : kMovRbxFirstArgument) Emit8(byte);
+  if (kShadowSpace) EmitBytes({0x48, 0x83, 0xEC, kShadowSpace});  // sub rsp
+
+  const uint8_t page = address >> 8;
+  int count = 0;
+  for (;;) {
+    Cpu::DecodedInstruction decoded;
+    cpu_.Fetch(address, &decoded);
+    if ((address & 0xFF) + decoded.length > 0x100) break;
+
+    const Cpu::Instruction& instruction = Cpu::kInstructions[decoded.opcode];
+    const uint16_t next = static_cast<uint16_t>(address + decoded.length);
+    instruction_offsets_.emplace_back(address, block_code_.size());
+    if (!EmitBranch(decoded.opcode, decoded.operand, address) &&
+        !EmitInline(decoded.opcode, decoded.operand, decoded.length,
+                    instruction.cycles)) {
+      EmitThunkCall(decoded.opcode,
+                    decoded.operand | static_cast<uint32_t>(decoded.length)
+                                          << 16);
+    }
+    ++count;
+
+    const bool ends_block =
+        instruction.mode == Cpu::Mode::kRelative ||
+        instruction.operation == Cpu::Operation::kJmp ||
+        instruction.operation == Cpu::Operation::kJsr ||
+        instruction.operation == Cpu::Operation::kRts ||
+        instruction.operation == Cpu::Operation::kRti ||
+        instruction.operation == Cpu::Operation::kBrk ||
+        instruction.operation == Cpu::Operation::kJam;
+    if (ends_block || count == kMaxBlockInstructions || next >> 8 != page) {
+      break;
+    }
+    address = next;
+  }
+  if (count == 0) return nullptr;
+
+  const size_t exit = block_code_.size();
+  for (size_t jump : exit_jumps_) {
+    const int32_t displacement = static_cast<int32_t>(exit - (jump + 4));
+    std::memcpy(&block_code_[jump], &displacement, sizeof(displacement));
+  }
+  if (kShadowSpace) EmitBytes({0x48, 0x83, 0xC4, kShadowSpace});  // add rsp
+  Emit8(0x5B);  // pop rbx
+  Emit8(0xC3);  // ret
+
+  uint8_t* const block = code_ + code_used_;
+  std::memcpy(block, block_code_.data(), block_code_.size());
+  code_used_ += block_code_.size();
+  cpu_.MarkCodePage(page);
+  return reinterpret_cast<Block>(block);
+}
+
+void Jit::EmitBytes(std::initializer_list<uint8_t> bytes) {
+  for (uint8_t byte : bytes) Emit8(byte);
+}
+
+void Jit::Emit16(uint16_t value) {
+  Emit8(value & 0xFF);
+  Emit8(value >> 8);
+}
+
+void Jit::Emit32(uint32_t value) {
+  Emit16(value & 0xFFFF);
+  Emit16(value >> 16);
+}
+
+void Jit::Emit64(uint64_t value) {
+  Emit32(value & 0xFFFFFFFF);
+  Emit32(value >> 32);
+}
+
+void Jit::EmitMemory(std::initializer_list<uint8_t> opcode, uint8_t reg,
+                     std::ptrdiff_t displacement) {
+  EmitBytes(opcode);
+  Emit8(static_cast<uint8_t>(0x80 | reg << 3 | 3));  // [rbx + disp32]
+  Emit32(static_cast<uint32_t>(displacement));
+}
+
+void Jit::EmitExitJump(uint8_t condition) {
+  Emit8(0x0F);
+  Emit8(condition);
+  exit_jumps_.push_back(block_code_.size());
+  Emit32(0);
+}
+
+void Jit::EmitAdvance(uint8_t length, uint8_t cycles) {
+  // add word [rbx + pc], length
+  EmitMemory({0x66, 0x83}, 0, OffsetOf(&cpu_.pc_));
+  Emit8(length);
+  // add qword [rbx + cycles], cycles
+  EmitMemory({0x48, 0x83}, 0, OffsetOf(&cpu_.cycles_));
+  Emit8(cycles);
+}
+
+void Jit::EmitDeadlineCheck() {
+  EmitMemory({0x48, 0x8B}, kRegisterAl, OffsetOf(&cpu_.cycles_));
+  EmitMemory({0x48, 0x3B}, kRegisterAl, OffsetOf(&cpu_.deadline_));
+  EmitExitJump(kConditionAboveOrEqual);
+}
+
+void Jit::EmitStoreNz() {
+  EmitBytes({0x0F, 0xB6, 0xC0});  // movzx eax, al
+  EmitMemory({0x66, 0x89}, kRegisterAl, OffsetOf(&cpu_.nz_result_));
+}
+
+bool Jit::EmitInline(uint8_t opcode, uint16_t operand, uint8_t length,
+                     uint8_t cycles) {
+  const std::ptrdiff_t a = OffsetOf(&cpu_.a_);
+  const std::ptrdiff_t x = OffsetOf(&cpu_.x_);
+  const std::ptrdiff_t y = OffsetOf(&cpu_.y_);
+
+  // Register-to-register copy that also sets N/Z.
+  auto transfer = [&](std::ptrdiff_t from, std::ptrdiff_t to) {
+    EmitMemory({0x8A}, kRegisterAl, from);  // mov al, [from]
+    EmitMemory({0x88}, kRegisterAl, to);    // mov [to], al
+    EmitStoreNz();
+  };
+  // Increment (0xC0) or decrement (0xC8) of a register that sets N/Z.
+  auto step = [&](std::ptrdiff_t reg, uint8_t modrm) {
+    EmitMemory({0x8A}, kRegisterAl, reg);
+    Emit8(0xFE);
+    Emit8(modrm);
+    EmitMemory({0x88}, kRegisterAl, reg);
+    EmitStoreNz();
+  };
+  // Immediate load that sets N/Z.
+  auto load = [&](std::ptrdiff_t reg) {
+    EmitMemory({0xC6}, 0, reg);
+    Emit8(static_cast<uint8_t>(operand));
+    EmitMemory({0x66, 0xC7}, 0, OffsetOf(&cpu_.nz_result_));
+    Emit16(static_cast<uint8_t>(operand));
+  };
+  // Stores an immediate into the carry.
+  auto set_carry = [&](uint8_t value) {
+    EmitMemory({0xC6}, 0, OffsetOf(&cpu_.carry_));
+    Emit8(value);
+  };
+
+  switch (opcode) {
+    case 0x18: set_carry(0); break;      // CLC
+    case 0x38: set_carry(1); break;      // SEC
+    case 0x88: step(y, 0xC8); break;     // DEY
+    case 0x8A: transfer(x, a); break;    // TXA
+    case 0x98: transfer(y, a); break;    // TYA
+    case 0xA0: load(y); break;           // LDY #
+    case 0xA2: load(x); break;           // LDX #
+    case 0xA8: transfer(a, y); break;    // TAY
+    case 0xA9: load(a); break;           // LDA #
+    case 0xAA: transfer(a, x); break;    // TAX
+    case 0xC8: step(y, 0xC0); break;     // INY
+    case 0xCA: step(x, 0xC8); break;     // DEX
+    case 0xE8: step(x, 0xC0); break;     // INX
+    case 0xEA: break;                    // NOP
+    default: return false;
+  }
+  EmitAdvance(length, cycles);
+  EmitDeadlineCheck();
+  return true;
+}
+
+bool Jit::EmitBranch(uint8_t opcode, uint16_t operand, uint16_t address) {
+  if ((opcode & 0x1F) != 0x10) return false;
+  const uint16_t next = static_cast<uint16_t>(address + 2);
+  const uint16_t target =
+      static_cast<uint16_t>(next + static_cast<int8_t>(operand));
+  // Backward branches have to go through Cpu::Branch() to detect idle loops.
+  if (cpu_.idle_loop_skipping_ && target < next) return false;
+
+  // Evaluates the lazy flag and picks the condition under which the branch
+  // is not taken.
+  uint8_t not_taken;
+  switch (opcode) {
+    case 0x10:  // BPL
+    case 0x30:  // BMI
+      // N is bit 7 of the low or high byte of the N/Z result.
+      EmitMemory({0x0F, 0xB7}, kRegisterAl, OffsetOf(&cpu_.nz_result_));
+      EmitBytes({0x89, 0xC1});        // mov ecx, eax
+      EmitBytes({0xC1, 0xE9, 0x08});  // shr ecx, 8
+      EmitBytes({0x09, 0xC8});        // or eax, ecx
+      EmitBytes({0xA8, 0x80});        // test al, 0x80
+      not_taken = opcode == 0x10 ? kConditionNotZero : kConditionZero;
+      break;
+    case 0x50:  // BVC
+    case 0x70:  // BVS
+      EmitMemory({0xF6}, 0, OffsetOf(&cpu_.overflow_result_));
+      Emit8(0x80);
+      not_taken = opcode == 0x50 ? kConditionNotZero : kConditionZero;
+      break;
+    case 0x90:  // BCC
+    case 0xB0:  // BCS
+      EmitMemory({0x80}, 7, OffsetOf(&cpu_.carry_));  // cmp byte, imm8
+      Emit8(0);
+      not_taken = opcode == 0x90 ? kConditionNotZero : kConditionZero;
+      break;
+    case 0xD0:  // BNE
+    case 0xF0:  // BEQ
+      EmitMemory({0xF6}, 0, OffsetOf(&cpu_.nz_result_));  // test byte, imm8
+      Emit8(0xFF);
+      not_taken = opcode == 0xD0 ? kConditionZero : kConditionNotZero;
+      break;
+    default:
+      return false;
+  }
+  Emit8(0x0F);
+  Emit8(not_taken);
+  const size_t skip = block_code_.size();
+  Emit32(0);
+
+  // Taken: the target and the page-crossing penalty are known statically.
+  EmitMemory({0x66, 0xC7}, 0, OffsetOf(&cpu_.pc_));  // mov word, imm16
+  Emit16(target);
+  EmitMemory({0x48, 0x83}, 0, OffsetOf(&cpu_.cycles_));
+  Emit8((next ^ target) >> 8 ? 4 : 3);
+  size_t loop = 0;
+  bool in_block = false;
+  for (const auto& instruction : instruction_offsets_) {
+    if (instruction.first == target) {
+      loop = instruction.second;
+      in_block = true;
+    }
+  }
+  if (in_block) {
+    EmitDeadlineCheck();
+    Emit8(0xE9);  // jmp rel32
+    Emit32(static_cast<uint32_t>(loop - (block_code_.size() + 4)));
+  } else {
+    Emit8(0xE9);
+    exit_jumps_.push_back(block_code_.size());
+    Emit32(0);
+  }
+
+  const int32_t displacement =
+      static_cast<int32_t>(block_code_.size() - (skip + 4));
+  std::memcpy(&block_code_[skip], &displacement, sizeof(displacement));
+  EmitAdvance(2, 2);
+  return true;
+}
+
+void Jit::EmitThunkCall(uint8_t opcode, uint32_t argument) {
+  for (uint8_t byte : kMovFirstArgumentRbx) Emit8(byte);
+  Emit8(kMovSecondArgumentImm32);
+  Emit32(argument);
+  EmitBytes({0x48, 0xB8});  // mov rax, imm64
+  Emit64(reinterpret_cast<uint64_t>(Cpu::kInstructionEntries[opcode]));
+  EmitBytes({0xFF, 0xD0});  // call rax
+  EmitBytes({0x84, 0xC0});  // test al, al
+  EmitExitJump(kConditionNotZero);
+}
+
+std::ptrdiff_t Jit::OffsetOf(const void* member) const {
+  return static_cast<const char*>(member) -
+         reinterpret_cast<const char*>(&cpu_);
+}
+
+}  // namespace purenes
+
+#endif  // PURENES_JIT_X64
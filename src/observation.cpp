@@ -0,0 +1,226 @@
+#include "observation.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+#include "pixel_format.h"
+#include "scanline_kernels.h"
+
+#ifdef PURENES_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace purenes {
+
+namespace {
+
+constexpr size_t kFramePixels = Ppu::kWidth * Ppu::kHeight;
+
+// The weights of the rows that an observed row covers add up to the frame
+// height, so its column sums fit in 16 bits.
+static_assert(Ppu::kHeight * 0xFF <= 0xFFFF,
+              "column sums of luma overflow 16 bits");
+
+void MaxScalar(const uint8_t* a, const uint8_t* b, size_t count,
+               uint8_t* out) {
+  for (size_t i = 0; i < count; ++i) out[i] = std::max(a[i], b[i]);
+}
+
+#ifdef PURENES_SIMD_X86
+
+__attribute__((target("ssse3"))) void MaxSsse3(const uint8_t* a,
+                                               const uint8_t* b, size_t count,
+                                               uint8_t* out) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(out + i),
+        _mm_max_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+  }
+  MaxScalar(a + i, b + i, count - i, out + i);
+}
+
+__attribute__((target("avx2"))) void MaxAvx2(const uint8_t* a,
+                                             const uint8_t* b, size_t count,
+                                             uint8_t* out) {
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(out + i),
+        _mm256_max_epu8(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i))));
+  }
+  MaxScalar(a + i, b + i, count - i, out + i);
+}
+
+#endif  // PURENES_SIMD_X86
+
+void Max(Ppu::Simd simd, const uint8_t* a, const uint8_t* b, size_t count,
+         uint8_t* out) {
+#ifdef PURENES_SIMD_X86
+  switch (simd) {
+    case Ppu::Simd::kNone:
+      break;
+    case Ppu::Simd::kSsse3:
+      return MaxSsse3(a, b, count, out);
+    case Ppu::Simd::kAvx2:
+      return MaxAvx2(a, b, count, out);
+  }
+#else
+  static_cast<void>(simd);
+#endif
+  MaxScalar(a, b, count, out);
+}
+
+// Adds `weight` times each of `count` bytes of `source` to `sums`.
+void AccumulateScalar(uint16_t weight, const uint8_t* source, size_t count,
+                      uint16_t* sums) {
+  for (size_t i = 0; i < count; ++i) {
+    sums[i] = static_cast<uint16_t>(sums[i] + weight * source[i]);
+  }
+}
+
+#ifdef PURENES_SIMD_X86
+
+__attribute__((target("ssse3"))) void AccumulateSsse3(uint16_t weight,
+                                                      const uint8_t* source,
+                                                      size_t count,
+                                                      uint16_t* sums) {
+  const __m128i weights = _mm_set1_epi16(static_cast<short>(weight));
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+    __m128i* const lo = reinterpret_cast<__m128i*>(sums + i);
+    __m128i* const hi = reinterpret_cast<__m128i*>(sums + i + 8);
+    _mm_storeu_si128(
+        lo, _mm_add_epi16(_mm_loadu_si128(lo),
+                          _mm_mullo_epi16(_mm_unpacklo_epi8(bytes, zero),
+                                          weights)));
+    _mm_storeu_si128(
+        hi, _mm_add_epi16(_mm_loadu_si128(hi),
+                          _mm_mullo_epi16(_mm_unpackhi_epi8(bytes, zero),
+                                          weights)));
+  }
+  AccumulateScalar(weight, source + i, count - i, sums + i);
+}
+
+__attribute__((target("avx2"))) void AccumulateAvx2(uint16_t weight,
+                                                    const uint8_t* source,
+                                                    size_t count,
+                                                    uint16_t* sums) {
+  const __m256i weights = _mm256_set1_epi16(static_cast<short>(weight));
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i* const out = reinterpret_cast<__m256i*>(sums + i);
+    const __m256i words = _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)));
+    _mm256_storeu_si256(out,
+                        _mm256_add_epi16(_mm256_loadu_si256(out),
+                                         _mm256_mullo_epi16(words, weights)));
+  }
+  AccumulateScalar(weight, source + i, count - i, sums + i);
+}
+
+#endif  // PURENES_SIMD_X86
+
+void Accumulate(Ppu::Simd simd, uint16_t weight, const uint8_t* source,
+                size_t count, uint16_t* sums) {
+#ifdef PURENES_SIMD_X86
+  switch (simd) {
+    case Ppu::Simd::kNone:
+      break;
+    case Ppu::Simd::kSsse3:
+      return AccumulateSsse3(weight, source, count, sums);
+    case Ppu::Simd::kAvx2:
+      return AccumulateAvx2(weight, source, count, sums);
+  }
+#else
+  static_cast<void>(simd);
+#endif
+  AccumulateScalar(weight, source, count, sums);
+}
+
+}  // namespace
+
+constexpr int Observation::kDefaultSize;
+
+Observation::Observation(int width, int height, Ppu::Simd simd)
+    : width_(width),
+      height_(height),
+      simd_(simd),
+      columns_(Spans(Ppu::kWidth, width)),
+      rows_(Spans(Ppu::kHeight, height)),
+      current_(kFramePixels),
+      previous_(kFramePixels),
+      pooled_(kFramePixels),
+      column_sums_(Ppu::kWidth),
+      pixels_(width * height) {}
+
+std::vector<Observation::Span> Observation::Spans(int source, int target) {
+  // Measured in units of 1/target source pixels, source pixel s covers
+  // [s * target, (s + 1) * target) and observed pixel i covers
+  // [i * source, (i + 1) * source).
+  std::vector<Span> spans;
+  for (int i = 0; i < target; ++i) {
+    const int start = i * source;
+    const int end = start + source;
+    Span span{start / target, {}};
+    for (int s = span.first; s * target < end; ++s) {
+      const int covered =
+          std::min(end, (s + 1) * target) - std::max(start, s * target);
+      span.weights.push_back(static_cast<uint32_t>(covered));
+    }
+    spans.push_back(std::move(span));
+  }
+  return spans;
+}
+
+void Observation::AddFrame(const uint16_t* frame, uint64_t number) {
+  current_.swap(previous_);
+  ConvertPixels(frame, kFramePixels, PixelFormat::kGray8, current_.data(),
+                simd_);
+  // A frame skipped in between would have been the one to pool with.
+  const uint8_t* pooled = current_.data();
+  if (number == number_ + 1) {
+    Max(simd_, current_.data(), previous_.data(), kFramePixels,
+        pooled_.data());
+    pooled = pooled_.data();
+  }
+  number_ = number;
+
+  // Every observed pixel sums its luma weighted by both spans, whose
+  // weights add up to the source width and height. Rows are summed first,
+  // a whole frame width at a time in 16-bit lanes, which leaves only an
+  // observed row of columns to scale horizontally.
+  const uint32_t total = Ppu::kWidth * Ppu::kHeight;
+  for (int y = 0; y < height_; ++y) {
+    const Span& row = rows_[y];
+    std::fill(column_sums_.begin(), column_sums_.end(), 0);
+    for (size_t i = 0; i < row.weights.size(); ++i) {
+      Accumulate(simd_, static_cast<uint16_t>(row.weights[i]),
+                 pooled + (row.first + i) * Ppu::kWidth, Ppu::kWidth,
+                 column_sums_.data());
+    }
+    for (int x = 0; x < width_; ++x) {
+      const Span& column = columns_[x];
+      uint32_t sum = 0;
+      for (size_t i = 0; i < column.weights.size(); ++i) {
+        sum += column.weights[i] * column_sums_[column.first + i];
+      }
+      pixels_[y * width_ + x] = static_cast<uint8_t>((sum + total / 2) / total);
+    }
+  }
+}
+
+void Observation::Clear() {
+  std::fill(current_.begin(), current_.end(), 0);
+  std::fill(previous_.begin(), previous_.end(), 0);
+  std::fill(pixels_.begin(), pixels_.end(), 0);
+}
+
+}  // namespace purenes
@@ -0,0 +1,59 @@
+#include "opcode_pair_profile.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "opcodes.h"
+
+namespace purenes {
+
+namespace {
+
+#define PURENES_OPCODE_NAME(opcode, operation, mode, cycles, penalty) \
+  #operation " " #mode,
+constexpr const char* kOpcodeNames[256] = {
+    PURENES_OPCODES(PURENES_OPCODE_NAME)};
+#undef PURENES_OPCODE_NAME
+
+}  // namespace
+
+OpcodePairProfile::OpcodePairProfile() : counts_(256 * 256) {}
+
+void OpcodePairProfile::Record(uint8_t opcode) {
+  if (previous_ >= 0) {
+    ++counts_[previous_ << 8 | opcode];
+    ++total_;
+  }
+  previous_ = opcode;
+}
+
+void OpcodePairProfile::Interrupt() { previous_ = -1; }
+
+std::vector<OpcodePairProfile::Pair> OpcodePairProfile::Top(
+    size_t limit) const {
+  std::vector<Pair> pairs;
+  for (int i = 0; i < 256 * 256; ++i) {
+    if (counts_[i] == 0) continue;
+    pairs.push_back({static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i),
+                     counts_[i]});
+  }
+  const size_t size = std::min(limit, pairs.size());
+  std::partial_sort(pairs.begin(), pairs.begin() + size, pairs.end(),
+                    [](const Pair& a, const Pair& b) {
+                      return a.count > b.count;
+                    });
+  pairs.resize(size);
+  return pairs;
+}
+
+void OpcodePairProfile::Report(size_t limit, std::ostream& out) const {
+  for (const Pair& pair : Top(limit)) {
+    char line[96];
+    std::snprintf(line, sizeof(line), "%02X %02X  %6.2f%%  %s, %s\n",
+                  pair.first, pair.second, 100.0 * pair.count / total_,
+                  kOpcodeNames[pair.first], kOpcodeNames[pair.second]);
+    out << line;
+  }
+}
+
+}  // namespace purenes
@@ -0,0 +1,330 @@
+#ifndef PURENES_OPCODES_H
+#define PURENES_OPCODES_H
+
+// The complete 2A03 instruction set as an X-macro, one entry per opcode in
+// ascending opcode order:
+//
+//   X(opcode, Operation, AddressingMode, base cycles, page-cross penalty)
+//
+// Everything that needs to know about individual opcodes (the dispatch table,
+// the disassembler, the tests) expands this list rather than keeping its own
+// copy, so the entries can never disagree with each other. The list must stay
+// sorted; cpu.cpp static_asserts that entry N describes opcode N.
+//
+// The page-cross penalty column is 1 for read instructions whose indexed
+// effective address costs an extra cycle when it lands in a different page
+// than the base address. Branches account for their own extra cycles. The
+// CPU charges the penalty through the access policy of the operation, and
+// cpu.cpp static_asserts that both agree.
+#define PURENES_OPCODES(X)                 \
+  X(0x00, Brk, Implied,     7, 0)          \
+  X(0x01, Ora, IndirectX,   6, 0)          \
+  X(0x02, Jam, Implied,     2, 0)          \
+  X(0x03, Slo, IndirectX,   8, 0)          \
+  X(0x04, Nop, ZeroPage,    3, 0)          \
+  X(0x05, Ora, ZeroPage,    3, 0)          \
+  X(0x06, Asl, ZeroPage,    5, 0)          \
+  X(0x07, Slo, ZeroPage,    5, 0)          \
+  X(0x08, Php, Implied,     3, 0)          \
+  X(0x09, Ora, Immediate,   2, 0)          \
+  X(0x0A, Asl, Accumulator, 2, 0)          \
+  X(0x0B, Anc, Immediate,   2, 0)          \
+  X(0x0C, Nop, Absolute,    4, 0)          \
+  X(0x0D, Ora, Absolute,    4, 0)          \
+  X(0x0E, Asl, Absolute,    6, 0)          \
+  X(0x0F, Slo, Absolute,    6, 0)          \
+  X(0x10, Bpl, Relative,    2, 0)          \
+  X(0x11, Ora, IndirectY,   5, 1)          \
+  X(0x12, Jam, Implied,     2, 0)          \
+  X(0x13, Slo, IndirectY,   8, 0)          \
+  X(0x14, Nop, ZeroPageX,   4, 0)          \
+  X(0x15, Ora, ZeroPageX,   4, 0)          \
+  X(0x16, Asl, ZeroPageX,   6, 0)          \
+  X(0x17, Slo, ZeroPageX,   6, 0)          \
+  X(0x18, Clc, Implied,     2, 0)          \
+  X(0x19, Ora, AbsoluteY,   4, 1)          \
+  X(0x1A, Nop, Implied,     2, 0)          \
+  X(0x1B, Slo, AbsoluteY,   7, 0)          \
+  X(0x1C, Nop, AbsoluteX,   4, 1)          \
+  X(0x1D, Ora, AbsoluteX,   4, 1)          \
+  X(0x1E, Asl, AbsoluteX,   7, 0)          \
+  X(0x1F, Slo, AbsoluteX,   7, 0)          \
+  X(0x20, Jsr, Absolute,    6, 0)          \
+  X(0x21, And, IndirectX,   6, 0)          \
+  X(0x22, Jam, Implied,     2, 0)          \
+  X(0x23, Rla, IndirectX,   8, 0)          \
+  X(0x24, Bit, ZeroPage,    3, 0)          \
+  X(0x25, And, ZeroPage,    3, 0)          \
+  X(0x26, Rol, ZeroPage,    5, 0)          \
+  X(0x27, Rla, ZeroPage,    5, 0)          \
+  X(0x28, Plp, Implied,     4, 0)          \
+  X(0x29, And, Immediate,   2, 0)          \
+  X(0x2A, Rol, Accumulator, 2, 0)          \
+  X(0x2B, Anc, Immediate,   2, 0)          \
+  X(0x2C, Bit, Absolute,    4, 0)          \
+  X(0x2D, And, Absolute,    4, 0)          \
+  X(0x2E, Rol, Absolute,    6, 0)          \
+  X(0x2F, Rla, Absolute,    6, 0)          \
+  X(0x30, Bmi, Relative,    2, 0)          \
+  X(0x31, And, IndirectY,   5, 1)          \
+  X(0x32, Jam, Implied,     2, 0)          \
+  X(0x33, Rla, IndirectY,   8, 0)          \
+  X(0x34, Nop, ZeroPageX,   4, 0)          \
+  X(0x35, And, ZeroPageX,   4, 0)          \
+  X(0x36, Rol, ZeroPageX,   6, 0)          \
+  X(0x37, Rla, ZeroPageX,   6, 0)          \
+  X(0x38, Sec, Implied,     2, 0)          \
+  X(0x39, And, AbsoluteY,   4, 1)          \
+  X(0x3A, Nop, Implied,     2, 0)          \
+  X(0x3B, Rla, AbsoluteY,   7, 0)          \
+  X(0x3C, Nop, AbsoluteX,   4, 1)          \
+  X(0x3D, And, AbsoluteX,   4, 1)          \
+  X(0x3E, Rol, AbsoluteX,   7, 0)          \
+  X(0x3F, Rla, AbsoluteX,   7, 0)          \
+  X(0x40, Rti, Implied,     6, 0)          \
+  X(0x41, Eor, IndirectX,   6, 0)          \
+  X(0x42, Jam, Implied,     2, 0)          \
+  X(0x43, Sre, IndirectX,   8, 0)          \
+  X(0x44, Nop, ZeroPage,    3, 0)          \
+  X(0x45, Eor, ZeroPage,    3, 0)          \
+  X(0x46, Lsr, ZeroPage,    5, 0)          \
+  X(0x47, Sre, ZeroPage,    5, 0)          \
+  X(0x48, Pha, Implied,     3, 0)          \
+  X(0x49, Eor, Immediate,   2, 0)          \
+  X(0x4A, Lsr, Accumulator, 2, 0)          \
+  X(0x4B, Alr, Immediate,   2, 0)          \
+  X(0x4C, Jmp, Absolute,    3, 0)          \
+  X(0x4D, Eor, Absolute,    4, 0)          \
+  X(0x4E, Lsr, Absolute,    6, 0)          \
+  X(0x4F, Sre, Absolute,    6, 0)          \
+  X(0x50, Bvc, Relative,    2, 0)          \
+  X(0x51, Eor, IndirectY,   5, 1)          \
+  X(0x52, Jam, Implied,     2, 0)          \
+  X(0x53, Sre, IndirectY,   8, 0)          \
+  X(0x54, Nop, ZeroPageX,   4, 0)          \
+  X(0x55, Eor, ZeroPageX,   4, 0)          \
+  X(0x56, Lsr, ZeroPageX,   6, 0)          \
+  X(0x57, Sre, ZeroPageX,   6, 0)          \
+  X(0x58, Cli, Implied,     2, 0)          \
+  X(0x59, Eor, AbsoluteY,   4, 1)          \
+  X(0x5A, Nop, Implied,     2, 0)          \
+  X(0x5B, Sre, AbsoluteY,   7, 0)          \
+  X(0x5C, Nop, AbsoluteX,   4, 1)          \
+  X(0x5D, Eor, AbsoluteX,   4, 1)          \
+  X(0x5E, Lsr, AbsoluteX,   7, 0)          \
+  X(0x5F, Sre, AbsoluteX,   7, 0)          \
+  X(0x60, Rts, Implied,     6, 0)          \
+  X(0x61, Adc, IndirectX,   6, 0)          \
+  X(0x62, Jam, Implied,     2, 0)          \
+  X(0x63, Rra, IndirectX,   8, 0)          \
+  X(0x64, Nop, ZeroPage,    3, 0)          \
+  X(0x65, Adc, ZeroPage,    3, 0)          \
+  X(0x66, Ror, ZeroPage,    5, 0)          \
+  X(0x67, Rra, ZeroPage,    5, 0)          \
+  X(0x68, Pla, Implied,     4, 0)          \
+  X(0x69, Adc, Immediate,   2, 0)          \
+  X(0x6A, Ror, Accumulator, 2, 0)          \
+  X(0x6B, Arr, Immediate,   2, 0)          \
+  X(0x6C, Jmp, Indirect,    5, 0)          \
+  X(0x6D, Adc, Absolute,    4, 0)          \
+  X(0x6E, Ror, Absolute,    6, 0)          \
+  X(0x6F, Rra, Absolute,    6, 0)          \
+  X(0x70, Bvs, Relative,    2, 0)          \
+  X(0x71, Adc, IndirectY,   5, 1)          \
+  X(0x72, Jam, Implied,     2, 0)          \
+  X(0x73, Rra, IndirectY,   8, 0)          \
+  X(0x74, Nop, ZeroPageX,   4, 0)          \
+  X(0x75, Adc, ZeroPageX,   4, 0)          \
+  X(0x76, Ror, ZeroPageX,   6, 0)          \
+  X(0x77, Rra, ZeroPageX,   6, 0)          \
+  X(0x78, Sei, Implied,     2, 0)          \
+  X(0x79, Adc, AbsoluteY,   4, 1)          \
+  X(0x7A, Nop, Implied,     2, 0)          \
+  X(0x7B, Rra, AbsoluteY,   7, 0)          \
+  X(0x7C, Nop, AbsoluteX,   4, 1)          \
+  X(0x7D, Adc, AbsoluteX,   4, 1)          \
+  X(0x7E, Ror, AbsoluteX,   7, 0)          \
+  X(0x7F, Rra, AbsoluteX,   7, 0)          \
+  X(0x80, Nop, Immediate,   2, 0)          \
+  X(0x81, Sta, IndirectX,   6, 0)          \
+  X(0x82, Nop, Immediate,   2, 0)          \
+  X(0x83, Sax, IndirectX,   6, 0)          \
+  X(0x84, Sty, ZeroPage,    3, 0)          \
+  X(0x85, Sta, ZeroPage,    3, 0)          \
+  X(0x86, Stx, ZeroPage,    3, 0)          \
+  X(0x87, Sax, ZeroPage,    3, 0)          \
+  X(0x88, Dey, Implied,     2, 0)          \
+  X(0x89, Nop, Immediate,   2, 0)          \
+  X(0x8A, Txa, Implied,     2, 0)          \
+  X(0x8B, Xaa, Immediate,   2, 0)          \
+  X(0x8C, Sty, Absolute,    4, 0)          \
+  X(0x8D, Sta, Absolute,    4, 0)          \
+  X(0x8E, Stx, Absolute,    4, 0)          \
+  X(0x8F, Sax, Absolute,    4, 0)          \
+  X(0x90, Bcc, Relative,    2, 0)          \
+  X(0x91, Sta, IndirectY,   6, 0)          \
+  X(0x92, Jam, Implied,     2, 0)          \
+  X(0x93, Ahx, IndirectY,   6, 0)          \
+  X(0x94, Sty, ZeroPageX,   4, 0)          \
+  X(0x95, Sta, ZeroPageX,   4, 0)          \
+  X(0x96, Stx, ZeroPageY,   4, 0)          \
+  X(0x97, Sax, ZeroPageY,   4, 0)          \
+  X(0x98, Tya, Implied,     2, 0)          \
+  X(0x99, Sta, AbsoluteY,   5, 0)          \
+  X(0x9A, Txs, Implied,     2, 0)          \
+  X(0x9B, Tas, AbsoluteY,   5, 0)          \
+  X(0x9C, Shy, AbsoluteX,   5, 0)          \
+  X(0x9D, Sta, AbsoluteX,   5, 0)          \
+  X(0x9E, Shx, AbsoluteY,   5, 0)          \
+  X(0x9F, Ahx, AbsoluteY,   5, 0)          \
+  X(0xA0, Ldy, Immediate,   2, 0)          \
+  X(0xA1, Lda, IndirectX,   6, 0)          \
+  X(0xA2, Ldx, Immediate,   2, 0)          \
+  X(0xA3, Lax, IndirectX,   6, 0)          \
+  X(0xA4, Ldy, ZeroPage,    3, 0)          \
+  X(0xA5, Lda, ZeroPage,    3, 0)          \
+  X(0xA6, Ldx, ZeroPage,    3, 0)          \
+  X(0xA7, Lax, ZeroPage,    3, 0)          \
+  X(0xA8, Tay, Implied,     2, 0)          \
+  X(0xA9, Lda, Immediate,   2, 0)          \
+  X(0xAA, Tax, Implied,     2, 0)          \
+  X(0xAB, Lax, Immediate,   2, 0)          \
+  X(0xAC, Ldy, Absolute,    4, 0)          \
+  X(0xAD, Lda, Absolute,    4, 0)          \
+  X(0xAE, Ldx, Absolute,    4, 0)          \
+  X(0xAF, Lax, Absolute,    4, 0)          \
+  X(0xB0, Bcs, Relative,    2, 0)          \
+  X(0xB1, Lda, IndirectY,   5, 1)          \
+  X(0xB2, Jam, Implied,     2, 0)          \
+  X(0xB3, Lax, IndirectY,   5, 1)          \
+  X(0xB4, Ldy, ZeroPageX,   4, 0)          \
+  X(0xB5, Lda, ZeroPageX,   4, 0)          \
+  X(0xB6, Ldx, ZeroPageY,   4, 0)          \
+  X(0xB7, Lax, ZeroPageY,   4, 0)          \
+  X(0xB8, Clv, Implied,     2, 0)          \
+  X(0xB9, Lda, AbsoluteY,   4, 1)          \
+  X(0xBA, Tsx, Implied,     2, 0)          \
+  X(0xBB, Las, AbsoluteY,   4, 1)          \
+  X(0xBC, Ldy, AbsoluteX,   4, 1)          \
+  X(0xBD, Lda, AbsoluteX,   4, 1)          \
+  X(0xBE, Ldx, AbsoluteY,   4, 1)          \
+  X(0xBF, Lax, AbsoluteY,   4, 1)          \
+  X(0xC0, Cpy, Immediate,   2, 0)          \
+  X(0xC1, Cmp, IndirectX,   6, 0)          \
+  X(0xC2, Nop, Immediate,   2, 0)          \
+  X(0xC3, Dcp, IndirectX,   8, 0)          \
+  X(0xC4, Cpy, ZeroPage,    3, 0)          \
+  X(0xC5, Cmp, ZeroPage,    3, 0)          \
+  X(0xC6, Dec, ZeroPage,    5, 0)          \
+  X(0xC7, Dcp, ZeroPage,    5, 0)          \
+  X(0xC8, Iny, Implied,     2, 0)          \
+  X(0xC9, Cmp, Immediate,   2, 0)          \
+  X(0xCA, Dex, Implied,     2, 0)          \
+  X(0xCB, Axs, Immediate,   2, 0)          \
+  X(0xCC, Cpy, Absolute,    4, 0)          \
+  X(0xCD, Cmp, Absolute,    4, 0)          \
+  X(0xCE, Dec, Absolute,    6, 0)          \
+  X(0xCF, Dcp, Absolute,    6, 0)          \
+  X(0xD0, Bne, Relative,    2, 0)          \
+  X(0xD1, Cmp, IndirectY,   5, 1)          \
+  X(0xD2, Jam, Implied,     2, 0)          \
+  X(0xD3, Dcp, IndirectY,   8, 0)          \
+  X(0xD4, Nop, ZeroPageX,   4, 0)          \
+  X(0xD5, Cmp, ZeroPageX,   4, 0)          \
+  X(0xD6, Dec, ZeroPageX,   6, 0)          \
+  X(0xD7, Dcp, ZeroPageX,   6, 0)          \
+  X(0xD8, Cld, Implied,     2, 0)          \
+  X(0xD9, Cmp, AbsoluteY,   4, 1)          \
+  X(0xDA, Nop, Implied,     2, 0)          \
+  X(0xDB, Dcp, AbsoluteY,   7, 0)          \
+  X(0xDC, Nop, AbsoluteX,   4, 1)          \
+  X(0xDD, Cmp, AbsoluteX,   4, 1)          \
+  X(0xDE, Dec, AbsoluteX,   7, 0)          \
+  X(0xDF, Dcp, AbsoluteX,   7, 0)          \
+  X(0xE0, Cpx, Immediate,   2, 0)          \
+  X(0xE1, Sbc, IndirectX,   6, 0)          \
+  X(0xE2, Nop, Immediate,   2, 0)          \
+  X(0xE3, Isc, IndirectX,   8, 0)          \
+  X(0xE4, Cpx, ZeroPage,    3, 0)          \
+  X(0xE5, Sbc, ZeroPage,    3, 0)          \
+  X(0xE6, Inc, ZeroPage,    5, 0)          \
+  X(0xE7, Isc, ZeroPage,    5, 0)          \
+  X(0xE8, Inx, Implied,     2, 0)          \
+  X(0xE9, Sbc, Immediate,   2, 0)          \
+  X(0xEA, Nop, Implied,     2, 0)          \
+  X(0xEB, Sbc, Immediate,   2, 0)          \
+  X(0xEC, Cpx, Absolute,    4, 0)          \
+  X(0xED, Sbc, Absolute,    4, 0)          \
+  X(0xEE, Inc, Absolute,    6, 0)          \
+  X(0xEF, Isc, Absolute,    6, 0)          \
+  X(0xF0, Beq, Relative,    2, 0)          \
+  X(0xF1, Sbc, IndirectY,   5, 1)          \
+  X(0xF2, Jam, Implied,     2, 0)          \
+  X(0xF3, Isc, IndirectY,   8, 0)          \
+  X(0xF4, Nop, ZeroPageX,   4, 0)          \
+  X(0xF5, Sbc, ZeroPageX,   4, 0)          \
+  X(0xF6, Inc, ZeroPageX,   6, 0)          \
+  X(0xF7, Isc, ZeroPageX,   6, 0)          \
+  X(0xF8, Sed, Implied,     2, 0)          \
+  X(0xF9, Sbc, AbsoluteY,   4, 1)          \
+  X(0xFA, Nop, Implied,     2, 0)          \
+  X(0xFB, Isc, AbsoluteY,   7, 0)          \
+  X(0xFC, Nop, AbsoluteX,   4, 1)          \
+  X(0xFD, Sbc, AbsoluteX,   4, 1)          \
+  X(0xFE, Inc, AbsoluteX,   7, 0)          \
+  X(0xFF, Isc, AbsoluteX,   7, 0)
+
+// Pairs of consecutive instructions that the threaded run loop executes as
+// one superinstruction, saving the dispatch of the second one:
+//
+//   X(Name, first opcode, second opcode)
+//
+// Both instructions keep their own cycle counts, and the interrupt and
+// deadline checks between them still happen. Pairs worth adding show up in
+// the frequencies that Cpu::SetOpcodePairProfile() collects from a workload.
+#define PURENES_FUSIONS(X)                 \
+  X(DexBne, 0xCA, 0xD0)                    \
+  X(DeyBne, 0x88, 0xD0)                    \
+  X(InxBne, 0xE8, 0xD0)                    \
+  X(InyBne, 0xC8, 0xD0)                    \
+  X(LdaImmStaZp, 0xA9, 0x85)               \
+  X(LdaImmStaAbs, 0xA9, 0x8D)              \
+  X(LdaZpStaZp, 0xA5, 0x85)                \
+  X(LdaZpStaAbs, 0xA5, 0x8D)               \
+  X(LdaAbsStaZp, 0xAD, 0x85)               \
+  X(LdaAbsStaAbs, 0xAD, 0x8D)              \
+  X(LdaAbsXStaAbsX, 0xBD, 0x9D)            \
+  X(LdaIndYStaIndY, 0xB1, 0x91)            \
+  X(CmpImmBeq, 0xC9, 0xF0)                 \
+  X(CmpImmBne, 0xC9, 0xD0)                 \
+  X(CmpZpBeq, 0xC5, 0xF0)                  \
+  X(CmpZpBne, 0xC5, 0xD0)                  \
+  X(IncZpLdaZp, 0xE6, 0xA5)                \
+  X(ClcAdcImm, 0x18, 0x69)                 \
+  X(ClcAdcZp, 0x18, 0x65)                  \
+  X(ClcAdcAbs, 0x18, 0x6D)                 \
+  X(SecSbcImm, 0x38, 0xE9)
+
+#include <cstdint>
+
+namespace purenes {
+
+// Number of operand bytes following the opcode, per addressing mode, named
+// so that kOperandBytes##mode can be pasted from the list above.
+constexpr uint8_t kOperandBytesImplied = 0;
+constexpr uint8_t kOperandBytesAccumulator = 0;
+constexpr uint8_t kOperandBytesImmediate = 1;
+constexpr uint8_t kOperandBytesZeroPage = 1;
+constexpr uint8_t kOperandBytesZeroPageX = 1;
+constexpr uint8_t kOperandBytesZeroPageY = 1;
+constexpr uint8_t kOperandBytesAbsolute = 2;
+constexpr uint8_t kOperandBytesAbsoluteX = 2;
+constexpr uint8_t kOperandBytesAbsoluteY = 2;
+constexpr uint8_t kOperandBytesIndirect = 2;
+constexpr uint8_t kOperandBytesIndirectX = 1;
+constexpr uint8_t kOperandBytesIndirectY = 1;
+constexpr uint8_t kOperandBytesRelative = 1;
+
+}  // namespace purenes
+
+#endif //PURENES_OPCODES_H
@@ -0,0 +1,302 @@
+#include "pixel_format.h"
+
+#include <cstring>
+
+#include "scanline_kernels.h"
+
+#ifdef PURENES_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace purenes {
+
+namespace {
+
+// The 64 colors of the 2C02 as 0xRRGGBB.
+constexpr uint32_t kColors[64] = {
+    0x545454, 0x001E74, 0x081090, 0x300088, 0x440064, 0x5C0030, 0x540400,
+    0x3C1800, 0x202A00, 0x083A00, 0x004000, 0x003C00, 0x00323C, 0x000000,
+    0x000000, 0x000000, 0x989698, 0x084CC4, 0x3032EC, 0x5C1EE4, 0x8814B0,
+    0xA01464, 0x982220, 0x783C00, 0x545A00, 0x287200, 0x087C00, 0x007628,
+    0x006678, 0x000000, 0x000000, 0x000000, 0xECEEEC, 0x4C9AEC, 0x787CEC,
+    0xB062EC, 0xE454EC, 0xEC58B4, 0xEC6A64, 0xD48820, 0xA0AA00, 0x74C400,
+    0x4CD020, 0x38CC6C, 0x38B4CC, 0x3C3C3C, 0x000000, 0x000000, 0xECEEEC,
+    0xA8CCEC, 0xBCBCEC, 0xD4B2EC, 0xECAEEC, 0xECAED4, 0xECB4B0, 0xE4C490,
+    0xCCD278, 0xB4DE78, 0xA8E290, 0x98E2B4, 0xA0D6E4, 0xA0A2A0, 0x000000,
+    0x000000,
+};
+
+// Palette indices: 64 colors times 8 combinations of emphasis bits.
+constexpr int kIndices = 512;
+constexpr uint16_t kIndexMask = kIndices - 1;
+// Each emphasized channel dims the others to 209/256, about 0.816.
+constexpr int kDimming = 209;
+
+// The pixel of every palette index in every format, 32 bits wide so that
+// they can be gathered: the bytes of the 32-bit formats in memory order,
+// the others in the low bits.
+struct Tables {
+  alignas(32) uint32_t rgba[kIndices];
+  alignas(32) uint32_t bgra[kIndices];
+  alignas(32) uint32_t rgb565[kIndices];
+  alignas(32) uint32_t gray[kIndices];
+};
+
+Tables BuildTables() {
+  Tables tables;
+  for (int index = 0; index < kIndices; ++index) {
+    const uint32_t color = kColors[index & 0x3F];
+    const int emphasis = index >> 6;
+    int rgb[3] = {static_cast<int>(color >> 16 & 0xFF),
+                  static_cast<int>(color >> 8 & 0xFF),
+                  static_cast<int>(color & 0xFF)};
+    for (int channel = 0; channel < 3; ++channel) {
+      for (int other = 0; other < 3; ++other) {
+        if (other != channel && (emphasis >> other & 1)) {
+          rgb[channel] = rgb[channel] * kDimming >> 8;
+        }
+      }
+    }
+    const uint8_t r = static_cast<uint8_t>(rgb[0]);
+    const uint8_t g = static_cast<uint8_t>(rgb[1]);
+    const uint8_t b = static_cast<uint8_t>(rgb[2]);
+    const uint8_t rgba[4] = {r, g, b, 0xFF};
+    const uint8_t bgra[4] = {b, g, r, 0xFF};
+    std::memcpy(&tables.rgba[index], rgba, 4);
+    std::memcpy(&tables.bgra[index], bgra, 4);
+    tables.rgb565[index] = static_cast<uint32_t>((r >> 3) << 11 |
+                                                 (g >> 2) << 5 | b >> 3);
+    // ITU-R BT.601 luma.
+    tables.gray[index] =
+        static_cast<uint32_t>((r * 77 + g * 150 + b * 29 + 128) >> 8);
+  }
+  return tables;
+}
+
+const Tables& GetTables() {
+  static const Tables tables = BuildTables();
+  return tables;
+}
+
+const uint32_t* TableOf(PixelFormat format) {
+  const Tables& tables = GetTables();
+  switch (format) {
+    case PixelFormat::kRgba8888:
+      return tables.rgba;
+    case PixelFormat::kBgra8888:
+      return tables.bgra;
+    case PixelFormat::kRgb565:
+      return tables.rgb565;
+    case PixelFormat::kGray8:
+    case PixelFormat::kIndex16:
+      break;
+  }
+  return tables.gray;
+}
+
+void ConvertScalar(const uint16_t* pixels, size_t count, PixelFormat format,
+                   void* out) {
+  const uint32_t* const table = TableOf(format);
+  switch (format) {
+    case PixelFormat::kIndex16:
+      std::memcpy(out, pixels, count * sizeof(*pixels));
+      break;
+    case PixelFormat::kRgba8888:
+    case PixelFormat::kBgra8888: {
+      uint8_t* const bytes = static_cast<uint8_t*>(out);
+      for (size_t i = 0; i < count; ++i) {
+        std::memcpy(bytes + i * 4, &table[pixels[i] & kIndexMask], 4);
+      }
+      break;
+    }
+    case PixelFormat::kRgb565: {
+      uint16_t* const words = static_cast<uint16_t*>(out);
+      for (size_t i = 0; i < count; ++i) {
+        words[i] = static_cast<uint16_t>(table[pixels[i] & kIndexMask]);
+      }
+      break;
+    }
+    case PixelFormat::kGray8: {
+      uint8_t* const bytes = static_cast<uint8_t*>(out);
+      for (size_t i = 0; i < count; ++i) {
+        bytes[i] = static_cast<uint8_t>(table[pixels[i] & kIndexMask]);
+      }
+      break;
+    }
+  }
+}
+
+#ifdef PURENES_SIMD_X86
+
+// The luma table as SSSE3 shuffles look it up, 16 entries at a time: the
+// luma of the colors under emphasis `emphasis` is in luma[emphasis], 16
+// colors per slice. Each slice after the first holds its luma XORed with
+// that of the slice before, so that XORing the lookups in all slices up to
+// that of a color gives its luma.
+struct GraySlices {
+  alignas(16) uint8_t luma[8][64];
+};
+
+GraySlices BuildGraySlices() {
+  const uint32_t* const gray = GetTables().gray;
+  GraySlices slices;
+  for (int index = 0; index < kIndices; ++index) {
+    const int color = index & 0x3F;
+    const uint32_t previous = color >= 16 ? gray[index - 16] : 0;
+    slices.luma[index >> 6][color] =
+        static_cast<uint8_t>(gray[index] ^ previous);
+  }
+  return slices;
+}
+
+// Converts whole vectors of 16 pixels to kGray8, and returns how many
+// pixels it went through. The 64 colors of the emphasis that the pixels of
+// a vector share, as all pixels of most frames do, take four shuffles;
+// vectors with mixed emphasis are converted by ConvertScalar().
+//
+// The other formats take several bytes per pixel, and so several times the
+// shuffles and interleaving, which is slower than scalar lookups.
+__attribute__((target("ssse3"))) size_t ConvertGraySsse3(
+    const uint16_t* pixels, size_t count, uint8_t* out) {
+  static const GraySlices kSlices = BuildGraySlices();
+  const __m128i emphasis_mask = _mm_set1_epi16(kIndexMask & ~0x3F);
+  const __m128i color_mask = _mm_set1_epi16(0x3F);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i first =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+    const __m128i second =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i + 8));
+    const uint16_t emphasis = pixels[i] & (kIndexMask & ~0x3F);
+    const __m128i expected = _mm_set1_epi16(static_cast<short>(emphasis));
+    const __m128i same = _mm_and_si128(
+        _mm_cmpeq_epi16(_mm_and_si128(first, emphasis_mask), expected),
+        _mm_cmpeq_epi16(_mm_and_si128(second, emphasis_mask), expected));
+    if (_mm_movemask_epi8(same) != 0xFFFF) {
+      ConvertScalar(pixels + i, 16, PixelFormat::kGray8, out + i);
+      continue;
+    }
+
+    // Slice k is looked up with the colors less 16 * k, which the shuffle
+    // turns into 0 where negative.
+    __m128i colors = _mm_packus_epi16(_mm_and_si128(first, color_mask),
+                                      _mm_and_si128(second, color_mask));
+    const uint8_t* const luma = kSlices.luma[emphasis >> 6];
+    __m128i bytes = _mm_setzero_si128();
+    for (int k = 0; k < 4; ++k) {
+      const __m128i slice =
+          _mm_load_si128(reinterpret_cast<const __m128i*>(luma + 16 * k));
+      bytes = _mm_xor_si128(bytes, _mm_shuffle_epi8(slice, colors));
+      colors = _mm_sub_epi8(colors, _mm_set1_epi8(16));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), bytes);
+  }
+  return i;
+}
+
+// The table entries of the 8 palette indices at `pixels`.
+__attribute__((target("avx2"))) __m256i Gather(const uint32_t* table,
+                                               const uint16_t* pixels) {
+  const __m256i indices = _mm256_and_si256(
+      _mm256_cvtepu16_epi32(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels))),
+      _mm256_set1_epi32(kIndexMask));
+  return _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), indices,
+                                4);
+}
+
+// Converts the pixels that fill whole vectors, and returns how many. The
+// 256-bit packs work on each 128-bit half separately, so packed pixels are
+// permuted back in order.
+__attribute__((target("avx2"))) size_t ConvertAvx2(const uint16_t* pixels,
+                                                   size_t count,
+                                                   PixelFormat format,
+                                                   void* out) {
+  const uint32_t* const table = TableOf(format);
+  size_t i = 0;
+  switch (format) {
+    case PixelFormat::kIndex16:
+      // Only copied.
+      break;
+    case PixelFormat::kRgba8888:
+    case PixelFormat::kBgra8888: {
+      __m256i* const vectors = static_cast<__m256i*>(out);
+      for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256(vectors + i / 8, Gather(table, pixels + i));
+      }
+      break;
+    }
+    case PixelFormat::kRgb565: {
+      __m256i* const vectors = static_cast<__m256i*>(out);
+      for (; i + 16 <= count; i += 16) {
+        const __m256i packed =
+            _mm256_packus_epi32(Gather(table, pixels + i),
+                                Gather(table, pixels + i + 8));
+        _mm256_storeu_si256(vectors + i / 16,
+                            _mm256_permute4x64_epi64(packed, 0xD8));
+      }
+      break;
+    }
+    case PixelFormat::kGray8: {
+      const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+      __m256i* const vectors = static_cast<__m256i*>(out);
+      for (; i + 32 <= count; i += 32) {
+        const __m256i low =
+            _mm256_packus_epi32(Gather(table, pixels + i),
+                                Gather(table, pixels + i + 8));
+        const __m256i high =
+            _mm256_packus_epi32(Gather(table, pixels + i + 16),
+                                Gather(table, pixels + i + 24));
+        _mm256_storeu_si256(
+            vectors + i / 32,
+            _mm256_permutevar8x32_epi32(_mm256_packus_epi16(low, high),
+                                        order));
+      }
+      break;
+    }
+  }
+  return i;
+}
+
+#endif  // PURENES_SIMD_X86
+
+}  // namespace
+
+size_t BytesPerPixel(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::kRgba8888:
+    case PixelFormat::kBgra8888:
+      return 4;
+    case PixelFormat::kIndex16:
+    case PixelFormat::kRgb565:
+      return 2;
+    case PixelFormat::kGray8:
+      break;
+  }
+  return 1;
+}
+
+void ConvertPixels(const uint16_t* pixels, size_t count, PixelFormat format,
+                   void* out, Ppu::Simd simd) {
+  size_t done = 0;
+#ifdef PURENES_SIMD_X86
+  switch (simd) {
+    case Ppu::Simd::kNone:
+      break;
+    case Ppu::Simd::kSsse3:
+      if (format == PixelFormat::kGray8) {
+        done = ConvertGraySsse3(pixels, count, static_cast<uint8_t*>(out));
+      }
+      break;
+    case Ppu::Simd::kAvx2:
+      done = ConvertAvx2(pixels, count, format, out);
+      break;
+  }
+#else
+  static_cast<void>(simd);
+#endif
+  ConvertScalar(pixels + done, count - done, format,
+                static_cast<uint8_t*>(out) + done * BytesPerPixel(format));
+}
+
+}  // namespace purenes
@@ -0,0 +1,855 @@
+#include "ppu.h"
+
+#include <algorithm>
+
+#include "cpu.h"
+#include "pixel_format.h"
+#include "scanline_kernels.h"
+#include "scheduler.h"
+
+namespace purenes {
+
+namespace {
+
+// Bits 2-4 of sprite attributes do not exist and read back as 0.
+constexpr uint8_t kAttributeMask = 0xE3;
+
+enum SpriteAttribute : uint8_t {
+  kBehindBackground = 0x20,
+  kFlipHorizontal = 0x40,
+  kFlipVertical = 0x80,
+};
+
+// What pattern memory reads as when there is none.
+const ChrMemory::Row kBlankRow = {};
+
+}  // namespace
+
+constexpr int Ppu::kWidth;
+constexpr int Ppu::kHeight;
+constexpr int Ppu::kDotsPerScanline;
+constexpr int Ppu::kScanlineTiles;
+
+Ppu::Ppu(Cpu& cpu, Scheduler& scheduler, Region region)
+    : cpu_(cpu), scheduler_(scheduler), region_(region) {
+  SetSimd(HostSimd());
+  switch (region) {
+    case Region::kNtsc:
+      SetUp<Region::kNtsc>();
+      break;
+    case Region::kPal:
+      SetUp<Region::kPal>();
+      break;
+    case Region::kDendy:
+      SetUp<Region::kDendy>();
+      break;
+  }
+}
+
+template <Region kRegion>
+void Ppu::SetUp() {
+  pre_render_scanline_ = RegionTiming<kRegion>::kScanlinesPerFrame - 1;
+  catch_up_ = &Ppu::CatchUpIn<kRegion>;
+  SelectSync<kRegion>(Accuracy::kInstruction);
+  scheduler_.SetHandler(Scheduler::kPpu, [this](uint64_t) {
+    CatchUpIn<kRegion>(cpu_.cycles());
+    ScheduleVblank<kRegion>();
+  });
+  ScheduleVblank<kRegion>();
+}
+
+void Ppu::Reset() {
+  (this->*sync_)();
+  control_ = 0;
+  mask_ = 0;
+  read_buffer_ = 0;
+  t_ = 0;
+  fine_x_ = 0;
+  write_toggle_ = false;
+  switch (region_) {
+    case Region::kNtsc:
+      ScheduleVblank<Region::kNtsc>();
+      break;
+    case Region::kPal:
+      ScheduleVblank<Region::kPal>();
+      break;
+    case Region::kDendy:
+      ScheduleVblank<Region::kDendy>();
+      break;
+  }
+}
+
+void Ppu::SetPatternMemory(ChrMemory* chr, size_t offset) {
+  (this->*sync_)();
+  chr_ = chr;
+  chr_offset_ = offset;
+}
+
+Ppu::Simd Ppu::HostSimd() {
+  static const Simd simd = DetectSimd();
+  return simd;
+}
+
+void Ppu::SetSimd(Simd simd) {
+  simd_ = simd;
+  kernels_ = &ScanlineKernelsFor(simd);
+}
+
+void Ppu::SetOutput(void* pixels, ptrdiff_t stride, PixelFormat format) {
+  (this->*sync_)();
+  output_ = static_cast<uint8_t*>(pixels);
+  output_stride_ = stride;
+  output_format_ = format;
+}
+
+void Ppu::SetMirroring(Mirroring mirroring) {
+  (this->*sync_)();
+  mirroring_ = mirroring;
+}
+
+void Ppu::SetAccuracy(Accuracy accuracy) {
+  switch (region_) {
+    case Region::kNtsc:
+      SelectSync<Region::kNtsc>(accuracy);
+      break;
+    case Region::kPal:
+      SelectSync<Region::kPal>(accuracy);
+      break;
+    case Region::kDendy:
+      SelectSync<Region::kDendy>(accuracy);
+      break;
+  }
+}
+
+template <Region kRegion>
+void Ppu::SelectSync(Accuracy accuracy) {
+  switch (accuracy) {
+    case Accuracy::kInstruction:
+      sync_ = &Ppu::Sync<kRegion, Accuracy::kInstruction>;
+      break;
+    case Accuracy::kScanline:
+      sync_ = &Ppu::Sync<kRegion, Accuracy::kScanline>;
+      break;
+  }
+}
+
+template <Region kRegion>
+void Ppu::CatchUpIn(uint64_t cycle) {
+  const uint64_t target = RegionTiming<kRegion>::FirstDot(cycle);
+  while (dots_ < target) {
+    if (dot_ == 0 && dots_ + ScanlineDots<kRegion>() <= target) {
+      RunScanline<kRegion>();
+    } else {
+      Tick<kRegion>();
+    }
+  }
+}
+
+template <Region kRegion, Accuracy kAccuracy>
+void Ppu::Sync() {
+  if (cpu_.cycles() == 0) return;
+  const uint64_t cycle = cpu_.cycles() - 1;
+  if (kAccuracy == Accuracy::kScanline) {
+    RunScanlines<kRegion>(RegionTiming<kRegion>::FirstDot(cycle));
+  } else {
+    CatchUpIn<kRegion>(cycle);
+  }
+}
+
+template <Region kRegion>
+void Ppu::RunScanlines(uint64_t target) {
+  while (dot_ != 0 && dots_ + (kDotsPerScanline - dot_) <= target) {
+    Tick<kRegion>();
+  }
+  while (dot_ == 0 && dots_ + ScanlineDots<kRegion>() <= target) {
+    RunScanline<kRegion>();
+  }
+}
+
+template <Region kRegion>
+int Ppu::ScanlineDots() const {
+  using Timing = RegionTiming<kRegion>;
+  const bool skip = Timing::kSkipsOddFrameDot && odd_frame_ &&
+                    scanline_ == Timing::kScanlinesPerFrame - 1 && rendering();
+  return skip ? kDotsPerScanline - 1 : kDotsPerScanline;
+}
+
+template <Region kRegion>
+void Ppu::RunScanline() {
+  using Timing = RegionTiming<kRegion>;
+  const int dots = ScanlineDots<kRegion>();
+  if (scanline_ < kHeight) {
+    RenderScanline();
+    OutputScanline();
+  } else if (scanline_ == Timing::kScanlinesPerFrame - 1) {
+    status_ &= ~(kVblank | kSpriteZeroHit | kSpriteOverflow);
+    if (rendering()) {
+      SkipScanlineTiles();
+      next_sprite_count_ = 0;
+      sprite_zero_next_ = false;
+      // Copy the vertical scroll bits from t.
+      v_ = static_cast<uint16_t>((v_ & 0x041F) | (t_ & 0x7BE0));
+      PrefetchTiles();
+    }
+    sprite_count_ = 0;
+    sprite_zero_on_line_ = false;
+  } else if (scanline_ == Timing::kVblankScanline) {
+    status_ |= kVblank;
+    ++frame_count_;
+    if (control_ & kNmiEnable) cpu_.Nmi();
+  }
+
+  dots_ += dots;
+  if (++scanline_ == Timing::kScanlinesPerFrame) {
+    scanline_ = 0;
+    odd_frame_ = !odd_frame_;
+  }
+}
+
+template <Region kRegion>
+void Ppu::ScheduleVblank() {
+  using Timing = RegionTiming<kRegion>;
+  // Assumes that an odd frame skips its last dot, so that if it does not,
+  // the event comes one dot early and is simply scheduled again.
+  const int position = scanline_ * kDotsPerScanline + dot_;
+  const int vblank = Timing::kVblankScanline * kDotsPerScanline + 1;
+  int distance = vblank - position;
+  if (distance < 0) {
+    const bool skip = Timing::kSkipsOddFrameDot && odd_frame_;
+    distance += Timing::kScanlinesPerFrame * kDotsPerScanline - (skip ? 1 : 0);
+  }
+  // The dot runs in the CPU cycle it falls into, so it has happened once
+  // the next cycle starts.
+  scheduler_.Schedule(Scheduler::kPpu,
+                      Timing::CycleOfDot(dots_ + distance) + 1);
+}
+
+uint8_t Ppu::Read(uint16_t address) {
+  (this->*sync_)();
+  switch (address & 7) {
+    case 2:
+      io_latch_ = static_cast<uint8_t>(status_ | (io_latch_ & 0x1F));
+      status_ &= ~kVblank;
+      read_status_ = status_;
+      write_toggle_ = false;
+      break;
+    case 4:
+      io_latch_ = (oam_address_ & 3) == 2
+                      ? oam_[oam_address_] & kAttributeMask
+                      : oam_[oam_address_];
+      break;
+    case 7: {
+      const uint16_t vram_address = v_ & 0x3FFF;
+      if (vram_address >= 0x3F00) {
+        // Palette reads are immediate, and buffer the nametable byte
+        // underneath.
+        io_latch_ = static_cast<uint8_t>(ReadMemory(vram_address) |
+                                         (io_latch_ & 0xC0));
+        read_buffer_ = ReadMemory(vram_address - 0x1000);
+      } else {
+        io_latch_ = read_buffer_;
+        read_buffer_ = ReadMemory(vram_address);
+      }
+      if (rendering() && fetching_scanline()) {
+        IncrementX();
+        IncrementY();
+      } else {
+        v_ += control_ & kIncrement32 ? 32 : 1;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return io_latch_;
+}
+
+void Ppu::Write(uint16_t address, uint8_t data) {
+  (this->*sync_)();
+  io_latch_ = data;
+  switch (address & 7) {
+    case 0:
+      // Enabling NMIs during VBlank raises one right away.
+      if (!(control_ & kNmiEnable) && (data & kNmiEnable) &&
+          (status_ & kVblank)) {
+        cpu_.Nmi();
+      }
+      control_ = data;
+      t_ = static_cast<uint16_t>((t_ & 0xF3FF) | (data & 0x03) << 10);
+      break;
+    case 1:
+      mask_ = data;
+      break;
+    case 3:
+      oam_address_ = data;
+      break;
+    case 4:
+      WriteOam(data);
+      break;
+    case 5:
+      if (!write_toggle_) {
+        t_ = static_cast<uint16_t>((t_ & 0xFFE0) | data >> 3);
+        fine_x_ = data & 7;
+      } else {
+        t_ = static_cast<uint16_t>((t_ & 0x8C1F) | (data & 0x07) << 12 |
+                                   (data & 0xF8) << 2);
+      }
+      write_toggle_ = !write_toggle_;
+      break;
+    case 6:
+      if (!write_toggle_) {
+        t_ = static_cast<uint16_t>((t_ & 0x00FF) | (data & 0x3F) << 8);
+      } else {
+        t_ = static_cast<uint16_t>((t_ & 0xFF00) | data);
+        v_ = t_;
+      }
+      write_toggle_ = !write_toggle_;
+      break;
+    case 7:
+      WriteMemory(v_ & 0x3FFF, data);
+      if (rendering() && fetching_scanline()) {
+        IncrementX();
+        IncrementY();
+      } else {
+        v_ += control_ & kIncrement32 ? 32 : 1;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+bool Ppu::HasReadSideEffects(uint16_t address) {
+  // Reads of the write-only registers return the latch, which only changes
+  // on access.
+  switch (address & 7) {
+    case 2:
+    case 4:
+    case 7:
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint64_t Ppu::ReadStableUntil(uint16_t address) {
+  if ((address & 7) != 2) return 0;
+  switch (region_) {
+    case Region::kNtsc:
+      return StatusStableUntil<Region::kNtsc>();
+    case Region::kPal:
+      return StatusStableUntil<Region::kPal>();
+    case Region::kDendy:
+      break;
+  }
+  return StatusStableUntil<Region::kDendy>();
+}
+
+template <Region kRegion>
+uint64_t Ppu::StatusStableUntil() {
+  using Timing = RegionTiming<kRegion>;
+  (this->*sync_)();
+  // The next read has to see what the last one left, which then stays the
+  // same until the pre-render scanline clears the flags, or VBlank sets
+  // one, which is the scheduled event.
+  if (status_ != read_status_) return 0;
+  // Like ScheduleVblank(), this assumes that an odd frame skips a dot,
+  // which at worst ends it a dot early.
+  const int position = scanline_ * kDotsPerScanline + dot_;
+  const int clear = pre_render_scanline_ * kDotsPerScanline + 1;
+  int distance = clear - position;
+  const bool wraps = distance < 0;
+  if (wraps) {
+    const bool skip = Timing::kSkipsOddFrameDot && odd_frame_;
+    distance += Timing::kScanlinesPerFrame * kDotsPerScanline - (skip ? 1 : 0);
+  }
+
+  // Before then, sprite evaluation on the visible scanlines that are left
+  // can set the sprite 0 hit and overflow flags. A sprite list is evaluated
+  // on its scanline, and sprite 0 hits on the next one.
+  if (rendering() && (scanline_ < kHeight || wraps)) {
+    const int height = control_ & kTallSprites ? 16 : 8;
+    if (sprite_lists_height_ != height) BuildSpriteLists(height);
+    const bool hit = status_ & kSpriteZeroHit;
+    const bool overflow = status_ & kSpriteOverflow;
+    for (int line = wraps ? 0 : std::max(scanline_ - 1, 0);
+         line < kHeight; ++line) {
+      const SpriteList& list = sprite_lists_[line];
+      if ((list.sprite_zero && !hit) || (list.overflow && !overflow)) {
+        return 0;
+      }
+    }
+  }
+  return std::min(Timing::CycleOfDot(dots_ + distance) + 1,
+                  scheduler_.scheduled(Scheduler::kPpu));
+}
+
+void Ppu::WriteOam(uint8_t data) {
+  (this->*sync_)();
+  oam_[oam_address_++] = data;
+  sprite_lists_height_ = 0;
+}
+
+template <Region kRegion>
+void Ppu::Tick() {
+  using Timing = RegionTiming<kRegion>;
+  constexpr int kPreRenderScanline = Timing::kScanlinesPerFrame - 1;
+  if (scanline_ < kHeight || scanline_ == kPreRenderScanline) {
+    if (scanline_ == kPreRenderScanline && dot_ == 1) {
+      status_ &= ~(kVblank | kSpriteZeroHit | kSpriteOverflow);
+    }
+    if (rendering()) {
+      FetchBackground();
+      if (dot_ == 257) {
+        if (scanline_ < kHeight) {
+          EvaluateSprites();
+        } else {
+          next_sprite_count_ = 0;
+          sprite_zero_next_ = false;
+        }
+      }
+      if (dot_ == 320) FetchSprites();
+      if (scanline_ == kPreRenderScanline && dot_ >= 280 && dot_ <= 304) {
+        // Copy the vertical scroll bits from t.
+        v_ = static_cast<uint16_t>((v_ & 0x041F) | (t_ & 0x7BE0));
+      }
+    } else if (dot_ == 320) {
+      sprite_count_ = 0;
+      sprite_zero_on_line_ = false;
+    }
+    if (scanline_ < kHeight && dot_ >= 1 && dot_ <= kWidth) {
+      RenderPixel();
+      if (dot_ == kWidth) OutputScanline();
+    }
+  } else if (scanline_ == Timing::kVblankScanline && dot_ == 1) {
+    status_ |= kVblank;
+    ++frame_count_;
+    if (control_ & kNmiEnable) cpu_.Nmi();
+  }
+
+  ++dots_;
+  if (++dot_ == kDotsPerScanline) {
+    dot_ = 0;
+    if (++scanline_ == Timing::kScanlinesPerFrame) {
+      scanline_ = 0;
+      odd_frame_ = !odd_frame_;
+    }
+  } else if (Timing::kSkipsOddFrameDot && dot_ == kDotsPerScanline - 1 &&
+             scanline_ == kPreRenderScanline && odd_frame_ && rendering()) {
+    // Odd frames skip the last dot of the pre-render line.
+    dot_ = 0;
+    scanline_ = 0;
+    odd_frame_ = false;
+  }
+}
+
+void Ppu::FetchBackground() {
+  if ((dot_ >= 2 && dot_ <= 257) || (dot_ >= 321 && dot_ <= 337)) {
+    pattern_low_ <<= 1;
+    pattern_high_ <<= 1;
+    attribute_low_ <<= 1;
+    attribute_high_ <<= 1;
+    switch ((dot_ - 1) & 7) {
+      case 0:
+        ReloadBackgroundShifters();
+        next_tile_ = ReadMemory(0x2000 | (v_ & 0x0FFF));
+        break;
+      case 2:
+        next_attribute_ = AttributeBits(ReadMemory(AttributeAddress()));
+        break;
+      case 4:
+        next_low_ = ReadMemory(BackgroundPatternAddress());
+        break;
+      case 6:
+        next_high_ = ReadMemory(BackgroundPatternAddress() + 8);
+        break;
+      case 7:
+        IncrementX();
+        break;
+      default:
+        break;
+    }
+  }
+  if (dot_ == 256) IncrementY();
+  if (dot_ == 257) {
+    ReloadBackgroundShifters();
+    // Copy the horizontal scroll bits from t.
+    v_ = static_cast<uint16_t>((v_ & 0x7BE0) | (t_ & 0x041F));
+  }
+}
+
+void Ppu::ReloadBackgroundShifters() {
+  pattern_low_ = static_cast<uint16_t>((pattern_low_ & 0xFF00) | next_low_);
+  pattern_high_ = static_cast<uint16_t>((pattern_high_ & 0xFF00) | next_high_);
+  attribute_low_ = static_cast<uint16_t>((attribute_low_ & 0xFF00) |
+                                         (next_attribute_ & 1 ? 0xFF : 0));
+  attribute_high_ = static_cast<uint16_t>((attribute_high_ & 0xFF00) |
+                                          (next_attribute_ & 2 ? 0xFF : 0));
+}
+
+void Ppu::RenderPixel() {
+  const int x = dot_ - 1;
+
+  uint8_t background = 0;
+  if ((mask_ & kShowBackground) && (x >= 8 || (mask_ & kBackgroundLeft))) {
+    const int bit = 15 - fine_x_;
+    const int pixel = (pattern_low_ >> bit & 1) | (pattern_high_ >> bit & 1)
+                                                      << 1;
+    if (pixel) {
+      background = static_cast<uint8_t>(
+          (attribute_low_ >> bit & 1) << 2 | (attribute_high_ >> bit & 1) << 3 |
+          pixel);
+    }
+  }
+
+  uint8_t sprite = 0;
+  bool sprite_in_front = false;
+  if ((mask_ & kShowSprites) && (x >= 8 || (mask_ & kSpritesLeft))) {
+    for (int i = 0; i < sprite_count_; ++i) {
+      const LineSprite& line_sprite = sprites_[i];
+      const int offset = x - line_sprite.x;
+      if (offset < 0 || offset > 7) continue;
+      const int pixel = line_sprite.pixels[offset];
+      if (!pixel) continue;
+      if (i == 0 && sprite_zero_on_line_ && background && x != 255) {
+        status_ |= kSpriteZeroHit;
+      }
+      sprite = static_cast<uint8_t>(0x10 | (line_sprite.attributes & 3) << 2 |
+                                    pixel);
+      sprite_in_front = !(line_sprite.attributes & kBehindBackground);
+      break;
+    }
+  }
+
+  uint8_t index = 0;
+  if (sprite && (sprite_in_front || !background)) {
+    index = sprite;
+  } else if (background) {
+    index = background;
+  }
+  uint8_t color = palette_[index];
+  if (mask_ & kGrayscale) color &= 0x30;
+  frame_[scanline_ * kWidth + x] =
+      static_cast<uint16_t>((color & 0x3F) | emphasis());
+}
+
+void Ppu::OutputScanline() {
+  if (!output_ || !video_output_) return;
+  ConvertPixels(&frame_[scanline_ * kWidth], kWidth, output_format_,
+                output_ + scanline_ * output_stride_, simd_);
+}
+
+void Ppu::RenderScanline() {
+  if (!rendering()) {
+    if (video_output_) {
+      uint8_t color = palette_[0];
+      if (mask_ & kGrayscale) color &= 0x30;
+      uint16_t* const row = &frame_[scanline_ * kWidth];
+      std::fill(row, row + kWidth,
+                static_cast<uint16_t>((color & 0x3F) | emphasis()));
+    }
+    sprite_count_ = 0;
+    sprite_zero_on_line_ = false;
+    return;
+  }
+
+  if (video_output_) {
+    ComposeScanline();
+  } else {
+    if (SpriteZeroHits()) status_ |= kSpriteZeroHit;
+    SkipScanlineTiles();
+  }
+  EvaluateSprites();
+  FetchSprites();
+  PrefetchTiles();
+}
+
+void Ppu::ComposeScanline() {
+  std::array<uint8_t, kScanlineTiles * 8> background_pixels{};
+  uint8_t* const background = &background_pixels[fine_x_];
+  if (mask_ & kShowBackground) {
+    FetchScanlineTiles(background_pixels.data());
+    if (!(mask_ & kBackgroundLeft)) std::fill_n(background, 8, 0);
+  } else {
+    SkipScanlineTiles();
+  }
+
+  // The sprites' pixels, lowest index on top: the palette index, with
+  // kSpriteZeroPixel and kFrontPixel.
+  std::array<uint8_t, kWidth> sprite_pixels{};
+  if (mask_ & kShowSprites) {
+    for (int i = sprite_count_ - 1; i >= 0; --i) {
+      const LineSprite& line_sprite = sprites_[i];
+      const uint8_t flags = static_cast<uint8_t>(
+          (i == 0 && sprite_zero_on_line_ ? kSpriteZeroPixel : 0) |
+          (line_sprite.attributes & kBehindBackground ? 0 : kFrontPixel));
+      const int end = std::min(line_sprite.x + 8, kWidth);
+      for (int x = line_sprite.x; x < end; ++x) {
+        const int pixel = line_sprite.pixels[x - line_sprite.x];
+        if (pixel) {
+          sprite_pixels[x] = static_cast<uint8_t>(
+              flags | 0x10 | (line_sprite.attributes & 3) << 2 | pixel);
+        }
+      }
+    }
+    if (!(mask_ & kSpritesLeft)) std::fill_n(sprite_pixels.begin(), 8, 0);
+    // Sprite 0 never hits at x=255.
+    sprite_pixels[kWidth - 1] &= ~kSpriteZeroPixel;
+  }
+
+  const uint8_t color_mask = mask_ & kGrayscale ? 0x30 : 0x3F;
+  uint16_t* const row = &frame_[scanline_ * kWidth];
+  if (kernels_->compose(background, sprite_pixels.data(), palette_.data(),
+                        color_mask, emphasis(), row)) {
+    status_ |= kSpriteZeroHit;
+  }
+}
+
+bool Ppu::SpriteZeroHits() {
+  constexpr uint8_t kBothLayers = kShowBackground | kShowSprites;
+  if (!sprite_zero_on_line_ || (mask_ & kBothLayers) != kBothLayers) {
+    return false;
+  }
+  const LineSprite& sprite = sprites_[0];
+  uint8_t candidates = sprite.opaque;
+  // Neither layer shows in the left 8 pixels if either is clipped there,
+  // and sprite 0 never hits at x=255.
+  constexpr uint8_t kBothLeft = kBackgroundLeft | kSpritesLeft;
+  if ((mask_ & kBothLeft) != kBothLeft && sprite.x < 8) {
+    candidates &= (1 << sprite.x) - 1;
+  }
+  if (sprite.x > kWidth - 9) candidates &= 0xFF << (sprite.x - (kWidth - 9));
+  if (!candidates) return false;
+
+  // The background pixels under the sprite span two tiles at most.
+  const int position = sprite.x + fine_x_;
+  const int tile = position / 8;
+  const int window = BackgroundOpaque(tile) << 8 | BackgroundOpaque(tile + 1);
+  return candidates & window << (position % 8) >> 8;
+}
+
+uint8_t Ppu::BackgroundOpaque(int tile) {
+  // The shifters hold the first two tiles.
+  if (tile < 2) {
+    return static_cast<uint8_t>((pattern_low_ | pattern_high_) >>
+                                (tile == 0 ? 8 : 0));
+  }
+  const uint16_t v = v_;
+  for (int i = 2; i < tile; ++i) IncrementX();
+  next_tile_ = ReadMemory(0x2000 | (v_ & 0x0FFF));
+  const uint8_t opaque = PatternRow(BackgroundPatternAddress()).opaque;
+  v_ = v;
+  return opaque;
+}
+
+void Ppu::FetchScanlineTiles(uint8_t* pixels) {
+  // The shifters hold the first two tiles, prefetched on the previous
+  // scanline.
+  for (int x = 0; x < 16; ++x) {
+    const int bit = 15 - x;
+    const int pixel =
+        (pattern_low_ >> bit & 1) | (pattern_high_ >> bit & 1) << 1;
+    const int attribute =
+        (attribute_low_ >> bit & 1) | (attribute_high_ >> bit & 1) << 1;
+    pixels[x] = static_cast<uint8_t>(pixel ? attribute << 2 | pixel : 0);
+  }
+  // The others come from the decoded rows, which makes the fetched pattern
+  // bytes unneeded: the shifters and latches only keep what dots 321-337
+  // fetch.
+  constexpr int kFetched = kScanlineTiles - 2;
+  const uint8_t* rows[kFetched];
+  uint8_t attributes[kFetched];
+  for (int i = 0; i < kFetched; ++i) {
+    const uint8_t attribute = ReadMemory(AttributeAddress());
+    attributes[i] = static_cast<uint8_t>(AttributeBits(attribute) << 2);
+    rows[i] = PatternRow(BackgroundPatternAddress()).pixels.data();
+    IncrementX();
+    // Dot 256 moves on to the next row, before dot 257 fetches one more
+    // name.
+    if (i == kFetched - 1) IncrementY();
+    next_tile_ = ReadMemory(0x2000 | (v_ & 0x0FFF));
+  }
+  kernels_->combine_tiles(rows, attributes, kFetched, pixels + 16);
+  // Copy the horizontal scroll bits from t.
+  v_ = static_cast<uint16_t>((v_ & 0x7BE0) | (t_ & 0x041F));
+}
+
+void Ppu::SkipScanlineTiles() {
+  for (int i = 2; i < kScanlineTiles; ++i) IncrementX();
+  IncrementY();
+  // Copy the horizontal scroll bits from t.
+  v_ = static_cast<uint16_t>((v_ & 0x7BE0) | (t_ & 0x041F));
+}
+
+void Ppu::PrefetchTiles() {
+  for (int i = 0; i < 2; ++i) {
+    next_tile_ = ReadMemory(0x2000 | (v_ & 0x0FFF));
+    FetchTile();
+    pattern_low_ = static_cast<uint16_t>(pattern_low_ << 8);
+    pattern_high_ = static_cast<uint16_t>(pattern_high_ << 8);
+    attribute_low_ = static_cast<uint16_t>(attribute_low_ << 8);
+    attribute_high_ = static_cast<uint16_t>(attribute_high_ << 8);
+    ReloadBackgroundShifters();
+  }
+  // Dot 337 fetches the name of the tile that dot 9 reloads.
+  next_tile_ = ReadMemory(0x2000 | (v_ & 0x0FFF));
+}
+
+void Ppu::FetchTile() {
+  next_attribute_ = AttributeBits(ReadMemory(AttributeAddress()));
+  next_low_ = ReadMemory(BackgroundPatternAddress());
+  next_high_ = ReadMemory(BackgroundPatternAddress() + 8);
+  IncrementX();
+}
+
+void Ppu::EvaluateSprites() {
+  const int height = control_ & kTallSprites ? 16 : 8;
+  if (sprite_lists_height_ != height) BuildSpriteLists(height);
+  const SpriteList& list = sprite_lists_[scanline_];
+  next_sprites_ = list.sprites;
+  next_sprite_count_ = list.count;
+  sprite_zero_next_ = list.sprite_zero;
+  if (list.overflow) status_ |= kSpriteOverflow;
+}
+
+void Ppu::BuildSpriteLists(int height) {
+  for (SpriteList& list : sprite_lists_) {
+    list.count = 0;
+    list.sprite_zero = false;
+    list.overflow = false;
+  }
+  // Hand every sprite to the scanlines that it covers, in OAM order, until
+  // a scanline has eight.
+  for (int n = 0; n < 64; ++n) {
+    const int end = std::min(oam_[n * 4] + height, kHeight);
+    for (int line = oam_[n * 4]; line < end; ++line) {
+      SpriteList& list = sprite_lists_[line];
+      if (list.count == kMaxSpritesPerLine) continue;
+      if (n == 0) list.sprite_zero = true;
+      list.sprites[list.count++] = static_cast<uint8_t>(n);
+    }
+  }
+  // With eight sprites found, the hardware goes on to look for a ninth but
+  // increments the byte offset along with the sprite index, so it compares
+  // tile numbers, attributes and X positions as Y coordinates.
+  for (int line = 0; line < kHeight; ++line) {
+    SpriteList& list = sprite_lists_[line];
+    if (list.count < kMaxSpritesPerLine) continue;
+    for (int n = list.sprites[kMaxSpritesPerLine - 1] + 1, m = 0; n < 64;
+         ++n, m = (m + 1) & 3) {
+      const int row = line - oam_[n * 4 + m];
+      if (row >= 0 && row < height) {
+        list.overflow = true;
+        break;
+      }
+    }
+  }
+  sprite_lists_height_ = height;
+}
+
+void Ppu::FetchSprites() {
+  const int height = control_ & kTallSprites ? 16 : 8;
+  for (int i = 0; i < next_sprite_count_; ++i) {
+    const uint8_t* const entry = &oam_[next_sprites_[i] * 4];
+    const uint8_t attributes = entry[2];
+    int row = scanline_ - entry[0];
+    if (attributes & kFlipVertical) row = height - 1 - row;
+    uint16_t address;
+    if (height == 16) {
+      address = static_cast<uint16_t>((entry[1] & 1) << 12 |
+                                      (entry[1] & 0xFE) << 4 |
+                                      (row & 8) << 1 | (row & 7));
+    } else {
+      address = static_cast<uint16_t>(
+          (control_ & kSpriteTable ? 0x1000 : 0) | entry[1] << 4 | row);
+    }
+    const ChrMemory::Row& pattern = PatternRow(address);
+    if (attributes & kFlipHorizontal) {
+      sprites_[i] = {entry[3], attributes, pattern.flipped,
+                     pattern.opaque_flipped};
+    } else {
+      sprites_[i] = {entry[3], attributes, pattern.pixels, pattern.opaque};
+    }
+  }
+  sprite_count_ = next_sprite_count_;
+  sprite_zero_on_line_ = sprite_zero_next_;
+}
+
+void Ppu::IncrementX() {
+  if ((v_ & 0x001F) == 31) {
+    v_ = static_cast<uint16_t>((v_ & ~0x001F) ^ 0x0400);
+  } else {
+    ++v_;
+  }
+}
+
+void Ppu::IncrementY() {
+  if ((v_ & 0x7000) != 0x7000) {
+    v_ += 0x1000;
+    return;
+  }
+  v_ &= ~0x7000;
+  int coarse_y = v_ >> 5 & 31;
+  if (coarse_y == 29) {
+    coarse_y = 0;
+    v_ ^= 0x0800;
+  } else if (coarse_y == 31) {
+    coarse_y = 0;
+  } else {
+    ++coarse_y;
+  }
+  v_ = static_cast<uint16_t>((v_ & ~0x03E0) | coarse_y << 5);
+}
+
+uint16_t Ppu::AttributeAddress() const {
+  return static_cast<uint16_t>(0x23C0 | (v_ & 0x0C00) | (v_ >> 4 & 0x38) |
+                               (v_ >> 2 & 0x07));
+}
+
+uint8_t Ppu::AttributeBits(uint8_t attribute) const {
+  return attribute >> ((v_ >> 4 & 4) | (v_ & 2)) & 3;
+}
+
+uint16_t Ppu::BackgroundPatternAddress() const {
+  return static_cast<uint16_t>((control_ & kBackgroundTable ? 0x1000 : 0) |
+                               next_tile_ << 4 | v_ >> 12);
+}
+
+const ChrMemory::Row& Ppu::PatternRow(uint16_t address) {
+  if (!chr_) return kBlankRow;
+  return chr_->DecodedRow((chr_offset_ + address) / ChrMemory::kTileSize,
+                          address & 7);
+}
+
+uint8_t Ppu::ReadMemory(uint16_t address) const {
+  address &= 0x3FFF;
+  if (address < 0x2000) return chr_ ? chr_->Read(chr_offset_ + address) : 0;
+  if (address < 0x3F00) return nametables_[NametableIndex(address)];
+  return palette_[PaletteIndex(address)];
+}
+
+void Ppu::WriteMemory(uint16_t address, uint8_t data) {
+  address &= 0x3FFF;
+  if (address < 0x2000) {
+    if (chr_) chr_->Write(chr_offset_ + address, data);
+  } else if (address < 0x3F00) {
+    nametables_[NametableIndex(address)] = data;
+  } else {
+    palette_[PaletteIndex(address)] = data & 0x3F;
+  }
+}
+
+uint16_t Ppu::NametableIndex(uint16_t address) const {
+  if (mirroring_ == Mirroring::kVertical) return address & 0x07FF;
+  return static_cast<uint16_t>((address >> 1 & 0x0400) | (address & 0x03FF));
+}
+
+uint8_t Ppu::PaletteIndex(uint16_t address) {
+  // The backdrop entries of the sprite palettes mirror those of the
+  // background palettes.
+  uint8_t index = address & 0x1F;
+  if ((index & 0x13) == 0x10) index &= 0x0F;
+  return index;
+}
+
+}  // namespace purenes
@@ -0,0 +1,387 @@
+#include "recompiler.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include "opcodes.h"
+
+namespace purenes {
+
+namespace {
+
+struct OpcodeInfo {
+  const char* name;
+  uint8_t length;
+};
+
+#define PURENES_OPCODE_INFO(opcode, operation, mode, cycles, penalty) \
+  {#operation, 1 + kOperandBytes##mode},
+constexpr OpcodeInfo kOpcodeInfo[256] = {PURENES_OPCODES(PURENES_OPCODE_INFO)};
+#undef PURENES_OPCODE_INFO
+
+// Opcodes with special meaning to control flow analysis.
+constexpr uint8_t kBrk = 0x00;
+constexpr uint8_t kJsr = 0x20;
+constexpr uint8_t kRti = 0x40;
+constexpr uint8_t kPha = 0x48;
+constexpr uint8_t kJmp = 0x4C;
+constexpr uint8_t kRts = 0x60;
+constexpr uint8_t kPla = 0x68;
+constexpr uint8_t kJmpIndirect = 0x6C;
+constexpr uint8_t kStaZeroPage = 0x85;
+constexpr uint8_t kStaAbsolute = 0x8D;
+constexpr uint8_t kLdaAbsoluteY = 0xB9;
+constexpr uint8_t kLdaAbsoluteX = 0xBD;
+
+// Upper bound of the entries read from a jump table whose length cannot be
+// inferred from the layout of its low and high byte tables.
+constexpr int kMaxJumpTableEntries = 256;
+
+bool IsBranch(uint8_t opcode) { return (opcode & 0x1F) == 0x10; }
+
+bool IsJam(uint8_t opcode) {
+  return std::strcmp(kOpcodeInfo[opcode].name, "Jam") == 0;
+}
+
+// Whether execution never continues with the next instruction.
+bool EndsFlow(uint8_t opcode) {
+  return opcode == kJmp || opcode == kJmpIndirect || opcode == kRts ||
+         opcode == kRti || opcode == kBrk || IsJam(opcode);
+}
+
+std::string Hex(unsigned value, int digits) {
+  char text[16];
+  std::snprintf(text, sizeof(text), "0x%0*X", digits, value);
+  return text;
+}
+
+std::string Label(uint16_t address) {
+  char text[16];
+  std::snprintf(text, sizeof(text), "at_%04X", address);
+  return text;
+}
+
+std::string Mnemonic(uint8_t opcode) {
+  std::string name = kOpcodeInfo[opcode].name;
+  for (char& c : name) c = static_cast<char>(std::toupper(c));
+  return name;
+}
+
+}  // namespace
+
+void Recompiler::AddRegion(uint16_t bank, uint16_t base,
+                           std::vector<uint8_t> bytes) {
+  banks_[bank].regions.push_back({base, std::move(bytes)});
+}
+
+void Recompiler::AddEntryPoint(uint16_t bank, uint16_t address) {
+  banks_[bank].pending.push_back(address);
+}
+
+void Recompiler::AddVectors(uint16_t bank) {
+  for (uint16_t vector = 0xFFFA; vector != 0; vector += 2) {
+    uint8_t lo, hi;
+    if (ReadByte(banks_[bank], vector, &lo) &&
+        ReadByte(banks_[bank], vector + 1, &hi)) {
+      AddEntryPoint(bank, static_cast<uint16_t>(lo | hi << 8));
+    }
+  }
+}
+
+void Recompiler::Analyze() {
+  bool pending = true;
+  while (pending) {
+    for (auto& entry : banks_) {
+      Bank& bank = entry.second;
+      while (!bank.pending.empty()) {
+        const uint16_t address = bank.pending.back();
+        bank.pending.pop_back();
+        uint8_t opcode;
+        if (ReadByte(bank, address, &opcode)) {
+          Trace(&bank, address);
+          continue;
+        }
+        // Control leaves the bank for whichever one is mapped there.
+        for (auto& other : banks_) {
+          if (ReadByte(other.second, address, &opcode) &&
+              !other.second.instructions.count(address)) {
+            other.second.pending.push_back(address);
+          }
+        }
+      }
+    }
+    // Tracing one bank can queue targets in banks already done.
+    pending = false;
+    for (const auto& entry : banks_) {
+      if (!entry.second.pending.empty()) pending = true;
+    }
+  }
+}
+
+std::vector<uint16_t> Recompiler::Instructions(uint16_t bank) const {
+  std::vector<uint16_t> addresses;
+  const auto found = banks_.find(bank);
+  if (found == banks_.end()) return addresses;
+  for (const auto& instruction : found->second.instructions) {
+    addresses.push_back(instruction.first);
+  }
+  return addresses;
+}
+
+bool Recompiler::ReadByte(const Bank& bank, uint16_t address,
+                          uint8_t* value) {
+  const Region* const region = RegionOf(bank, address);
+  if (!region) return false;
+  *value = region->bytes[static_cast<uint16_t>(address - region->base)];
+  return true;
+}
+
+const Recompiler::Region* Recompiler::RegionOf(const Bank& bank,
+                                               uint16_t address) {
+  for (const Region& region : bank.regions) {
+    const unsigned offset = static_cast<uint16_t>(address - region.base);
+    if (offset < region.bytes.size()) return &region;
+  }
+  return nullptr;
+}
+
+bool Recompiler::IsRom(uint16_t address) const {
+  uint8_t value;
+  for (const auto& bank : banks_) {
+    if (ReadByte(bank.second, address, &value)) return true;
+  }
+  return false;
+}
+
+void Recompiler::Trace(Bank* bank, uint16_t address) {
+  // Jump tables are recognized by where their entries go: every value
+  // loaded with LDA abs,X or LDA abs,Y is tagged with the table address,
+  // and the tag follows the value into memory or onto the stack.
+  std::map<uint16_t, uint16_t> stored;
+  std::vector<int> pushed;
+  int table = -1;
+
+  for (;;) {
+    if (bank->instructions.count(address)) return;
+    uint8_t opcode;
+    if (!ReadByte(*bank, address, &opcode)) return;
+    Instruction instruction = {opcode, 0, kOpcodeInfo[opcode].length};
+    for (int i = 1; i < instruction.length; ++i) {
+      uint8_t byte;
+      if (!ReadByte(*bank, static_cast<uint16_t>(address + i), &byte)) return;
+      instruction.operand |= static_cast<uint16_t>(byte << (8 * (i - 1)));
+    }
+    bank->instructions[address] = instruction;
+
+    const uint16_t operand = instruction.operand;
+    const uint16_t next = static_cast<uint16_t>(address + instruction.length);
+    int loaded = -1;
+    switch (opcode) {
+      case kLdaAbsoluteX:
+      case kLdaAbsoluteY:
+        loaded = operand;
+        break;
+      case kStaZeroPage:
+      case kStaAbsolute:
+        if (table >= 0) {
+          stored[operand] = static_cast<uint16_t>(table);
+        } else {
+          stored.erase(operand);
+        }
+        break;
+      case kPha:
+        pushed.push_back(table);
+        break;
+      case kPla:
+        if (!pushed.empty()) pushed.pop_back();
+        break;
+      case kJsr:
+        AddTarget(bank, address, operand);
+        break;
+      case kJmp:
+        AddTarget(bank, address, operand);
+        return;
+      case kJmpIndirect: {
+        const auto low = stored.find(operand);
+        const auto high = stored.find(static_cast<uint16_t>(operand + 1));
+        if (low != stored.end() && high != stored.end()) {
+          AddJumpTable(bank, address, low->second, high->second, 0);
+        }
+        return;
+      }
+      case kRts: {
+        // RTS continues after the address on the stack, so a pushed table
+        // entry points one byte before its target.
+        const size_t depth = pushed.size();
+        if (depth >= 2 && pushed[depth - 1] >= 0 && pushed[depth - 2] >= 0) {
+          AddJumpTable(bank, address,
+                       static_cast<uint16_t>(pushed[depth - 1]),
+                       static_cast<uint16_t>(pushed[depth - 2]), 1);
+        }
+        return;
+      }
+      default:
+        if (IsBranch(opcode)) {
+          bank->pending.push_back(
+              static_cast<uint16_t>(next + static_cast<int8_t>(operand)));
+        } else if (EndsFlow(opcode)) {
+          return;
+        }
+        break;
+    }
+    table = loaded;
+    address = next;
+  }
+}
+
+void Recompiler::AddTarget(Bank* bank, uint16_t from, uint16_t target) {
+  bank->pending.push_back(target);
+  const Region* const region = RegionOf(*bank, target);
+  if (!region || region == RegionOf(*bank, from)) return;
+  // The target is in another window of the address space, where a bank
+  // switch may have mapped any bank with ROM there instead of this one.
+  for (auto& entry : banks_) {
+    Bank& other = entry.second;
+    if (&other != bank && RegionOf(other, target) &&
+        !other.instructions.count(target)) {
+      other.pending.push_back(target);
+    }
+  }
+}
+
+void Recompiler::AddJumpTable(Bank* bank, uint16_t from, uint16_t low,
+                              uint16_t high, int offset) {
+  // Entries are either split into a low and a high byte table, which are
+  // usually adjacent so that the distance between them is the length, or
+  // interleaved as 16-bit words.
+  const int stride = high == low + 1 ? 2 : 1;
+  int count = kMaxJumpTableEntries / stride;
+  const int distance = std::abs(high - low);
+  if (stride == 1 && distance > 0 && distance < count) count = distance;
+
+  for (int i = 0; i < count; ++i) {
+    uint8_t lo, hi;
+    if (!ReadByte(*bank, static_cast<uint16_t>(low + i * stride), &lo) ||
+        !ReadByte(*bank, static_cast<uint16_t>(high + i * stride), &hi)) {
+      return;
+    }
+    const uint16_t target = static_cast<uint16_t>((lo | hi << 8) + offset);
+    // The first entry that does not point into ROM marks the end.
+    if (!IsRom(target)) return;
+    AddTarget(bank, from, target);
+  }
+}
+
+void Recompiler::EmitSource(const std::string& symbol,
+                            std::ostream& out) const {
+  out << "// Generated by purenes_recompile. Do not edit.\n\n"
+      << "#include \"cpu.h\"\n"
+      << "#include \"cpu_instructions.h\"\n\n"
+      << "namespace {\n\n"
+      << "using purenes::Cpu;\n";
+
+  size_t count = 0;
+  for (const auto& bank : banks_) {
+    if (bank.second.instructions.empty()) continue;
+    out << "\n";
+    EmitBank(bank.first, bank.second, out);
+    count += bank.second.instructions.size();
+  }
+
+  if (count > 0) {
+    out << "\nconst Cpu::CompiledBlock kBlocks[] = {\n";
+    for (const auto& bank : banks_) {
+      for (const auto& instruction : bank.second.instructions) {
+        out << "    {" << Hex(bank.first, 4) << ", "
+            << Hex(instruction.first, 4) << ", &RunBank"
+            << Hex(bank.first, 4).substr(2) << "},\n";
+      }
+    }
+    out << "};\n";
+  }
+
+  out << "\n}  // namespace\n\n"
+      << "extern const Cpu::CompiledCode " << symbol << ";\n"
+      << "const Cpu::CompiledCode " << symbol << " = {"
+      << (count > 0 ? "kBlocks" : "nullptr") << ", " << count << "};\n";
+}
+
+void Recompiler::EmitHeader(const std::string& symbol, std::ostream& out) {
+  std::string guard = "PURENES_RECOMPILED_" + symbol + "_H";
+  for (char& c : guard) c = static_cast<char>(std::toupper(c));
+  out << "// Generated by purenes_recompile. Do not edit.\n\n"
+      << "#ifndef " << guard << "\n"
+      << "#define " << guard << "\n\n"
+      << "#include \"cpu.h\"\n\n"
+      << "extern const purenes::Cpu::CompiledCode " << symbol << ";\n\n"
+      << "#endif //" << guard << "\n";
+}
+
+void Recompiler::EmitBank(uint16_t id, const Bank& bank,
+                          std::ostream& out) const {
+  const auto& instructions = bank.instructions;
+  const auto compiled = [&](uint16_t address) {
+    return instructions.count(address) != 0;
+  };
+
+  // Instructions call their entry points directly, which are inline, so
+  // that the compiler sees through the whole block.
+  out << "void RunBank" << Hex(id, 4).substr(2) << "(Cpu* cpu) {\n"
+      << "  switch (cpu->pc()) {\n";
+  for (const auto& instruction : instructions) {
+    out << "    case " << Hex(instruction.first, 4) << ": goto "
+        << Label(instruction.first) << ";\n";
+  }
+  out << "    default: return;\n"
+      << "  }\n";
+
+  for (auto it = instructions.begin(); it != instructions.end(); ++it) {
+    const uint16_t address = it->first;
+    const Instruction& instruction = it->second;
+    const uint8_t opcode = instruction.opcode;
+    const uint32_t argument =
+        instruction.operand | static_cast<uint32_t>(instruction.length) << 16;
+    const uint16_t next = static_cast<uint16_t>(address + instruction.length);
+
+    out << Label(address) << ":  // " << Mnemonic(opcode) << "\n"
+        << "  if (Cpu::ExecuteEntry<" << Hex(opcode, 2) << ">(cpu, "
+        << Hex(argument, 5) << ")) return;\n";
+
+    if (opcode == kJmp || opcode == kJsr) {
+      if (compiled(instruction.operand)) {
+        out << "  goto " << Label(instruction.operand) << ";\n";
+      } else {
+        out << "  return;\n";
+      }
+      continue;
+    }
+    if (EndsFlow(opcode)) {
+      out << "  return;\n";
+      continue;
+    }
+    if (IsBranch(opcode)) {
+      const int8_t offset = static_cast<int8_t>(instruction.operand);
+      const uint16_t target = static_cast<uint16_t>(next + offset);
+      if (compiled(target)) {
+        out << "  if (cpu->pc() == " << Hex(target, 4) << ") goto "
+            << Label(target) << ";\n";
+      } else {
+        out << "  if (cpu->pc() != " << Hex(next, 4) << ") return;\n";
+      }
+    }
+    const auto following = std::next(it);
+    if (following != instructions.end() && following->first == next) continue;
+    if (compiled(next)) {
+      out << "  goto " << Label(next) << ";\n";
+    } else {
+      out << "  return;\n";
+    }
+  }
+  out << "}\n";
+}
+
+}  // namespace purenes
@@ -0,0 +1,101 @@
+#ifndef PURENES_RECOMPILER_H
+#define PURENES_RECOMPILER_H
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace purenes {
+
+// Statically disassembles the code of a ROM and translates it to C++ that
+// calls the inline Cpu::ExecuteEntry() of each instruction, with the control
+// flow between instructions resolved at compile time, so that the compiler
+// optimizes each bank as a whole.
+//
+// Analysis starts at the given entry points and follows fall-through,
+// branch, JMP and JSR targets as well as jump tables dispatched through
+// JMP (indirect) or the PHA/PHA/RTS idiom. A target outside the ROM of its
+// bank is code of every bank with ROM there, since any of them may be
+// mapped when control gets there. So is a jump target in another region of
+// the same bank, like the switchable window that UxROM's fixed bank calls
+// into. Correctness does not depend on analysis
+// finding everything: the generated code for an address is the instruction
+// that the ROM holds there, so bytes wrongly taken for code are simply
+// never reached, and code that analysis misses is interpreted.
+class Recompiler {
+ public:
+  // Adds ROM that is visible at `base` while code bank `bank` is mapped
+  // there. Regions of one bank must not overlap.
+  void AddRegion(uint16_t bank, uint16_t base, std::vector<uint8_t> bytes);
+
+  // Marks `address` in `bank` as code. If outside the bank's regions, it is
+  // a target in other banks as described above.
+  void AddEntryPoint(uint16_t bank, uint16_t address);
+
+  // Adds the NMI, reset and IRQ vectors of `bank` as entry points, if the
+  // bank contains them.
+  void AddVectors(uint16_t bank);
+
+  // Follows control flow from every entry point added so far.
+  void Analyze();
+
+  // Start addresses of the instructions found in `bank`, in ascending
+  // order.
+  std::vector<uint16_t> Instructions(uint16_t bank) const;
+
+  // Writes a source file defining `const purenes::Cpu::CompiledCode symbol`
+  // for everything found by Analyze().
+  void EmitSource(const std::string& symbol, std::ostream& out) const;
+
+  // Writes a header declaring what EmitSource() defines.
+  static void EmitHeader(const std::string& symbol, std::ostream& out);
+
+ private:
+  struct Region {
+    uint16_t base;
+    std::vector<uint8_t> bytes;
+  };
+
+  // An instruction found by analysis.
+  struct Instruction {
+    uint8_t opcode;
+    uint16_t operand;
+    uint8_t length;
+  };
+
+  struct Bank {
+    std::vector<Region> regions;
+    std::map<uint16_t, Instruction> instructions;
+    std::vector<uint16_t> pending;
+  };
+
+  // Returns the region of `bank` holding `address`, or null.
+  static const Region* RegionOf(const Bank& bank, uint16_t address);
+  // Returns whether the byte at `address` is ROM of `bank`, storing it.
+  static bool ReadByte(const Bank& bank, uint16_t address, uint8_t* value);
+  // Whether any bank has ROM at `address`.
+  bool IsRom(uint16_t address) const;
+
+  // Decodes from `address` along the fall-through path until control
+  // leaves it, queueing every other target found on the way.
+  void Trace(Bank* bank, uint16_t address);
+
+  // Queues `target` of a jump or call at `from` in `bank`, and in the other
+  // banks that may be mapped at `target` if it is in a different region.
+  void AddTarget(Bank* bank, uint16_t from, uint16_t target);
+  // Queues the targets of the jump table whose low and high bytes start at
+  // `low` and `high`, each target adjusted by `offset`, for the jump at
+  // `from`.
+  void AddJumpTable(Bank* bank, uint16_t from, uint16_t low, uint16_t high,
+                    int offset);
+
+  void EmitBank(uint16_t id, const Bank& bank, std::ostream& out) const;
+
+  std::map<uint16_t, Bank> banks_;
+};
+
+}  // namespace purenes
+
+#endif //PURENES_RECOMPILER_H
@@ -0,0 +1,197 @@
+#include "scanline_kernels.h"
+
+#ifdef PURENES_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace purenes {
+
+namespace {
+
+void CombineTilesScalar(const uint8_t* const* rows, const uint8_t* attributes,
+                        int count, uint8_t* out) {
+  for (int i = 0; i < count; ++i) {
+    for (int x = 0; x < 8; ++x) {
+      const uint8_t pixel = rows[i][x];
+      out[i * 8 + x] = static_cast<uint8_t>(pixel ? attributes[i] | pixel : 0);
+    }
+  }
+}
+
+bool ComposeScalar(const uint8_t* background, const uint8_t* sprites,
+                   const uint8_t* palette, uint8_t color_mask,
+                   uint16_t emphasis, uint16_t* out) {
+  bool sprite_zero_hit = false;
+  for (int x = 0; x < Ppu::kWidth; ++x) {
+    const uint8_t back = background[x];
+    const uint8_t sprite = sprites[x];
+    if ((sprite & kSpriteZeroPixel) && back) sprite_zero_hit = true;
+    uint8_t index = back;
+    if (sprite && ((sprite & kFrontPixel) || !back)) index = sprite & 0x1F;
+    out[x] = static_cast<uint16_t>((palette[index] & color_mask) | emphasis);
+  }
+  return sprite_zero_hit;
+}
+
+#ifdef PURENES_SIMD_X86
+
+__attribute__((target("ssse3"))) void CombineTilesSsse3(
+    const uint8_t* const* rows, const uint8_t* attributes, int count,
+    uint8_t* out) {
+  const __m128i zero = _mm_setzero_si128();
+  for (int i = 0; i < count; i += 2) {
+    const __m128i pixels = _mm_unpacklo_epi64(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[i])),
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[i + 1])));
+    const __m128i attribute =
+        _mm_unpacklo_epi64(_mm_set1_epi8(static_cast<char>(attributes[i])),
+                           _mm_set1_epi8(static_cast<char>(attributes[i + 1])));
+    const __m128i opaque_attribute =
+        _mm_andnot_si128(_mm_cmpeq_epi8(pixels, zero), attribute);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 8),
+                     _mm_or_si128(pixels, opaque_attribute));
+  }
+}
+
+// Palette entries are looked up with pshufb, which indexes a 16-byte table
+// with the low 4 bits of each byte, from one table per half of the palette.
+__attribute__((target("ssse3"))) bool ComposeSsse3(
+    const uint8_t* background, const uint8_t* sprites, const uint8_t* palette,
+    uint8_t color_mask, uint16_t emphasis, uint16_t* out) {
+  const __m128i palette_low =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette));
+  const __m128i palette_high =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette + 16));
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i index_bits = _mm_set1_epi8(0x1F);
+  const __m128i high_half = _mm_set1_epi8(0x10);
+  const __m128i sprite_zero = _mm_set1_epi8(kSpriteZeroPixel);
+  const __m128i mask = _mm_set1_epi8(static_cast<char>(color_mask));
+  const __m128i emphasis_low = _mm_set1_epi8(static_cast<char>(emphasis));
+  const __m128i emphasis_high =
+      _mm_set1_epi8(static_cast<char>(emphasis >> 8));
+
+  __m128i hits = zero;
+  for (int x = 0; x < Ppu::kWidth; x += 16) {
+    const __m128i back =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(background + x));
+    const __m128i sprite =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(sprites + x));
+    const __m128i back_clear = _mm_cmpeq_epi8(back, zero);
+    hits = _mm_or_si128(
+        hits, _mm_andnot_si128(back_clear, _mm_and_si128(sprite, sprite_zero)));
+    // kFrontPixel is the sign bit.
+    const __m128i front = _mm_cmplt_epi8(sprite, zero);
+    const __m128i use_sprite = _mm_andnot_si128(
+        _mm_cmpeq_epi8(sprite, zero), _mm_or_si128(front, back_clear));
+    const __m128i index = _mm_or_si128(
+        _mm_and_si128(use_sprite, _mm_and_si128(sprite, index_bits)),
+        _mm_andnot_si128(use_sprite, back));
+
+    const __m128i in_high =
+        _mm_cmpeq_epi8(_mm_and_si128(index, high_half), high_half);
+    const __m128i color = _mm_and_si128(
+        mask,
+        _mm_or_si128(
+            _mm_and_si128(in_high, _mm_shuffle_epi8(palette_high, index)),
+            _mm_andnot_si128(in_high, _mm_shuffle_epi8(palette_low, index))));
+    const __m128i low = _mm_or_si128(color, emphasis_low);
+    __m128i* const pixels = reinterpret_cast<__m128i*>(out + x);
+    _mm_storeu_si128(pixels, _mm_unpacklo_epi8(low, emphasis_high));
+    _mm_storeu_si128(pixels + 1, _mm_unpackhi_epi8(low, emphasis_high));
+  }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(hits, zero)) != 0xFFFF;
+}
+
+// The same as ComposeSsse3() for 32 pixels at a time. The 256-bit shuffles
+// and unpacks work on each 128-bit half separately, so the palette is
+// repeated in both halves, and the widened pixels come out as pixels 0-7
+// and 16-23, then 8-15 and 24-31, to be put back in order.
+__attribute__((target("avx2"))) bool ComposeAvx2(
+    const uint8_t* background, const uint8_t* sprites, const uint8_t* palette,
+    uint8_t color_mask, uint16_t emphasis, uint16_t* out) {
+  const __m256i palette_low = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette)));
+  const __m256i palette_high = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette + 16)));
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i index_bits = _mm256_set1_epi8(0x1F);
+  const __m256i high_half = _mm256_set1_epi8(0x10);
+  const __m256i sprite_zero = _mm256_set1_epi8(kSpriteZeroPixel);
+  const __m256i mask = _mm256_set1_epi8(static_cast<char>(color_mask));
+  const __m256i emphasis_low = _mm256_set1_epi8(static_cast<char>(emphasis));
+  const __m256i emphasis_high =
+      _mm256_set1_epi8(static_cast<char>(emphasis >> 8));
+
+  __m256i hits = zero;
+  for (int x = 0; x < Ppu::kWidth; x += 32) {
+    const __m256i back =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(background + x));
+    const __m256i sprite =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sprites + x));
+    const __m256i back_clear = _mm256_cmpeq_epi8(back, zero);
+    hits = _mm256_or_si256(
+        hits,
+        _mm256_andnot_si256(back_clear, _mm256_and_si256(sprite, sprite_zero)));
+    const __m256i use_sprite = _mm256_andnot_si256(
+        _mm256_cmpeq_epi8(sprite, zero),
+        _mm256_or_si256(_mm256_cmpgt_epi8(zero, sprite), back_clear));
+    const __m256i index = _mm256_blendv_epi8(
+        back, _mm256_and_si256(sprite, index_bits), use_sprite);
+
+    const __m256i in_high =
+        _mm256_cmpeq_epi8(_mm256_and_si256(index, high_half), high_half);
+    const __m256i color = _mm256_and_si256(
+        mask, _mm256_blendv_epi8(_mm256_shuffle_epi8(palette_low, index),
+                                 _mm256_shuffle_epi8(palette_high, index),
+                                 in_high));
+    const __m256i low = _mm256_or_si256(color, emphasis_low);
+    const __m256i first = _mm256_unpacklo_epi8(low, emphasis_high);
+    const __m256i second = _mm256_unpackhi_epi8(low, emphasis_high);
+    __m256i* const pixels = reinterpret_cast<__m256i*>(out + x);
+    _mm256_storeu_si256(pixels,
+                        _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256(pixels + 1,
+                        _mm256_permute2x128_si256(first, second, 0x31));
+  }
+  return !_mm256_testz_si256(hits, hits);
+}
+
+#endif  // PURENES_SIMD_X86
+
+const ScanlineKernels kScalarKernels = {CombineTilesScalar, ComposeScalar};
+#ifdef PURENES_SIMD_X86
+const ScanlineKernels kSsse3Kernels = {CombineTilesSsse3, ComposeSsse3};
+// Tiles come from scattered rows, so combining them 4 at a time would not
+// gain anything over 2.
+const ScanlineKernels kAvx2Kernels = {CombineTilesSsse3, ComposeAvx2};
+#endif
+
+}  // namespace
+
+const ScanlineKernels& ScanlineKernelsFor(Ppu::Simd simd) {
+#ifdef PURENES_SIMD_X86
+  switch (simd) {
+    case Ppu::Simd::kNone:
+      break;
+    case Ppu::Simd::kSsse3:
+      return kSsse3Kernels;
+    case Ppu::Simd::kAvx2:
+      return kAvx2Kernels;
+  }
+#else
+  static_cast<void>(simd);
+#endif
+  return kScalarKernels;
+}
+
+Ppu::Simd DetectSimd() {
+#ifdef PURENES_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return Ppu::Simd::kAvx2;
+  if (__builtin_cpu_supports("ssse3")) return Ppu::Simd::kSsse3;
+#endif
+  return Ppu::Simd::kNone;
+}
+
+}  // namespace purenes
@@ -0,0 +1,50 @@
+#ifndef PURENES_SCANLINE_KERNELS_H
+#define PURENES_SCANLINE_KERNELS_H
+
+#include <cstdint>
+
+#include "ppu.h"
+
+// Vector kernels are built for x86 hosts with GCC-compatible compilers,
+// which can target instruction sets per function. Elsewhere only the
+// scalar kernels exist.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define PURENES_SIMD_X86 1
+#endif
+
+namespace purenes {
+
+// Flags of the sprite pixels that compose() takes, besides the palette
+// index in the low 5 bits: whether the pixel is sprite 0's, and whether it
+// is in front of the background.
+constexpr uint8_t kSpriteZeroPixel = 0x40;
+constexpr uint8_t kFrontPixel = 0x80;
+
+// The per-pixel loops of Ppu::RenderScanline(), in one version per
+// Ppu::Simd. All versions give the same results.
+struct ScanlineKernels {
+  // Writes the pixels of `count` tiles, an even number, to `out`, 8 per
+  // tile: the decoded pattern row `rows[i]` with the palette bits
+  // `attributes[i]` (0, 4, 8 or 12) added to each pixel that is not
+  // transparent.
+  void (*combine_tiles)(const uint8_t* const* rows, const uint8_t* attributes,
+                        int count, uint8_t* out);
+  // Resolves the priority of Ppu::kWidth background pixels, palette indices
+  // or 0, against sprite pixels, 0 or palette indices with flags, looks
+  // their colors up through `palette`, masked by `color_mask`, and writes
+  // them to `out` with `emphasis` added, as Ppu::frame() holds them.
+  // Returns whether a sprite 0 pixel covers a background pixel.
+  bool (*compose)(const uint8_t* background, const uint8_t* sprites,
+                  const uint8_t* palette, uint8_t color_mask,
+                  uint16_t emphasis, uint16_t* out);
+};
+
+// The kernels for `simd`, or the scalar ones if they are not built.
+const ScanlineKernels& ScanlineKernelsFor(Ppu::Simd simd);
+// The best Ppu::Simd that the host CPU supports, per CPUID.
+Ppu::Simd DetectSimd();
+
+}  // namespace purenes
+
+#endif //PURENES_SCANLINE_KERNELS_H
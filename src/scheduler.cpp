@@ -0,0 +1,52 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "cpu.h"
+
+namespace purenes {
+
+constexpr uint64_t Scheduler::kNever;
+
+Scheduler::Scheduler() { cycles_.fill(kNever); }
+
+Scheduler::~Scheduler() {
+  if (cpu_) cpu_->scheduler_ = nullptr;
+}
+
+void Scheduler::SetHandler(Slot slot, Handler handler) {
+  handlers_[slot] = std::move(handler);
+}
+
+void Scheduler::Schedule(Slot slot, uint64_t cycle) {
+  cycles_[slot] = cycle;
+  UpdateNext();
+  if (cpu_) cpu_->Preempt(cycle);
+}
+
+void Scheduler::Cancel(Slot slot) {
+  cycles_[slot] = kNever;
+  UpdateNext();
+}
+
+void Scheduler::Reset() {
+  cycles_.fill(kNever);
+  UpdateNext();
+}
+
+void Scheduler::RunDue(uint64_t cycle) {
+  while (next_ <= cycle) {
+    const auto slot = static_cast<Slot>(
+        std::min_element(cycles_.begin(), cycles_.end()) - cycles_.begin());
+    const uint64_t due = cycles_[slot];
+    Cancel(slot);
+    if (handlers_[slot]) handlers_[slot](due);
+  }
+}
+
+void Scheduler::UpdateNext() {
+  next_ = *std::min_element(cycles_.begin(), cycles_.end());
+}
+
+}  // namespace purenes
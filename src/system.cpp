@@ -0,0 +1,103 @@
+#include "system.h"
+
+#include <utility>
+
+namespace purenes {
+
+namespace {
+
+// CPU cycles of an OAM DMA, plus one if it starts on an odd cycle.
+constexpr int kOamDmaCycles = 513;
+
+}  // namespace
+
+System::System(std::unique_ptr<Cartridge> cartridge)
+    : cpu_(bus_),
+      ppu_(cpu_, scheduler_, cartridge->region()),
+      apu_(cpu_, scheduler_, bus_, cartridge->region()),
+      io_(*this),
+      cartridge_(std::move(cartridge)) {
+  cpu_.SetScheduler(&scheduler_);
+  cpu_.SetIdleLoopSkipping(true);
+  bus_.MapDevice(0x2000, 0x2000, &ppu_, 0x2007);
+  bus_.MapDevice(0x4000, Bus::kPageSize, &io_);
+  // Code fetched from registers, or from the open bus that the expansion
+  // area returns, can change without a write.
+  for (int page = 0x20; page < 0x60; ++page) {
+    cpu_.SetCodeBank(static_cast<uint8_t>(page), Cpu::kUncachedBank);
+  }
+  cartridge_->Connect(bus_, cpu_, ppu_);
+  cpu_.Reset();
+}
+
+void System::Reset() {
+  // Pending events are of the timelines that reset restarts; each device
+  // schedules its own again.
+  scheduler_.Reset();
+  ppu_.Reset();
+  apu_.Reset();
+  cpu_.Reset();
+}
+
+void System::SetAccuracy(Accuracy accuracy) {
+  accuracy_ = accuracy;
+  ppu_.SetAccuracy(accuracy);
+  switch (accuracy) {
+    case Accuracy::kInstruction:
+      run_frame_ = &System::RunFrameAt<Accuracy::kInstruction>;
+      break;
+    case Accuracy::kScanline:
+      run_frame_ = &System::RunFrameAt<Accuracy::kScanline>;
+      break;
+  }
+}
+
+template <Accuracy kAccuracy>
+void System::RunFrameAt() {
+  const uint64_t frame = ppu_.frame_count();
+  while (ppu_.frame_count() == frame) cpu_.RunUntil(scheduler_.next());
+}
+
+void System::OamDma(uint8_t page) {
+  for (int i = 0; i < 256; ++i) {
+    ppu_.WriteOam(bus_.Read(static_cast<uint16_t>(page << 8 | i)));
+  }
+  cpu_.Stall(kOamDmaCycles + (cpu_.cycles() & 1));
+}
+
+uint8_t System::Io::Read(uint16_t address) {
+  switch (address) {
+    case 0x4015:
+      return system_.apu_.Read(address);
+    case 0x4016:
+    case 0x4017: {
+      const int port = address - 0x4016;
+      if (system_.strobe_) system_.shifters_[port] = system_.buttons_[port];
+      const uint8_t bit = system_.shifters_[port] & 1;
+      // Once all eight buttons are out, the register reads 1s.
+      system_.shifters_[port] =
+          static_cast<uint8_t>(system_.shifters_[port] >> 1 | 0x80);
+      // The upper bits are open bus, the high byte of the address.
+      return static_cast<uint8_t>(0x40 | bit);
+    }
+    default:
+      return static_cast<uint8_t>(address >> 8);
+  }
+}
+
+void System::Io::Write(uint16_t address, uint8_t data) {
+  if (address == 0x4014) {
+    system_.OamDma(data);
+  } else if (address == 0x4016) {
+    system_.strobe_ = data & 1;
+    if (system_.strobe_) system_.shifters_ = system_.buttons_;
+  } else if (address <= 0x4017) {
+    system_.apu_.Write(address, data);
+  }
+}
+
+bool System::Io::HasReadSideEffects(uint16_t address) {
+  return address >= 0x4015 && address <= 0x4017;
+}
+
+}  // namespace purenes
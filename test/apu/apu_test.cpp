@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include "apu.h"
+#include "bus.h"
+#include "cpu.h"
+#include "scheduler.h"
+
+namespace purenes {
+namespace {
+
+class ApuTest : public ::testing::Test {
+ protected:
+  ApuTest() : cpu_(bus_), apu_(cpu_, scheduler_, bus_), program_(0x8000) {
+    cpu_.SetScheduler(&scheduler_);
+    bus_.MapDevice(0x4000, Bus::kPageSize, &apu_);
+    bus_.MapMemory(0x8000, 0x8000, program_.data(), program_.size(), false);
+  }
+
+  // Places `program` at $8000 with an IRQ handler at $9000 that counts
+  // IRQs in $10, stores $4015 to $11 and then clears $4015, and resets the
+  // CPU.
+  void Load(std::initializer_list<uint8_t> program) {
+    uint16_t address = 0;
+    for (uint8_t byte : program) program_[address++] = byte;
+    const uint8_t handler[] = {
+        0xE6, 0x10,        // INC $10
+        0xAD, 0x15, 0x40,  // LDA $4015
+        0x85, 0x11,        // STA $11
+        0xA9, 0x00,        // LDA #$00
+        0x8D, 0x15, 0x40,  // STA $4015
+        0x40,              // RTI
+    };
+    for (int i = 0; i < 13; ++i) program_[0x1000 + i] = handler[i];
+    program_[0x7FFD] = 0x80;  // Reset vector: $8000
+    program_[0x7FFF] = 0x90;  // IRQ vector: $9000
+    cpu_.Reset();
+  }
+
+  Scheduler scheduler_;
+  Bus bus_;
+  Cpu cpu_;
+  Apu apu_;
+  std::vector<uint8_t> program_;
+};
+
+TEST_F(ApuTest, FrameCounterRaisesIrqEverySequence) {
+  // CLI; loop: JMP loop
+  Load({0x58, 0x4C, 0x01, 0x80});
+
+  // The 4-step sequence ends in cycles 29829, 59659 and 89489.
+  cpu_.RunUntil(100000);
+
+  EXPECT_EQ(bus_.ram()[0x10], 3);
+  EXPECT_EQ(bus_.ram()[0x11], 0x40);
+}
+
+TEST_F(ApuTest, InhibitedFrameCounterRaisesNoIrq) {
+  // LDA #$40; STA $4017; CLI; loop: JMP loop
+  Load({0xA9, 0x40, 0x8D, 0x17, 0x40, 0x58, 0x4C, 0x06, 0x80});
+
+  cpu_.RunUntil(100000);
+
+  EXPECT_EQ(bus_.ram()[0x10], 0);
+}
+
+TEST_F(ApuTest, HalfFramesClockLengthCounters) {
+  apu_.Write(0x4015, 0x01);
+  // Length index 3 loads 2.
+  apu_.Write(0x4003, 0x18);
+  EXPECT_EQ(apu_.Read(0x4015) & 0x01, 0x01);
+
+  // The first half frame is the second step.
+  apu_.CatchUp(14914);
+  EXPECT_EQ(apu_.Read(0x4015) & 0x01, 0x01);
+  apu_.CatchUp(29830);
+  EXPECT_EQ(apu_.Read(0x4015) & 0x01, 0x00);
+}
+
+TEST(ApuRegionTest, PalFrameCounterRunsLonger) {
+  Scheduler scheduler;
+  Bus bus;
+  Cpu cpu(bus);
+  Apu apu(cpu, scheduler, bus, Region::kPal);
+
+  // The 4-step sequence ends in cycle 33252 rather than 29829.
+  apu.CatchUp(33252);
+  EXPECT_FALSE(apu.irq());
+  apu.CatchUp(33253);
+  EXPECT_TRUE(apu.irq());
+}
+
+TEST_F(ApuTest, DmcRaisesIrqAtTheEndOfTheSample) {
+  Load({
+      0xA9, 0x40,        // LDA #$40
+      0x8D, 0x17, 0x40,  // STA $4017
+      0xA9, 0x8F,        // LDA #$8F: IRQ enabled, fastest rate
+      0x8D, 0x10, 0x40,  // STA $4010
+      0xA9, 0x00,        // LDA #$00
+      0x8D, 0x12, 0x40,  // STA $4012: sample at $C000
+      0x8D, 0x13, 0x40,  // STA $4013: 1 byte long
+      0xA9, 0x10,        // LDA #$10
+      0x8D, 0x15, 0x40,  // STA $4015
+      0x58,              // CLI
+      0x4C, 0x18, 0x80,  // loop: JMP loop
+  });
+
+  cpu_.RunUntil(1000);
+
+  EXPECT_EQ(bus_.ram()[0x10], 1);
+  EXPECT_EQ(bus_.ram()[0x11], 0x80);
+  EXPECT_EQ(scheduler_.scheduled(Scheduler::kDmc), Scheduler::kNever);
+}
+
+}  // namespace
+}  // namespace purenes
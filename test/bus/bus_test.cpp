@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "bus.h"
+#include "cpu.h"
+
+namespace purenes {
+namespace {
+
+// Records the addresses it sees and returns their low byte.
+class RecordingDevice : public BusDevice {
+ public:
+  uint8_t Read(uint16_t address) override {
+    reads.push_back(address);
+    return address & 0xFF;
+  }
+  void Write(uint16_t address, uint8_t data) override {
+    writes.push_back(address);
+    last_write = data;
+  }
+
+  std::vector<uint16_t> reads;
+  std::vector<uint16_t> writes;
+  uint8_t last_write = 0;
+};
+
+TEST(BusTest, InternalRamIsMirroredFourTimes) {
+  Bus bus;
+  bus.Write(0x0001, 0x11);
+  bus.Write(0x1FFF, 0x22);
+
+  EXPECT_EQ(bus.Read(0x0801), 0x11);
+  EXPECT_EQ(bus.Read(0x1801), 0x11);
+  EXPECT_EQ(bus.ram()[0x07FF], 0x22);
+  EXPECT_EQ(bus.ReadPages()[0x00], bus.ReadPages()[0x18]);
+}
+
+TEST(BusTest, DevicesSeeMirroredAddressesFoldedByTheirMask) {
+  Bus bus;
+  RecordingDevice ppu;
+  bus.MapDevice(0x2000, 0x2000, &ppu, 0x2007);
+
+  EXPECT_EQ(bus.Read(0x3FFA), 0x02);
+  bus.Write(0x2106, 0x33);
+
+  EXPECT_EQ(ppu.reads, std::vector<uint16_t>{0x2002});
+  EXPECT_EQ(ppu.writes, std::vector<uint16_t>{0x2006});
+  EXPECT_EQ(ppu.last_write, 0x33);
+  EXPECT_EQ(bus.ReadPages()[0x20], nullptr);
+  EXPECT_TRUE(bus.HasReadSideEffects(0x2002));
+}
+
+TEST(BusTest, WritesToRomGoToTheDeviceBeneath) {
+  Bus bus;
+  RecordingDevice mapper;
+  std::vector<uint8_t> rom(0x4000, 0xEA);
+  bus.MapDevice(0x8000, 0x8000, &mapper);
+  bus.MapMemory(0x8000, 0x8000, rom.data(), rom.size(), false);
+
+  bus.Write(0xC123, 0x05);
+
+  EXPECT_EQ(bus.Read(0xC123), 0xEA);
+  EXPECT_EQ(rom[0x0123], 0xEA);
+  EXPECT_TRUE(mapper.reads.empty());
+  EXPECT_EQ(mapper.writes, std::vector<uint16_t>{0xC123});
+  EXPECT_FALSE(bus.HasReadSideEffects(0xC123));
+}
+
+TEST(BusTest, BankSwitchRepointsPages) {
+  Bus bus;
+  std::vector<uint8_t> prg(0x8000);
+  prg[0x0000] = 0x01;
+  prg[0x4000] = 0x02;
+  bus.MapMemory(0x8000, 0x4000, &prg[0x0000], 0x4000, false);
+  EXPECT_EQ(bus.Read(0x8000), 0x01);
+
+  bus.MapMemory(0x8000, 0x4000, &prg[0x4000], 0x4000, false);
+
+  EXPECT_EQ(bus.Read(0x8000), 0x02);
+}
+
+TEST(BusTest, UnmappedPagesReadOpenBus) {
+  Bus bus;
+  std::vector<uint8_t> wram(0x2000);
+  bus.MapMemory(0x6000, 0x2000, wram.data(), wram.size(), true);
+  bus.Unmap(0x6000, 0x2000);
+
+  bus.Write(0x6000, 0x44);
+
+  EXPECT_EQ(bus.Read(0x6000), 0x60);
+  EXPECT_EQ(wram[0], 0);
+}
+
+TEST(BusTest, CpuAccessesMemoryPagesDirectly) {
+  Bus bus;
+  RecordingDevice io;
+  std::vector<uint8_t> rom(0x4000, 0x02);
+  const uint8_t program[] = {
+      0xA9, 0x42,        // LDA #$42
+      0x8D, 0x10, 0x08,  // STA $0810
+      0xAD, 0x16, 0x40,  // LDA $4016
+      0x8D, 0x17, 0x40,  // STA $4017
+  };
+  for (int i = 0; i < 11; ++i) rom[i] = program[i];
+  rom[0x3FFC] = 0x00;
+  rom[0x3FFD] = 0xC0;
+  bus.MapDevice(0x4000, 0x100, &io);
+  bus.MapMemory(0xC000, 0x4000, rom.data(), rom.size(), false);
+  Cpu cpu(bus);
+  cpu.Reset();
+
+  for (int i = 0; i < 4; ++i) cpu.Step();
+
+  EXPECT_EQ(bus.ram()[0x0010], 0x42);
+  EXPECT_EQ(io.reads, std::vector<uint16_t>{0x4016});
+  EXPECT_EQ(io.writes, std::vector<uint16_t>{0x4017});
+  EXPECT_EQ(io.last_write, 0x16);
+}
+
+TEST(BusTest, CpuReadsPointersWithinPagesAndWrapsAtPageEnds) {
+  Bus bus;
+  std::vector<uint8_t> rom(0x4000, 0x02);
+  const uint8_t program[] = {
+      0x6C, 0x10, 0x02,  // JMP ($0210)
+  };
+  for (int i = 0; i < 3; ++i) rom[i] = program[i];
+  rom[0x0100] = 0x6C;  // $C100: JMP ($02FF)
+  rom[0x0101] = 0xFF;
+  rom[0x0102] = 0x02;
+  rom[0x3FFC] = 0x00;
+  rom[0x3FFD] = 0xC0;
+  bus.MapMemory(0xC000, 0x4000, rom.data(), rom.size(), false);
+  bus.ram()[0x0210] = 0x00;
+  bus.ram()[0x0211] = 0xC1;
+  bus.ram()[0x02FF] = 0x34;
+  bus.ram()[0x0200] = 0x12;
+  bus.ram()[0x0300] = 0x99;
+  Cpu cpu(bus);
+  cpu.Reset();
+  EXPECT_EQ(cpu.pc(), 0xC000);
+
+  cpu.Step();
+  EXPECT_EQ(cpu.pc(), 0xC100);
+  cpu.Step();
+  EXPECT_EQ(cpu.pc(), 0x1234);
+}
+
+}  // namespace
+}  // namespace purenes
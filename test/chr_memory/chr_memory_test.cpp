@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "chr_memory.h"
+
+namespace purenes {
+namespace {
+
+using Pixels = std::array<uint8_t, 8>;
+
+std::vector<uint8_t> TwoTiles() {
+  std::vector<uint8_t> data(2 * ChrMemory::kTileSize);
+  // Tile 1, row 3: low plane 0b11001010, high plane 0b10010110.
+  data[ChrMemory::kTileSize + 3] = 0xCA;
+  data[ChrMemory::kTileSize + 8 + 3] = 0x96;
+  return data;
+}
+
+TEST(ChrMemoryTest, DecodesRowsToOnePixelPerByte) {
+  ChrMemory chr(TwoTiles(), false);
+
+  const ChrMemory::Row& row = chr.DecodedRow(1, 3);
+  EXPECT_EQ(row.pixels, (Pixels{3, 1, 0, 2, 1, 2, 3, 0}));
+  EXPECT_EQ(row.flipped, (Pixels{0, 3, 2, 1, 2, 0, 1, 3}));
+  EXPECT_EQ(row.opaque, 0xDE);
+  EXPECT_EQ(row.opaque_flipped, 0x7B);
+  EXPECT_EQ(chr.DecodedRow(0, 3).pixels, Pixels{});
+}
+
+TEST(ChrMemoryTest, RomIgnoresWrites) {
+  ChrMemory chr(TwoTiles(), false);
+
+  chr.Write(0, 0xFF);
+
+  EXPECT_EQ(chr.Read(0), 0);
+  EXPECT_EQ(chr.DecodedRow(0, 0).pixels, Pixels{});
+}
+
+TEST(ChrMemoryTest, WritesToRamRedecodeTheirTile) {
+  ChrMemory chr(TwoTiles(), true);
+  EXPECT_EQ(chr.DecodedRow(0, 7).pixels, Pixels{});
+
+  chr.Write(7, 0x0F);
+  chr.Write(15, 0x33);
+
+  EXPECT_EQ(chr.Read(7), 0x0F);
+  EXPECT_EQ(chr.DecodedRow(0, 7).pixels, (Pixels{0, 0, 2, 2, 1, 1, 3, 3}));
+  EXPECT_EQ(chr.DecodedRow(1, 3).pixels, (Pixels{3, 1, 0, 2, 1, 2, 3, 0}));
+}
+
+}  // namespace
+}  // namespace purenes
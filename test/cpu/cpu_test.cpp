@@ -0,0 +1,1066 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include "bus.h"
+#include "cpu.h"
+#include "opcode_pair_profile.h"
+
+namespace purenes {
+namespace {
+
+// 64KB of flat read/write memory.
+class FlatMemory : public CpuBus {
+ public:
+  uint8_t Read(uint16_t address) override { return data[address]; }
+  void Write(uint16_t address, uint8_t value) override {
+    data[address] = value;
+  }
+
+  std::array<uint8_t, 0x10000> data{};
+};
+
+constexpr uint16_t kProgramStart = 0x8000;
+
+class CpuTest : public ::testing::Test {
+ protected:
+  CpuTest() : cpu_(memory_) {}
+
+  // Places a program at kProgramStart, points the reset vector at it and
+  // resets the CPU. Code written behind the CPU's back requires dropping its
+  // decoded-instruction cache.
+  void Load(std::initializer_list<uint8_t> program) {
+    uint16_t address = kProgramStart;
+    for (uint8_t byte : program) memory_.data[address++] = byte;
+    memory_.data[Cpu::kResetVector] = kProgramStart & 0xFF;
+    memory_.data[Cpu::kResetVector + 1] = kProgramStart >> 8;
+    cpu_.InvalidateCodeCache();
+    cpu_.Reset();
+  }
+
+  FlatMemory memory_;
+  Cpu cpu_;
+};
+
+// Runs a test once per CPU backend, skipping backends this build lacks.
+class CpuBackendTest : public CpuTest,
+                       public ::testing::WithParamInterface<Cpu::Backend> {
+ protected:
+  void SetUp() override {
+    if (!cpu_.SetBackend(GetParam())) GTEST_SKIP() << "backend unavailable";
+  }
+};
+
+INSTANTIATE_TEST_SUITE_P(Backends, CpuBackendTest,
+                         ::testing::Values(Cpu::Backend::kInterpreter,
+                                           Cpu::Backend::kJit));
+
+TEST_F(CpuTest, ResetLoadsVectorAndInitializesRegisters) {
+  Load({});
+
+  EXPECT_EQ(cpu_.pc(), kProgramStart);
+  EXPECT_EQ(cpu_.s(), 0xFD);
+  EXPECT_EQ(cpu_.p(), kUnused | kInterruptDisable);
+  EXPECT_EQ(cpu_.cycles(), 7u);
+}
+
+TEST_F(CpuTest, LdaImmediateSetsZeroAndNegative) {
+  Load({0xA9, 0x00, 0xA9, 0x80, 0xA9, 0x01});
+
+  EXPECT_EQ(cpu_.Step(), 2);
+  EXPECT_TRUE(cpu_.p() & kZero);
+  EXPECT_FALSE(cpu_.p() & kNegative);
+
+  cpu_.Step();
+  EXPECT_EQ(cpu_.a(), 0x80);
+  EXPECT_FALSE(cpu_.p() & kZero);
+  EXPECT_TRUE(cpu_.p() & kNegative);
+
+  cpu_.Step();
+  EXPECT_EQ(cpu_.a(), 0x01);
+  EXPECT_FALSE(cpu_.p() & (kZero | kNegative));
+}
+
+TEST_F(CpuTest, AdcSetsCarryAndOverflow) {
+  // CLC; LDA #$50; ADC #$50; ADC #$C0
+  Load({0x18, 0xA9, 0x50, 0x69, 0x50, 0x69, 0xC0});
+  cpu_.Step();
+  cpu_.Step();
+
+  cpu_.Step();
+  EXPECT_EQ(cpu_.a(), 0xA0);
+  EXPECT_TRUE(cpu_.p() & kOverflow);
+  EXPECT_FALSE(cpu_.p() & kCarry);
+
+  cpu_.Step();
+  EXPECT_EQ(cpu_.a(), 0x60);
+  EXPECT_TRUE(cpu_.p() & kOverflow);
+  EXPECT_TRUE(cpu_.p() & kCarry);
+}
+
+TEST_F(CpuTest, SbcBorrowsThroughCarry) {
+  // SEC; LDA #$50; SBC #$F0; SBC #$01
+  Load({0x38, 0xA9, 0x50, 0xE9, 0xF0, 0xE9, 0x01});
+  cpu_.Step();
+  cpu_.Step();
+
+  cpu_.Step();
+  EXPECT_EQ(cpu_.a(), 0x60);
+  EXPECT_FALSE(cpu_.p() & kCarry);
+  EXPECT_FALSE(cpu_.p() & kOverflow);
+
+  cpu_.Step();
+  EXPECT_EQ(cpu_.a(), 0x5E);
+  EXPECT_TRUE(cpu_.p() & kCarry);
+}
+
+TEST_F(CpuTest, DecimalFlagDoesNotAffectArithmetic) {
+  // SED; CLC; LDA #$09; ADC #$01
+  Load({0xF8, 0x18, 0xA9, 0x09, 0x69, 0x01});
+  for (int i = 0; i < 4; ++i) cpu_.Step();
+
+  EXPECT_EQ(cpu_.a(), 0x0A);
+  EXPECT_TRUE(cpu_.p() & kDecimal);
+}
+
+TEST_F(CpuTest, IndexedReadAddsCycleOnPageCross) {
+  // LDX #$01; LDA $80FF,X; LDA $8000,X
+  Load({0xA2, 0x01, 0xBD, 0xFF, 0x80, 0xBD, 0x00, 0x80});
+  memory_.data[0x8100] = 0x42;
+  cpu_.Step();
+
+  EXPECT_EQ(cpu_.Step(), 5);
+  EXPECT_EQ(cpu_.a(), 0x42);
+  EXPECT_EQ(cpu_.Step(), 4);
+}
+
+TEST_F(CpuTest, IndexedWriteAlwaysTakesFullCycles) {
+  // LDX #$01; STA $0200,X
+  Load({0xA2, 0x01, 0x9D, 0x00, 0x02});
+  cpu_.Step();
+
+  EXPECT_EQ(cpu_.Step(), 5);
+}
+
+TEST_F(CpuTest, IndirectYReadsZeroPagePointer) {
+  // LDY #$10; LDA ($FF),Y
+  Load({0xA0, 0x10, 0xB1, 0xFF});
+  memory_.data[0x00FF] = 0xF8;
+  memory_.data[0x0000] = 0x02;  // pointer high byte wraps to $00
+  memory_.data[0x0308] = 0x99;
+  cpu_.Step();
+
+  EXPECT_EQ(cpu_.Step(), 6);
+  EXPECT_EQ(cpu_.a(), 0x99);
+}
+
+TEST_F(CpuTest, IndirectXWrapsInZeroPage) {
+  // LDX #$01; LDA ($FF,X)
+  Load({0xA2, 0x01, 0xA1, 0xFF});
+  memory_.data[0x0000] = 0x34;
+  memory_.data[0x0001] = 0x12;
+  memory_.data[0x1234] = 0x77;
+  cpu_.Step();
+
+  EXPECT_EQ(cpu_.Step(), 6);
+  EXPECT_EQ(cpu_.a(), 0x77);
+}
+
+TEST_F(CpuTest, BranchCyclesDependOnOutcomeAndPage) {
+  // LDA #$01; BNE +0; BEQ +0; BNE -$10 (crosses into page $7F)
+  Load({0xA9, 0x01, 0xD0, 0x00, 0xF0, 0x00, 0xD0, 0xF0});
+  cpu_.Step();
+
+  EXPECT_EQ(cpu_.Step(), 3);
+  EXPECT_EQ(cpu_.Step(), 2);
+  EXPECT_EQ(cpu_.Step(), 4);
+  EXPECT_EQ(cpu_.pc(), 0x7FF8);
+}
+
+TEST_F(CpuTest, JmpIndirectWrapsWithinPage) {
+  // JMP ($02FF)
+  Load({0x6C, 0xFF, 0x02});
+  memory_.data[0x02FF] = 0x00;
+  memory_.data[0x0200] = 0x90;
+  memory_.data[0x0300] = 0xA0;
+
+  EXPECT_EQ(cpu_.Step(), 5);
+  EXPECT_EQ(cpu_.pc(), 0x9000);
+}
+
+TEST_F(CpuTest, JsrAndRtsRoundTrip) {
+  // JSR $8010; ... $8010: RTS
+  Load({0x20, 0x10, 0x80});
+  memory_.data[0x8010] = 0x60;
+
+  EXPECT_EQ(cpu_.Step(), 6);
+  EXPECT_EQ(cpu_.pc(), 0x8010);
+  EXPECT_EQ(memory_.data[0x01FD], 0x80);
+  EXPECT_EQ(memory_.data[0x01FC], 0x02);
+
+  EXPECT_EQ(cpu_.Step(), 6);
+  EXPECT_EQ(cpu_.pc(), 0x8003);
+  EXPECT_EQ(cpu_.s(), 0xFD);
+}
+
+TEST_F(CpuTest, PhpPushesBreakAndPlpIgnoresIt) {
+  // SEC; PHP; CLC; PLP
+  Load({0x38, 0x08, 0x18, 0x28});
+  cpu_.Step();
+  cpu_.Step();
+  EXPECT_EQ(memory_.data[0x01FD],
+            kCarry | kBreak | kUnused | kInterruptDisable);
+
+  cpu_.Step();
+  cpu_.Step();
+  EXPECT_EQ(cpu_.p(), kCarry | kUnused | kInterruptDisable);
+}
+
+TEST_F(CpuTest, BrkAndRti) {
+  // BRK; (padding); ... handler at $9000: RTI
+  Load({0x00, 0xEA});
+  memory_.data[Cpu::kIrqVector] = 0x00;
+  memory_.data[Cpu::kIrqVector + 1] = 0x90;
+  memory_.data[0x9000] = 0x40;
+
+  EXPECT_EQ(cpu_.Step(), 7);
+  EXPECT_EQ(cpu_.pc(), 0x9000);
+  EXPECT_EQ(memory_.data[0x01FB] & kBreak, kBreak);
+
+  EXPECT_EQ(cpu_.Step(), 6);
+  EXPECT_EQ(cpu_.pc(), 0x8002);
+}
+
+TEST_F(CpuTest, NmiIsServicedAtNextInstructionBoundary) {
+  Load({0xEA});
+  memory_.data[Cpu::kNmiVector] = 0x00;
+  memory_.data[Cpu::kNmiVector + 1] = 0xA0;
+
+  cpu_.Nmi();
+
+  EXPECT_EQ(cpu_.Step(), 7);
+  EXPECT_EQ(cpu_.pc(), 0xA000);
+  EXPECT_EQ(memory_.data[0x01FB] & kBreak, 0);
+  EXPECT_TRUE(cpu_.p() & kInterruptDisable);
+}
+
+TEST_F(CpuTest, IrqIsMaskedByInterruptDisable) {
+  // NOP; CLI; NOP
+  Load({0xEA, 0x58, 0xEA});
+  memory_.data[Cpu::kIrqVector] = 0x00;
+  memory_.data[Cpu::kIrqVector + 1] = 0xB0;
+
+  cpu_.SetIrq(true);
+  cpu_.Step();
+  cpu_.Step();
+  EXPECT_EQ(cpu_.pc(), 0x8002);
+
+  EXPECT_EQ(cpu_.Step(), 7);
+  EXPECT_EQ(cpu_.pc(), 0xB000);
+}
+
+TEST_F(CpuTest, ReadModifyWriteOperations) {
+  // LDA #$01; SEC; ROL $10; LSR $10; DEC $10; INC $11
+  Load({0xA9, 0x01, 0x38, 0x26, 0x10, 0x46, 0x10, 0xC6, 0x10, 0xE6, 0x11});
+  memory_.data[0x0010] = 0x80;
+  memory_.data[0x0011] = 0xFF;
+  cpu_.Step();
+  cpu_.Step();
+
+  EXPECT_EQ(cpu_.Step(), 5);
+  EXPECT_EQ(memory_.data[0x0010], 0x01);
+  EXPECT_TRUE(cpu_.p() & kCarry);
+
+  cpu_.Step();
+  EXPECT_EQ(memory_.data[0x0010], 0x00);
+  EXPECT_TRUE(cpu_.p() & kZero);
+
+  cpu_.Step();
+  EXPECT_EQ(memory_.data[0x0010], 0xFF);
+  EXPECT_TRUE(cpu_.p() & kNegative);
+
+  cpu_.Step();
+  EXPECT_EQ(memory_.data[0x0011], 0x00);
+  EXPECT_TRUE(cpu_.p() & kZero);
+}
+
+TEST_F(CpuTest, UnofficialLaxAndDcp) {
+  // LAX $10; DCP $11
+  Load({0xA7, 0x10, 0xC7, 0x11});
+  memory_.data[0x0010] = 0x33;
+  memory_.data[0x0011] = 0x34;
+
+  cpu_.Step();
+  EXPECT_EQ(cpu_.a(), 0x33);
+  EXPECT_EQ(cpu_.x(), 0x33);
+
+  EXPECT_EQ(cpu_.Step(), 5);
+  EXPECT_EQ(memory_.data[0x0011], 0x33);
+  EXPECT_TRUE(cpu_.p() & kZero);
+  EXPECT_TRUE(cpu_.p() & kCarry);
+}
+
+// Copies eight bytes from $0300 to $0400 in a subroutine, summing them
+// with ADC, then counts down Y with a nested delay loop.
+constexpr std::initializer_list<uint8_t> kCopyAndSumProgram = {
+    0x20, 0x12, 0x80,  // JSR copy
+    0xA0, 0x20,        // LDY #$20
+    0xA2, 0x10,        // delay: LDX #$10
+    0xCA,              // inner: DEX
+    0xD0, 0xFD,        // BNE inner
+    0x88,              // DEY
+    0xD0, 0xF8,        // BNE delay
+    0x4C, 0x0D, 0x80,  // done: JMP done
+    0x00, 0x00,        // (padding)
+    0xA2, 0x07,        // copy ($8012): LDX #$07
+    0x18,              // CLC
+    0xA9, 0x00,        // LDA #$00
+    0x7D, 0x00, 0x03,  // loop: ADC $0300,X
+    0xBC, 0x00, 0x03,  // LDY $0300,X
+    0x94, 0x10,        // STY $10,X
+    0xFE, 0x00, 0x04,  // INC $0400,X
+    0xCA,              // DEX
+    0x10, 0xF2,        // BPL loop
+    0x85, 0x20,        // STA $20
+    0x60,              // RTS
+};
+
+TEST_P(CpuBackendTest, RunUntilMatchesSingleStepping) {
+  Load(kCopyAndSumProgram);
+  for (int i = 0; i < 8; ++i) memory_.data[0x0300 + i] = 0x11 * (i + 1);
+
+  FlatMemory stepped_memory = memory_;
+  Cpu stepped(stepped_memory);
+  stepped.Reset();
+
+  cpu_.RunUntil(5000);
+  while (stepped.cycles() < cpu_.cycles()) stepped.Step();
+
+  EXPECT_EQ(memory_.data, stepped_memory.data);
+  EXPECT_EQ(cpu_.cycles(), stepped.cycles());
+  EXPECT_EQ(cpu_.pc(), stepped.pc());
+  EXPECT_EQ(cpu_.a(), stepped.a());
+  EXPECT_EQ(cpu_.x(), stepped.x());
+  EXPECT_EQ(cpu_.y(), stepped.y());
+  EXPECT_EQ(cpu_.s(), stepped.s());
+  EXPECT_EQ(cpu_.p(), stepped.p());
+
+  EXPECT_EQ(memory_.data[0x0020], 0x66);  // $11 + ... + $88 plus carries
+  EXPECT_EQ(memory_.data[0x0017], 0x88);
+  EXPECT_EQ(cpu_.pc(), 0x800D);
+}
+
+TEST_P(CpuBackendTest, RunUntilServicesInterrupts) {
+  // CLI; loop: JMP loop; handler: INC $10; RTI
+  Load({0x58, 0x4C, 0x01, 0x80, 0xE6, 0x10, 0x40});
+  memory_.data[Cpu::kNmiVector] = 0x04;
+  memory_.data[Cpu::kNmiVector + 1] = 0x80;
+
+  cpu_.RunUntil(20);
+  cpu_.Nmi();
+  cpu_.RunUntil(50);
+  cpu_.Nmi();
+  cpu_.RunUntil(80);
+
+  EXPECT_EQ(memory_.data[0x0010], 2);
+  EXPECT_EQ(cpu_.s(), 0xFD);
+}
+
+TEST_P(CpuBackendTest, RunUntilStopsAtFirstInstructionBoundaryPastTarget) {
+  // NOP; LDA $0200; NOP
+  Load({0xEA, 0xAD, 0x00, 0x02, 0xEA});
+
+  EXPECT_EQ(cpu_.RunUntil(10), 13u);
+  EXPECT_EQ(cpu_.pc(), 0x8004);
+  EXPECT_EQ(cpu_.RunUntil(13), 13u);
+}
+
+// Yields when address $4000 is written.
+class YieldingMemory : public FlatMemory {
+ public:
+  void Write(uint16_t address, uint8_t value) override {
+    FlatMemory::Write(address, value);
+    if (address == 0x4000) cpu->Yield();
+  }
+
+  Cpu* cpu = nullptr;
+};
+
+TEST_P(CpuBackendTest, RunUntilReturnsAfterYieldingInstruction) {
+  YieldingMemory memory;
+  Cpu cpu(memory);
+  ASSERT_TRUE(cpu.SetBackend(GetParam()));
+  memory.cpu = &cpu;
+  // NOP; STA $4000; NOP
+  const uint8_t program[] = {0xEA, 0x8D, 0x00, 0x40, 0xEA};
+  for (int i = 0; i < 5; ++i) memory.data[kProgramStart + i] = program[i];
+  memory.data[Cpu::kResetVector + 1] = kProgramStart >> 8;
+  cpu.Reset();
+
+  EXPECT_EQ(cpu.RunUntil(1000), 13u);
+  EXPECT_EQ(cpu.pc(), 0x8004);
+}
+
+TEST_P(CpuBackendTest, TickMatchesRunUntilAtInstructionBoundaries) {
+  Load(kCopyAndSumProgram);
+  for (int i = 0; i < 8; ++i) memory_.data[0x0300 + i] = 0x11 * (i + 1);
+
+  FlatMemory ticked_memory = memory_;
+  Cpu ticked(ticked_memory);
+  ticked.Reset();
+
+  // Tick() executes each instruction on its first cycle, so after ticking
+  // to cycle N it has executed every instruction that starts before N.
+  uint64_t cycle = ticked.cycles();
+  for (uint64_t target = 100; target <= 3000; target += 100) {
+    const uint64_t reached = cpu_.RunUntil(target);
+    while (cycle < reached) {
+      ticked.Tick();
+      ++cycle;
+    }
+    EXPECT_EQ(ticked.cycles(), reached);
+    EXPECT_EQ(ticked.pc(), cpu_.pc());
+    EXPECT_EQ(ticked.a(), cpu_.a());
+    EXPECT_EQ(ticked.x(), cpu_.x());
+    EXPECT_EQ(ticked.y(), cpu_.y());
+    EXPECT_EQ(ticked.p(), cpu_.p());
+  }
+  EXPECT_EQ(ticked_memory.data, memory_.data);
+}
+
+TEST_P(CpuBackendTest, WritesInvalidateCachedCode) {
+  // At $0200: LDA #$05; INC $0201; DEX; BNE -8; JMP *
+  const uint8_t program[] = {0xA9, 0x05, 0xEE, 0x01, 0x02, 0xCA,
+                             0xD0, 0xF8, 0x4C, 0x08, 0x02};
+  for (int i = 0; i < 11; ++i) memory_.data[0x0200 + i] = program[i];
+  cpu_.set_pc(0x0200);
+  cpu_.set_x(3);
+
+  cpu_.RunUntil(200);
+
+  EXPECT_EQ(cpu_.a(), 0x07);
+  EXPECT_EQ(memory_.data[0x0201], 0x08);
+}
+
+TEST_P(CpuBackendTest, WritesThroughMirrorsInvalidateCachedCode) {
+  // Internal RAM appears four times in $0000-$1FFF. The code runs from one
+  // mirror of $0300 and changes its LDA operand through another.
+  for (uint16_t run : {0x0300, 0x0B00}) {
+    const uint16_t change = run == 0x0300 ? 0x0B01 : 0x0301;
+    // LDA #$01; INC change; DEX; BNE -8; JMP *
+    const uint8_t program[] = {0xA9, 0x01, 0xEE,
+                               static_cast<uint8_t>(change),
+                               static_cast<uint8_t>(change >> 8),
+                               0xCA, 0xD0, 0xF8, 0x4C,
+                               static_cast<uint8_t>(run + 8),
+                               static_cast<uint8_t>((run + 8) >> 8)};
+    Bus bus;
+    for (int i = 0; i < 11; ++i) bus.Write(0x0300 + i, program[i]);
+    Cpu cpu(bus);
+    ASSERT_TRUE(cpu.SetBackend(GetParam()));
+    cpu.set_pc(run);
+    cpu.set_x(3);
+
+    cpu.RunUntil(200);
+
+    EXPECT_EQ(cpu.a(), 0x03) << run;
+    EXPECT_EQ(bus.ram()[0x0301], 0x04) << run;
+  }
+}
+
+// Exercises superinstructions: CLC/ADC, LDA/STA, CMP/BNE and DEX/BNE.
+constexpr std::initializer_list<uint8_t> kFusedPairsProgram = {
+    0xA2, 0x05,        // LDX #$05
+    0x18,              // loop: CLC
+    0x69, 0x03,        // ADC #$03
+    0xA5, 0x10,        // LDA $10
+    0x85, 0x11,        // STA $11
+    0xC9, 0x00,        // CMP #$00
+    0xD0, 0x02,        // BNE skip
+    0xE6, 0x10,        // INC $10
+    0xCA,              // skip: DEX
+    0xD0, 0xF0,        // BNE loop
+    0x4C, 0x12, 0x80,  // JMP *
+};
+
+TEST_F(CpuTest, SuperinstructionsStopAtEveryDeadline) {
+  Load(kFusedPairsProgram);
+  FlatMemory stepped_memory = memory_;
+  Cpu stepped(stepped_memory);
+  stepped.Reset();
+
+  // Targets one cycle apart land between the halves of every pair.
+  for (uint64_t target = cpu_.cycles() + 1; target < 200; ++target) {
+    cpu_.RunUntil(target);
+    while (stepped.cycles() < cpu_.cycles()) stepped.Step();
+    ASSERT_EQ(cpu_.cycles(), stepped.cycles());
+    ASSERT_EQ(cpu_.pc(), stepped.pc());
+    ASSERT_EQ(cpu_.a(), stepped.a());
+    ASSERT_EQ(cpu_.x(), stepped.x());
+    ASSERT_EQ(cpu_.p(), stepped.p());
+  }
+  EXPECT_EQ(memory_.data, stepped_memory.data);
+  EXPECT_EQ(memory_.data[0x0011], 0x01);
+}
+
+TEST_F(CpuTest, SuperinstructionSeesWriteToItsSecondHalf) {
+  // At $0040: INC $43; LDA $10; JMP *. The INC turns LDA $10 into LDA $11.
+  const uint8_t program[] = {0xE6, 0x43, 0xA5, 0x10, 0x4C, 0x44, 0x00};
+  for (int i = 0; i < 7; ++i) memory_.data[0x0040 + i] = program[i];
+  memory_.data[0x0010] = 0xAA;
+  memory_.data[0x0011] = 0xBB;
+  cpu_.set_pc(0x0040);
+
+  cpu_.RunUntil(100);
+
+  EXPECT_EQ(cpu_.a(), 0xBB);
+}
+
+TEST_F(CpuTest, OpcodePairProfileCountsConsecutiveOpcodes) {
+  // LDX #$03; loop: DEX; BNE loop; handler: RTI
+  Load({0xA2, 0x03, 0xCA, 0xD0, 0xFD, 0x40});
+  memory_.data[Cpu::kNmiVector] = 0x05;
+  memory_.data[Cpu::kNmiVector + 1] = 0x80;
+  OpcodePairProfile profile;
+  cpu_.SetOpcodePairProfile(&profile);
+
+  for (int i = 0; i < 7; ++i) cpu_.Step();
+  cpu_.Nmi();
+  cpu_.Step();
+  cpu_.Step();
+
+  EXPECT_EQ(profile.count(0xA2, 0xCA), 1u);
+  EXPECT_EQ(profile.count(0xCA, 0xD0), 3u);
+  EXPECT_EQ(profile.count(0xD0, 0xCA), 2u);
+  // The interrupt separates the last BNE from the RTI of the handler.
+  EXPECT_EQ(profile.count(0xD0, 0x40), 0u);
+  EXPECT_EQ(profile.total(), 6u);
+  const std::vector<OpcodePairProfile::Pair> top = profile.Top(1);
+  ASSERT_EQ(top.size(), 1u);
+  EXPECT_EQ(top[0].first, 0xCA);
+  EXPECT_EQ(top[0].second, 0xD0);
+}
+
+TEST_F(CpuTest, UncachedBankIsDecodedOnEveryFetch) {
+  memory_.data[0x5000] = 0xA9;  // LDA #$01
+  memory_.data[0x5001] = 0x01;
+  cpu_.SetCodeBank(0x50, Cpu::kUncachedBank);
+  cpu_.set_pc(0x5000);
+  cpu_.Step();
+  EXPECT_EQ(cpu_.a(), 0x01);
+
+  memory_.data[0x5001] = 0x02;  // changed without a CPU write
+  cpu_.set_pc(0x5000);
+  cpu_.Step();
+  EXPECT_EQ(cpu_.a(), 0x02);
+}
+
+// Two 256-byte banks switchable into $C000-$C0FF by writing $FFF0, in the
+// way a mapper would report them to the CPU.
+class BankedMemory : public FlatMemory {
+ public:
+  uint8_t Read(uint16_t address) override {
+    if ((address >> 8) == 0xC0) return banks[selected][address & 0xFF];
+    return FlatMemory::Read(address);
+  }
+  void Write(uint16_t address, uint8_t value) override {
+    if (address != 0xFFF0) return FlatMemory::Write(address, value);
+    selected = value & 1;
+    cpu->SetCodeBank(0xC0, static_cast<uint16_t>(1 + selected));
+  }
+
+  uint8_t banks[2][256] = {};
+  int selected = 0;
+  Cpu* cpu = nullptr;
+};
+
+TEST_P(CpuBackendTest, BankSwitchSelectsCodeOfNewBank) {
+  BankedMemory memory;
+  Cpu cpu(memory);
+  ASSERT_TRUE(cpu.SetBackend(GetParam()));
+  memory.cpu = &cpu;
+  cpu.SetCodeBank(0xC0, 1);
+  const uint8_t subroutine0[] = {0xA9, 0x11, 0x60};  // LDA #$11; RTS
+  const uint8_t subroutine1[] = {0xA9, 0x22, 0x60};  // LDA #$22; RTS
+  for (int i = 0; i < 3; ++i) {
+    memory.banks[0][i] = subroutine0[i];
+    memory.banks[1][i] = subroutine1[i];
+  }
+  const uint8_t program[] = {
+      0x20, 0x00, 0xC0,  // JSR $C000
+      0x85, 0x00,        // STA $00
+      0xA9, 0x01,        // LDA #$01
+      0x8D, 0xF0, 0xFF,  // STA $FFF0
+      0x20, 0x00, 0xC0,  // JSR $C000
+      0x85, 0x01,        // STA $01
+      0xA9, 0x00,        // LDA #$00
+      0x8D, 0xF0, 0xFF,  // STA $FFF0
+      0x20, 0x00, 0xC0,  // JSR $C000
+      0x85, 0x02,        // STA $02
+      0x4C, 0x19, 0x80,  // JMP *
+  };
+  for (size_t i = 0; i < sizeof(program); ++i) {
+    memory.data[kProgramStart + i] = program[i];
+  }
+  memory.data[Cpu::kResetVector + 1] = kProgramStart >> 8;
+  cpu.Reset();
+
+  cpu.RunUntil(200);
+
+  EXPECT_EQ(memory.data[0x0000], 0x11);
+  EXPECT_EQ(memory.data[0x0001], 0x22);
+  EXPECT_EQ(memory.data[0x0002], 0x11);
+}
+
+// kCopyAndSumProgram's delay loop at $8005-$800F as purenes_recompile
+// translates it.
+void RunDelayLoop(Cpu* cpu) {
+  const Cpu::InstructionEntry* const execute = Cpu::kInstructionEntries;
+  switch (cpu->pc()) {
+    case 0x8005: goto at_8005;
+    case 0x8007: goto at_8007;
+    case 0x8008: goto at_8008;
+    case 0x800A: goto at_800A;
+    case 0x800B: goto at_800B;
+    default: return;
+  }
+at_8005:  // LDX
+  if (execute[0xA2](cpu, 0x20010)) return;
+at_8007:  // DEX
+  if (execute[0xCA](cpu, 0x10000)) return;
+at_8008:  // BNE
+  if (execute[0xD0](cpu, 0x200FD)) return;
+  if (cpu->pc() == 0x8007) goto at_8007;
+at_800A:  // DEY
+  if (execute[0x88](cpu, 0x10000)) return;
+at_800B:  // BNE
+  if (execute[0xD0](cpu, 0x200F8)) return;
+  if (cpu->pc() == 0x8005) goto at_8005;
+  return;
+}
+
+const Cpu::CompiledBlock kDelayLoopBlocks[] = {
+    {0, 0x8005, &RunDelayLoop}, {0, 0x8007, &RunDelayLoop},
+    {0, 0x8008, &RunDelayLoop}, {0, 0x800A, &RunDelayLoop},
+    {0, 0x800B, &RunDelayLoop},
+};
+const Cpu::CompiledCode kDelayLoop = {kDelayLoopBlocks, 5};
+
+TEST_P(CpuBackendTest, CompiledCodeMatchesInterpretation) {
+  Load(kCopyAndSumProgram);
+  for (int i = 0; i < 8; ++i) memory_.data[0x0300 + i] = 0x11 * (i + 1);
+  cpu_.SetCompiledCode(&kDelayLoop);
+
+  FlatMemory interpreted_memory = memory_;
+  Cpu interpreted(interpreted_memory);
+  interpreted.Reset();
+
+  for (uint64_t target = 100; target <= 5000; target += 100) {
+    EXPECT_EQ(cpu_.RunUntil(target), interpreted.RunUntil(target));
+    EXPECT_EQ(cpu_.pc(), interpreted.pc());
+    EXPECT_EQ(cpu_.x(), interpreted.x());
+    EXPECT_EQ(cpu_.y(), interpreted.y());
+    EXPECT_EQ(cpu_.p(), interpreted.p());
+  }
+  EXPECT_EQ(memory_.data, interpreted_memory.data);
+}
+
+TEST_P(CpuBackendTest, CompiledCodeIsOnlyUsedInItsBank) {
+  Load(kCopyAndSumProgram);
+  // The delay loop now lives in a bank the compiled code was not built from.
+  cpu_.SetCodeBank(0x80, 1);
+  memory_.data[0x8006] = 0x01;  // LDX #$01
+  cpu_.SetCompiledCode(&kDelayLoop);
+
+  // With X = 1 the delay loop finishes within 1000 cycles. The compiled
+  // loop, still counting X down from 16, would take over 2500.
+  cpu_.RunUntil(1000);
+  EXPECT_EQ(cpu_.pc(), 0x800D);
+}
+
+// Counts reads, and reports reads of $4016 as having side effects, which
+// repeat until `stable_until`.
+class CountingMemory : public FlatMemory {
+ public:
+  uint8_t Read(uint16_t address) override {
+    ++reads;
+    return FlatMemory::Read(address);
+  }
+  bool HasReadSideEffects(uint16_t address) override {
+    return address == 0x4016;
+  }
+  uint64_t ReadStableUntil(uint16_t address) override {
+    return address == 0x4016 ? stable_until : 0;
+  }
+
+  int reads = 0;
+  uint64_t stable_until = 0;
+};
+
+TEST_F(CpuTest, CachedInstructionsOnlyAccessTheirOperands) {
+  CountingMemory memory;
+  Cpu cpu(memory);
+  // loop: LDA #$05; ASL A; STA $0200,X; JMP loop
+  const uint8_t program[] = {0xA9, 0x05, 0x0A, 0x9D, 0x00,
+                             0x02, 0x4C, 0x00, 0x80};
+  for (int i = 0; i < 9; ++i) memory.data[kProgramStart + i] = program[i];
+  memory.data[Cpu::kResetVector + 1] = kProgramStart >> 8;
+  cpu.Reset();
+  for (int i = 0; i < 4; ++i) cpu.Step();
+
+  // Immediate and accumulator operands, stores and jumps read nothing once
+  // decoded.
+  memory.reads = 0;
+  const uint64_t start = cpu.cycles();
+  for (int i = 0; i < 40; ++i) cpu.Step();
+
+  EXPECT_EQ(memory.reads, 0);
+  EXPECT_EQ(cpu.cycles() - start, 10u * (2 + 2 + 5 + 3));
+  EXPECT_EQ(memory.data[0x0200], 0x0A);
+}
+
+// Waits for the NMI handler to set $10, then counts frames in $12 with a
+// delay loop in between.
+constexpr std::initializer_list<uint8_t> kWaitForNmiProgram = {
+    0xA5, 0x10,        // wait: LDA $10
+    0xF0, 0xFC,        // BEQ wait
+    0xA9, 0x00,        // LDA #$00
+    0x85, 0x10,        // STA $10
+    0xE6, 0x12,        // INC $12
+    0xA2, 0x40,        // LDX #$40
+    0xCA,              // delay: DEX
+    0xD0, 0xFD,        // BNE delay
+    0x4C, 0x00, 0x80,  // JMP wait
+    0xE6, 0x10,        // nmi ($8012): INC $10
+    0x40,              // RTI
+};
+
+void LoadWaitForNmiProgram(FlatMemory* memory, Cpu* cpu) {
+  uint16_t address = kProgramStart;
+  for (uint8_t byte : kWaitForNmiProgram) memory->data[address++] = byte;
+  memory->data[Cpu::kResetVector + 1] = kProgramStart >> 8;
+  memory->data[Cpu::kNmiVector] = 0x12;
+  memory->data[Cpu::kNmiVector + 1] = kProgramStart >> 8;
+  cpu->Reset();
+}
+
+TEST_P(CpuBackendTest, IdleLoopSkippingIsCycleIdentical) {
+  CountingMemory skipping_memory;
+  Cpu skipping(skipping_memory);
+  ASSERT_TRUE(skipping.SetBackend(GetParam()));
+  skipping.SetIdleLoopSkipping(true);
+  LoadWaitForNmiProgram(&skipping_memory, &skipping);
+  CountingMemory running_memory;
+  Cpu running(running_memory);
+  LoadWaitForNmiProgram(&running_memory, &running);
+
+  // Frames of 29781 cycles with the NMI at their start, and an uneven
+  // slice in between.
+  for (uint64_t frame = 1; frame <= 10; ++frame) {
+    for (uint64_t target : {frame * 29781 - 1234, frame * 29781}) {
+      ASSERT_EQ(skipping.RunUntil(target), running.RunUntil(target));
+      ASSERT_EQ(skipping.pc(), running.pc());
+      ASSERT_EQ(skipping.a(), running.a());
+      ASSERT_EQ(skipping.x(), running.x());
+      ASSERT_EQ(skipping.p(), running.p());
+    }
+    skipping.Nmi();
+    running.Nmi();
+  }
+
+  EXPECT_EQ(skipping_memory.data, running_memory.data);
+  EXPECT_EQ(running_memory.data[0x0012], 9);
+  EXPECT_LT(skipping_memory.reads, running_memory.reads / 10);
+}
+
+TEST_P(CpuBackendTest, IdleLoopSkippingSkipsJumpToSelf) {
+  CountingMemory memory;
+  Cpu cpu(memory);
+  ASSERT_TRUE(cpu.SetBackend(GetParam()));
+  cpu.SetIdleLoopSkipping(true);
+  memory.data[kProgramStart] = 0x4C;  // JMP *
+  memory.data[kProgramStart + 2] = kProgramStart >> 8;
+  cpu.set_pc(kProgramStart);
+
+  // The last JMP starts before the target and ends past it.
+  EXPECT_EQ(cpu.RunUntil(1000000), 1000002u);
+  EXPECT_LT(memory.reads, 20);
+}
+
+TEST_P(CpuBackendTest, IdleLoopSkippingKeepsReadsWithSideEffects) {
+  CountingMemory memory;
+  Cpu cpu(memory);
+  ASSERT_TRUE(cpu.SetBackend(GetParam()));
+  cpu.SetIdleLoopSkipping(true);
+  const uint8_t program[] = {0xAD, 0x16, 0x40,  // wait: LDA $4016
+                             0xF0, 0xFB};       // BEQ wait
+  for (int i = 0; i < 5; ++i) memory.data[kProgramStart + i] = program[i];
+  cpu.set_pc(kProgramStart);
+
+  cpu.RunUntil(7000);
+
+  EXPECT_GE(memory.reads, 1000);
+  EXPECT_EQ(cpu.skipped_cycles(), 0u);
+}
+
+TEST_P(CpuBackendTest, IdleLoopSkippingSkipsStableReads) {
+  const uint8_t program[] = {0xAD, 0x16, 0x40,  // wait: LDA $4016
+                             0xF0, 0xFB};       // BEQ wait
+  CountingMemory skipping_memory;
+  Cpu skipping(skipping_memory);
+  ASSERT_TRUE(skipping.SetBackend(GetParam()));
+  skipping.SetIdleLoopSkipping(true);
+  CountingMemory running_memory;
+  Cpu running(running_memory);
+  for (CountingMemory* memory : {&skipping_memory, &running_memory}) {
+    for (int i = 0; i < 5; ++i) memory->data[kProgramStart + i] = program[i];
+    memory->stable_until = 5000;
+  }
+  skipping.set_pc(kProgramStart);
+  running.set_pc(kProgramStart);
+
+  // Skips up to the last iteration that ends before the reads change, and
+  // runs from there.
+  ASSERT_EQ(skipping.RunUntil(7000), running.RunUntil(7000));
+  EXPECT_GT(skipping.skipped_cycles(), 4900u);
+  EXPECT_LT(skipping.skipped_cycles(), 5000u);
+  EXPECT_GE(skipping_memory.reads, 250);
+}
+
+// Eager reference model of the flag-setting operations: each computes the
+// complete P register the straightforward way from the previous P value.
+uint8_t EagerZn(uint8_t p, uint8_t value) {
+  p &= ~(kZero | kNegative);
+  if (value == 0) p |= kZero;
+  return p | (value & kNegative);
+}
+
+uint8_t EagerAdc(uint8_t p, uint8_t a, uint8_t m, uint8_t* result) {
+  const unsigned sum = a + m + (p & kCarry);
+  *result = static_cast<uint8_t>(sum);
+  p &= ~(kCarry | kOverflow);
+  if (sum > 0xFF) p |= kCarry;
+  if (~(a ^ m) & (a ^ *result) & 0x80) p |= kOverflow;
+  return EagerZn(p, *result);
+}
+
+uint8_t EagerCompare(uint8_t p, uint8_t reg, uint8_t m) {
+  p &= ~kCarry;
+  if (reg >= m) p |= kCarry;
+  return EagerZn(p, static_cast<uint8_t>(reg - m));
+}
+
+uint8_t EagerBit(uint8_t p, uint8_t a, uint8_t m) {
+  p &= ~(kZero | kOverflow | kNegative);
+  if ((a & m) == 0) p |= kZero;
+  return p | (m & (kOverflow | kNegative));
+}
+
+class LazyFlagTest : public CpuTest {
+ protected:
+  // Executes the instruction `opcode operand` at kProgramStart with the
+  // given A and P and returns the resulting P.
+  uint8_t Execute(uint8_t opcode, uint8_t operand, uint8_t a, uint8_t p) {
+    memory_.data[kProgramStart] = opcode;
+    memory_.data[kProgramStart + 1] = operand;
+    cpu_.InvalidateCodeCache();
+    cpu_.set_pc(kProgramStart);
+    cpu_.set_a(a);
+    cpu_.set_p(p);
+    cpu_.Step();
+    return cpu_.p();
+  }
+};
+
+// Status values that exercise every flag the operations leave untouched.
+constexpr uint8_t kInitialStatuses[] = {
+    kUnused,
+    kUnused | kCarry,
+    0xFF & ~kBreak,
+    kUnused | kZero | kNegative | kOverflow | kDecimal,
+};
+
+TEST_F(LazyFlagTest, AdcAndSbcMatchEagerReference) {
+  for (uint8_t initial : kInitialStatuses) {
+    for (int a = 0; a < 256; ++a) {
+      for (int m = 0; m < 256; ++m) {
+        uint8_t result;
+        const uint8_t adc = EagerAdc(initial, a, m, &result);
+        ASSERT_EQ(Execute(0x69, m, a, initial), adc) << a << " + " << m;
+        ASSERT_EQ(cpu_.a(), result);
+
+        const uint8_t sbc = EagerAdc(initial, a, ~m & 0xFF, &result);
+        ASSERT_EQ(Execute(0xE9, m, a, initial), sbc) << a << " - " << m;
+        ASSERT_EQ(cpu_.a(), result);
+      }
+    }
+  }
+}
+
+TEST_F(LazyFlagTest, CompareAndBitMatchEagerReference) {
+  memory_.data[0x00F0] = 0;
+  for (uint8_t initial : kInitialStatuses) {
+    for (int a = 0; a < 256; ++a) {
+      for (int m = 0; m < 256; ++m) {
+        ASSERT_EQ(Execute(0xC9, m, a, initial), EagerCompare(initial, a, m));
+
+        memory_.data[0x00F0] = static_cast<uint8_t>(m);
+        ASSERT_EQ(Execute(0x24, 0xF0, a, initial), EagerBit(initial, a, m));
+      }
+    }
+  }
+}
+
+TEST_F(LazyFlagTest, ShiftsAndLoadsMatchEagerReference) {
+  for (uint8_t initial : kInitialStatuses) {
+    const uint8_t carry_in = initial & kCarry;
+    for (int a = 0; a < 256; ++a) {
+      const uint8_t asl = static_cast<uint8_t>(a << 1);
+      const uint8_t lsr = static_cast<uint8_t>(a >> 1);
+      const uint8_t rol = static_cast<uint8_t>(a << 1 | carry_in);
+      const uint8_t ror = static_cast<uint8_t>(a >> 1 | carry_in << 7);
+      const uint8_t without_carry = initial & ~kCarry;
+
+      EXPECT_EQ(Execute(0x0A, 0, a, initial),
+                EagerZn(without_carry | (a >> 7), asl));
+      EXPECT_EQ(Execute(0x4A, 0, a, initial),
+                EagerZn(without_carry | (a & 1), lsr));
+      EXPECT_EQ(Execute(0x2A, 0, a, initial),
+                EagerZn(without_carry | (a >> 7), rol));
+      EXPECT_EQ(Execute(0x6A, 0, a, initial),
+                EagerZn(without_carry | (a & 1), ror));
+      EXPECT_EQ(Execute(0xA9, a, 0, initial), EagerZn(initial, a));
+    }
+  }
+}
+
+TEST_F(LazyFlagTest, PhpPushesMaterializedStatusForEveryValue) {
+  for (int value = 0; value < 256; ++value) {
+    // PLP; PHP
+    memory_.data[kProgramStart] = 0x28;
+    memory_.data[kProgramStart + 1] = 0x08;
+    memory_.data[0x01FF] = static_cast<uint8_t>(value);
+    cpu_.InvalidateCodeCache();
+    cpu_.set_pc(kProgramStart);
+    cpu_.set_s(0xFE);
+    cpu_.Step();
+    cpu_.Step();
+
+    EXPECT_EQ(cpu_.p(), (value & ~kBreak) | kUnused);
+    EXPECT_EQ(memory_.data[0x01FF], value | kBreak | kUnused);
+  }
+}
+
+TEST_F(LazyFlagTest, InterruptPushesMaterializedStatus) {
+  // LDA #$80; CMP #$80; SEC; BIT $F0
+  Load({0xA9, 0x80, 0xC9, 0x80, 0x38, 0x24, 0xF0});
+  memory_.data[0x00F0] = 0x40;
+  for (int i = 0; i < 4; ++i) cpu_.Step();
+
+  cpu_.Nmi();
+  cpu_.Step();
+
+  // BIT $40 with A = $80: Z set, V set, N clear.
+  EXPECT_EQ(memory_.data[0x01FB],
+            kUnused | kInterruptDisable | kCarry | kZero | kOverflow);
+}
+
+TEST_F(LazyFlagTest, BranchesAgreeWithMaterializedStatus) {
+  struct BranchCase {
+    uint8_t opcode;
+    uint8_t flag;
+    bool taken_when_set;
+  };
+  constexpr BranchCase kBranches[] = {
+      {0x10, kNegative, false}, {0x30, kNegative, true},
+      {0x50, kOverflow, false}, {0x70, kOverflow, true},
+      {0x90, kCarry, false},    {0xB0, kCarry, true},
+      {0xD0, kZero, false},     {0xF0, kZero, true},
+  };
+  for (const BranchCase& branch : kBranches) {
+    for (int value = 0; value < 256; ++value) {
+      Execute(branch.opcode, 0x10, 0, static_cast<uint8_t>(value));
+      const bool taken = cpu_.pc() == kProgramStart + 0x12;
+      EXPECT_EQ(taken, ((value & branch.flag) != 0) == branch.taken_when_set)
+          << "opcode $" << std::hex << int(branch.opcode) << " P=$" << value;
+    }
+  }
+}
+
+TEST_P(CpuBackendTest, RunUntilBranchesAgreeWithMaterializedStatus) {
+  const uint8_t kBranches[][2] = {
+      {0x10, kNegative}, {0x30, kNegative}, {0x50, kOverflow},
+      {0x70, kOverflow}, {0x90, kCarry},    {0xB0, kCarry},
+      {0xD0, kZero},     {0xF0, kZero},
+  };
+  for (const auto& branch : kBranches) {
+    // Bxx +$10; the odd opcodes in each pair branch when the flag is set.
+    memory_.data[kProgramStart] = branch[0];
+    memory_.data[kProgramStart + 1] = 0x10;
+    for (int value = 0; value < 256; ++value) {
+      cpu_.InvalidateCodeCache();
+      cpu_.set_pc(kProgramStart);
+      cpu_.set_p(static_cast<uint8_t>(value));
+      const uint64_t start = cpu_.cycles();
+      const bool flag_set = (value & branch[1]) != 0;
+      const bool taken = flag_set == ((branch[0] & 0x20) != 0);
+
+      cpu_.RunUntil(start + 1);
+
+      EXPECT_EQ(cpu_.pc(), taken ? kProgramStart + 0x12 : kProgramStart + 2)
+          << "opcode $" << std::hex << int(branch[0]) << " P=$" << value;
+      EXPECT_EQ(cpu_.cycles() - start, taken ? 3u : 2u);
+    }
+  }
+}
+
+// Base cycle counts of every opcode, taken independently from the 6502
+// reference tables (no page crossing, branches not taken, JAM counted as 2).
+constexpr uint8_t kReferenceCycles[256] = {
+    7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,  // 0x00
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  // 0x10
+    6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,  // 0x20
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  // 0x30
+    6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,  // 0x40
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  // 0x50
+    6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6,  // 0x60
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  // 0x70
+    2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,  // 0x80
+    2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5,  // 0x90
+    2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,  // 0xA0
+    2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4,  // 0xB0
+    2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,  // 0xC0
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  // 0xD0
+    2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,  // 0xE0
+    2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,  // 0xF0
+};
+
+// Status flags under which the branch `opcode` (if it is one) is not taken.
+uint8_t FlagsForUntakenBranch(int opcode) {
+  switch (opcode) {
+    case 0x10: return kNegative;  // BPL
+    case 0x50: return kOverflow;  // BVC
+    case 0x90: return kCarry;     // BCC
+    case 0xD0: return kZero;      // BNE
+    default: return 0;
+  }
+}
+
+TEST_F(CpuTest, EveryOpcodeTakesReferenceBaseCycles) {
+  for (int opcode = 0; opcode < 256; ++opcode) {
+    memory_.data.fill(0);
+    // Operands of $00 keep every access in the zero page, so no indexed
+    // mode crosses a page.
+    Load({static_cast<uint8_t>(opcode), 0x00, 0x00});
+    cpu_.set_p(FlagsForUntakenBranch(opcode));
+
+    EXPECT_EQ(cpu_.Step(), kReferenceCycles[opcode])
+        << "opcode $" << std::hex << opcode;
+  }
+}
+
+}  // namespace
+}  // namespace purenes
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "observation.h"
+#include "ppu.h"
+
+namespace purenes {
+namespace {
+
+// White ($30) is 0xED in luma, black ($0F) 0.
+constexpr uint16_t kWhite = 0x30;
+constexpr uint16_t kBlack = 0x0F;
+constexpr uint8_t kWhiteLuma = 0xED;
+
+// A frame that is white where `white(x, y)`, and black elsewhere.
+template <typename Predicate>
+std::vector<uint16_t> Frame(Predicate white) {
+  std::vector<uint16_t> frame(Ppu::kWidth * Ppu::kHeight);
+  for (int y = 0; y < Ppu::kHeight; ++y) {
+    for (int x = 0; x < Ppu::kWidth; ++x) {
+      frame[y * Ppu::kWidth + x] = white(x, y) ? kWhite : kBlack;
+    }
+  }
+  return frame;
+}
+
+std::vector<uint8_t> Pixels(const Observation& observation) {
+  return std::vector<uint8_t>(
+      observation.pixels(),
+      observation.pixels() + observation.width() * observation.height());
+}
+
+TEST(ObservationTest, ScalesDownByAveragingArea) {
+  Observation observation(3, 2);
+  // The left half white: the middle column covers it halfway.
+  observation.AddFrame(Frame([](int x, int) { return x < 128; }).data());
+  EXPECT_EQ(Pixels(observation),
+            (std::vector<uint8_t>{kWhiteLuma, 119, 0, kWhiteLuma, 119, 0}));
+
+  Observation square;
+  EXPECT_EQ(square.width(), 84);
+  EXPECT_EQ(square.height(), 84);
+  square.AddFrame(Frame([](int, int) { return true; }).data());
+  EXPECT_EQ(Pixels(square), std::vector<uint8_t>(84 * 84, kWhiteLuma));
+}
+
+TEST(ObservationTest, TakesTheBrighterOfTheLastTwoFrames) {
+  Observation observation(2, 1);
+  const std::vector<uint16_t> left = Frame([](int x, int) { return x < 128; });
+  const std::vector<uint16_t> right =
+      Frame([](int x, int) { return x >= 128; });
+  const std::vector<uint16_t> black = Frame([](int, int) { return false; });
+
+  observation.AddFrame(left.data());
+  EXPECT_EQ(Pixels(observation), (std::vector<uint8_t>{kWhiteLuma, 0}));
+  observation.AddFrame(right.data());
+  EXPECT_EQ(Pixels(observation),
+            (std::vector<uint8_t>{kWhiteLuma, kWhiteLuma}));
+  observation.AddFrame(black.data());
+  EXPECT_EQ(Pixels(observation), (std::vector<uint8_t>{0, kWhiteLuma}));
+
+  observation.Clear();
+  EXPECT_EQ(Pixels(observation), (std::vector<uint8_t>{0, 0}));
+  observation.AddFrame(left.data());
+  EXPECT_EQ(Pixels(observation), (std::vector<uint8_t>{kWhiteLuma, 0}));
+}
+
+TEST(ObservationTest, OnlyPoolsConsecutiveFrames) {
+  Observation observation(2, 1);
+  const std::vector<uint16_t> left = Frame([](int x, int) { return x < 128; });
+  const std::vector<uint16_t> right =
+      Frame([](int x, int) { return x >= 128; });
+
+  observation.AddFrame(left.data(), 1);
+  observation.AddFrame(right.data(), 3);
+  EXPECT_EQ(Pixels(observation), (std::vector<uint8_t>{0, kWhiteLuma}));
+  observation.AddFrame(left.data(), 4);
+  EXPECT_EQ(Pixels(observation),
+            (std::vector<uint8_t>{kWhiteLuma, kWhiteLuma}));
+}
+
+TEST(ObservationTest, EverySimdObservesTheSame) {
+  // One pixel to spare, so that a second frame starts a pixel later.
+  std::vector<uint16_t> noise(Ppu::kWidth * Ppu::kHeight + 1);
+  for (size_t i = 0; i < noise.size(); ++i) {
+    noise[i] = static_cast<uint16_t>((i * 2654435761u >> 7) % 512);
+  }
+  Observation expected(84, 84, Ppu::Simd::kNone);
+  expected.AddFrame(noise.data());
+  expected.AddFrame(noise.data() + 1);
+
+  const int host = static_cast<int>(Ppu::HostSimd());
+  for (int simd = 1; simd <= host; ++simd) {
+    Observation observation(84, 84, static_cast<Ppu::Simd>(simd));
+    observation.AddFrame(noise.data());
+    observation.AddFrame(noise.data() + 1);
+    EXPECT_EQ(Pixels(observation), Pixels(expected)) << simd;
+  }
+}
+
+}  // namespace
+}  // namespace purenes
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "pixel_format.h"
+#include "ppu.h"
+
+namespace purenes {
+namespace {
+
+constexpr PixelFormat kFormats[] = {
+    PixelFormat::kIndex16, PixelFormat::kRgba8888, PixelFormat::kBgra8888,
+    PixelFormat::kRgb565, PixelFormat::kGray8};
+
+std::vector<uint8_t> Convert(const std::vector<uint16_t>& pixels,
+                             PixelFormat format,
+                             Ppu::Simd simd = Ppu::Simd::kNone) {
+  std::vector<uint8_t> out(pixels.size() * BytesPerPixel(format));
+  ConvertPixels(pixels.data(), pixels.size(), format, out.data(), simd);
+  return out;
+}
+
+TEST(PixelFormatTest, ConvertsToEveryFormat) {
+  // White ($30) and blue ($12).
+  const std::vector<uint16_t> pixels = {0x30, 0x12};
+
+  EXPECT_EQ(Convert(pixels, PixelFormat::kRgba8888),
+            (std::vector<uint8_t>{0xEC, 0xEE, 0xEC, 0xFF,
+                                  0x30, 0x32, 0xEC, 0xFF}));
+  EXPECT_EQ(Convert(pixels, PixelFormat::kBgra8888),
+            (std::vector<uint8_t>{0xEC, 0xEE, 0xEC, 0xFF,
+                                  0xEC, 0x32, 0x30, 0xFF}));
+  std::vector<uint16_t> rgb565(2);
+  ConvertPixels(pixels.data(), 2, PixelFormat::kRgb565, rgb565.data());
+  EXPECT_EQ(rgb565, (std::vector<uint16_t>{0xEF7D, 0x319D}));
+  EXPECT_EQ(Convert(pixels, PixelFormat::kGray8),
+            (std::vector<uint8_t>{0xED, 0x46}));
+}
+
+TEST(PixelFormatTest, Index16KeepsPaletteIndices) {
+  // Emphasis bits included.
+  const std::vector<uint16_t> pixels = {0x30, 0x1C0 | 0x12};
+  std::vector<uint16_t> indices(2);
+  ConvertPixels(pixels.data(), 2, PixelFormat::kIndex16, indices.data());
+
+  EXPECT_EQ(indices, pixels);
+  EXPECT_EQ(BytesPerPixel(PixelFormat::kIndex16), 2u);
+}
+
+TEST(PixelFormatTest, EmphasisDimsTheOtherChannels) {
+  // White with red emphasized, then with all three.
+  const std::vector<uint16_t> pixels = {0x40 | 0x30, 0x1C0 | 0x30};
+
+  EXPECT_EQ(Convert(pixels, PixelFormat::kRgba8888),
+            (std::vector<uint8_t>{0xEC, 0xC2, 0xC0, 0xFF,
+                                  0x9C, 0x9E, 0x9C, 0xFF}));
+}
+
+TEST(PixelFormatTest, EverySimdConvertsTheSame) {
+  // Every index in order, so that runs of pixels share their emphasis, then
+  // shuffled, and lengths that leave partial vectors.
+  std::vector<uint16_t> pixels(2 * 512 + 31);
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = static_cast<uint16_t>(i < 512 ? i : i * 7 % 512);
+  }
+  const int host = static_cast<int>(Ppu::HostSimd());
+  for (PixelFormat format : kFormats) {
+    const std::vector<uint8_t> expected = Convert(pixels, format);
+    for (int simd = 1; simd <= host; ++simd) {
+      EXPECT_EQ(Convert(pixels, format, static_cast<Ppu::Simd>(simd)),
+                expected)
+          << static_cast<int>(format) << " " << simd;
+    }
+  }
+}
+
+}  // namespace
+}  // namespace purenes
@@ -0,0 +1,353 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include "bus.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "scheduler.h"
+
+namespace purenes {
+namespace {
+
+class PpuTest : public ::testing::Test {
+ protected:
+  PpuTest() : cpu_(bus_), ppu_(cpu_, scheduler_), program_(0x8000) {
+    cpu_.SetScheduler(&scheduler_);
+    bus_.MapDevice(0x2000, 0x2000, &ppu_, 0x2007);
+    bus_.MapMemory(0x8000, 0x8000, program_.data(), program_.size(), false);
+    ppu_.SetPatternMemory(&chr_, 0);
+  }
+
+  // Places `program` at $8000 with an NMI handler at $9000 that counts
+  // NMIs in $10, and resets the CPU.
+  void Load(std::initializer_list<uint8_t> program) {
+    uint16_t address = 0;
+    for (uint8_t byte : program) program_[address++] = byte;
+    const uint8_t handler[] = {0xE6, 0x10, 0x40};  // INC $10; RTI
+    for (int i = 0; i < 3; ++i) program_[0x1000 + i] = handler[i];
+    program_[0x7FFB] = 0x90;  // NMI vector: $9000
+    program_[0x7FFD] = 0x80;  // Reset vector: $8000
+    cpu_.Reset();
+  }
+
+  Scheduler scheduler_;
+  Bus bus_;
+  Cpu cpu_;
+  Ppu ppu_;
+  std::vector<uint8_t> program_;
+  ChrMemory chr_{std::vector<uint8_t>(0x2000), true};
+};
+
+TEST_F(PpuTest, VblankNmiInterruptsRunUntil) {
+  // LDA #$80; STA $2000; loop: JMP loop
+  Load({0xA9, 0x80, 0x8D, 0x00, 0x20, 0x4C, 0x05, 0x80});
+
+  // VBlank starts in cycles 27394, 57174 and 86955.
+  cpu_.RunUntil(90000);
+
+  EXPECT_EQ(ppu_.frame_count(), 3u);
+  EXPECT_EQ(bus_.ram()[0x10], 3);
+}
+
+TEST_F(PpuTest, StatusReadCatchesUpToTheCycleOfTheAccess) {
+  // wait: BIT $2002; BPL wait; done: JMP done
+  Load({0x2C, 0x02, 0x20, 0x10, 0xFB, 0x4C, 0x05, 0x80});
+
+  while (cpu_.pc() != 0x8005) cpu_.Step();
+
+  // BIT reads in its last cycle, and VBlank starts in cycle 27394. The
+  // read in that cycle still misses it, the next one in 27401 sees it.
+  EXPECT_EQ(cpu_.cycles(), 27404u);
+  EXPECT_EQ(ppu_.Read(0x2002) & 0x80, 0);
+}
+
+TEST_F(PpuTest, OddFramesSkipADotWhileRendering) {
+  // Three frames of 341 * 262 dots.
+  ppu_.CatchUp(341 * 262);
+  EXPECT_EQ(ppu_.frame_count(), 3u);
+  EXPECT_EQ(ppu_.scanline(), 0);
+  EXPECT_EQ(ppu_.dot(), 0);
+
+  ppu_.Write(0x2001, 0x08);
+  // An odd frame that is a dot shorter, then an even one.
+  ppu_.CatchUp(341 * 262 + (2 * 341 * 262 - 1) / 3);
+
+  EXPECT_EQ(ppu_.frame_count(), 5u);
+  EXPECT_EQ(ppu_.scanline(), 0);
+  EXPECT_EQ(ppu_.dot(), 0);
+}
+
+TEST(PpuRegionTest, VblankStartsInTheCycleOfTheRegion) {
+  struct Case {
+    Region region;
+    // The CPU cycle of the dot that starts VBlank, (241, 1) or (291, 1) on
+    // the Dendy, at 3 or 3.2 dots per cycle.
+    uint64_t vblank;
+  };
+  const Case cases[] = {
+      {Region::kNtsc, 27394},
+      {Region::kPal, 25681},
+      {Region::kDendy, 33077},
+  };
+  for (const Case& c : cases) {
+    Scheduler scheduler;
+    Bus bus;
+    Cpu cpu(bus);
+    Ppu ppu(cpu, scheduler, c.region);
+
+    EXPECT_EQ(scheduler.scheduled(Scheduler::kPpu), c.vblank + 1);
+    ppu.CatchUp(c.vblank);
+    EXPECT_EQ(ppu.frame_count(), 0u);
+    ppu.CatchUp(c.vblank + 1);
+    EXPECT_EQ(ppu.frame_count(), 1u);
+  }
+}
+
+// A PPU on its own, with noise in its memory and rendering enabled.
+struct NoisyPpu {
+  explicit NoisyPpu(ChrMemory* chr) : cpu(bus), ppu(cpu, scheduler) {
+    ppu.SetPatternMemory(chr, 0);
+    ppu.Write(0x2006, 0x20);
+    ppu.Write(0x2006, 0x00);
+    for (int i = 0; i < 0x1000; ++i) {
+      ppu.Write(0x2007, static_cast<uint8_t>(i * 7 + (i >> 4)));
+    }
+    ppu.Write(0x2006, 0x3F);
+    ppu.Write(0x2006, 0x00);
+    for (int i = 0; i < 32; ++i) {
+      ppu.Write(0x2007, static_cast<uint8_t>(i * 5 + 2));
+    }
+    for (int i = 0; i < 64; ++i) {
+      // Eleven sprites on scanlines 101-108, the others scattered.
+      const bool crowded = i < 11;
+      ppu.Write(0x2004, static_cast<uint8_t>(crowded ? 100 : i * 29));
+      ppu.Write(0x2004, static_cast<uint8_t>(i * 3));
+      ppu.Write(0x2004, static_cast<uint8_t>(i * 0x45));
+      ppu.Write(0x2004, static_cast<uint8_t>(crowded ? i * 23 : i * 37));
+    }
+    ppu.Write(0x2000, 0x10);
+    ppu.Write(0x2005, 0x2B);
+    ppu.Write(0x2005, 0x11);
+    ppu.Write(0x2001, 0x1E);
+  }
+
+  Scheduler scheduler;
+  Bus bus;
+  Cpu cpu;
+  Ppu ppu;
+};
+
+std::vector<uint8_t> Noise() {
+  std::vector<uint8_t> noise(0x2000);
+  for (size_t i = 0; i < noise.size(); ++i) {
+    noise[i] = static_cast<uint8_t>(i * 73 + (i >> 3) * 11);
+  }
+  return noise;
+}
+
+// Catching up three dots at a time never runs a whole scanline.
+void CatchUpDotByDot(Ppu& ppu, uint64_t from, uint64_t to) {
+  for (uint64_t cycle = from; cycle <= to; ++cycle) ppu.CatchUp(cycle);
+}
+
+// Changes the mask and scroll, which splits the scanline if it is halfway
+// through one.
+void SplitScanline(Ppu& ppu) {
+  ppu.Write(0x2001, 0x19);
+  ppu.Write(0x2005, 0x05);
+  ppu.Write(0x2005, 0x00);
+}
+
+bool SameFrame(const Ppu& a, const Ppu& b) {
+  return std::equal(a.frame(), a.frame() + Ppu::kWidth * Ppu::kHeight,
+                    b.frame());
+}
+
+constexpr uint64_t kSplitCycle = 70000;
+constexpr uint64_t kEndCycle = 150000;
+
+TEST(PpuScanlineTest, WholeScanlinesRenderAsDotByDot) {
+  ChrMemory chr(Noise(), false);
+  NoisyPpu scanlines(&chr);
+  NoisyPpu dots(&chr);
+
+  scanlines.ppu.CatchUp(kSplitCycle);
+  CatchUpDotByDot(dots.ppu, 1, kSplitCycle);
+  ASSERT_EQ(dots.ppu.scanline(), scanlines.ppu.scanline());
+  ASSERT_EQ(dots.ppu.dot(), scanlines.ppu.dot());
+  ASSERT_GT(dots.ppu.dot(), 0);
+  SplitScanline(scanlines.ppu);
+  SplitScanline(dots.ppu);
+  scanlines.ppu.CatchUp(kEndCycle);
+  CatchUpDotByDot(dots.ppu, kSplitCycle + 1, kEndCycle);
+
+  EXPECT_EQ(dots.ppu.frame_count(), 5u);
+  EXPECT_EQ(scanlines.ppu.frame_count(), 5u);
+  EXPECT_TRUE(SameFrame(scanlines.ppu, dots.ppu));
+  EXPECT_EQ(scanlines.ppu.Read(0x2002), dots.ppu.Read(0x2002));
+}
+
+TEST(PpuScanlineTest, EverySimdRendersTheSameFrames) {
+  ChrMemory chr(Noise(), false);
+  NoisyPpu dots(&chr);
+  CatchUpDotByDot(dots.ppu, 1, kSplitCycle);
+  SplitScanline(dots.ppu);
+  CatchUpDotByDot(dots.ppu, kSplitCycle + 1, kEndCycle);
+  const uint8_t status = dots.ppu.Read(0x2002);
+
+  const int host = static_cast<int>(Ppu::HostSimd());
+  for (int simd = 0; simd <= host; ++simd) {
+    NoisyPpu scanlines(&chr);
+    scanlines.ppu.SetSimd(static_cast<Ppu::Simd>(simd));
+    scanlines.ppu.CatchUp(kSplitCycle);
+    SplitScanline(scanlines.ppu);
+    scanlines.ppu.CatchUp(kEndCycle);
+
+    EXPECT_TRUE(SameFrame(scanlines.ppu, dots.ppu)) << simd;
+    EXPECT_EQ(scanlines.ppu.Read(0x2002), status) << simd;
+  }
+}
+
+TEST(PpuScanlineTest, NoVideoKeepsStatusTheSame) {
+  // With few opaque pixels, whether sprite 0 hits depends on exactly where
+  // its pixels are. With many, it depends on clipping.
+  std::vector<uint8_t> sparse = Noise();
+  for (size_t i = 0; i < sparse.size(); ++i) {
+    sparse[i] &= static_cast<uint8_t>(i * 29 + (i >> 4)) & 0x12;
+  }
+  ChrMemory sparse_chr(sparse, false);
+  ChrMemory dense_chr(Noise(), false);
+  const uint8_t masks[] = {0x1E, 0x1A, 0x1C, 0x18};
+
+  int hits = 0;
+  int misses = 0;
+  for (ChrMemory* chr : {&sparse_chr, &dense_chr}) {
+    for (int x = 0; x < 256; x += x < 16 || x > 240 ? 1 : 3) {
+      NoisyPpu video(chr);
+      NoisyPpu no_video(chr);
+      no_video.ppu.SetVideoOutput(false);
+      for (NoisyPpu* noisy : {&video, &no_video}) {
+        // Sprite 0 at `x`, flipped every other time.
+        noisy->ppu.Write(0x2003, 2);
+        noisy->ppu.Write(0x2004, x % 2 ? 0x40 : 0x00);
+        noisy->ppu.Write(0x2004, static_cast<uint8_t>(x));
+        noisy->ppu.Write(0x2001, masks[(x + 1) % 4]);
+      }
+
+      // Mostly whole scanlines, with some split by the reads.
+      bool hit = false;
+      for (uint64_t cycle = 400; cycle < 29000; cycle += 400) {
+        video.ppu.CatchUp(cycle);
+        no_video.ppu.CatchUp(cycle);
+        const uint8_t status = video.ppu.Read(0x2002);
+        ASSERT_EQ(no_video.ppu.Read(0x2002), status) << x << " " << cycle;
+        if (status & 0x40) hit = true;
+      }
+      ++(hit ? hits : misses);
+    }
+  }
+  EXPECT_GT(hits, 0);
+  EXPECT_GT(misses, 0);
+}
+
+TEST_F(PpuTest, ChrRamWritesShowInTheNextFrame) {
+  // A black backdrop and white as color 1.
+  ppu_.Write(0x2006, 0x3F);
+  ppu_.Write(0x2006, 0x00);
+  ppu_.Write(0x2007, 0x0F);
+  ppu_.Write(0x2007, 0x30);
+  // Tile 0, which fills the blank nametables, all in color 1.
+  ppu_.Write(0x2006, 0x00);
+  ppu_.Write(0x2006, 0x00);
+  for (int i = 0; i < 8; ++i) ppu_.Write(0x2007, 0xFF);
+  ppu_.Write(0x2005, 0x00);
+  ppu_.Write(0x2005, 0x00);
+  ppu_.Write(0x2001, 0x0A);
+  // Into the second frame, whose first scanline had its tiles prefetched.
+  ppu_.CatchUp(30000);
+  EXPECT_EQ(ppu_.frame()[0], 0x30);
+
+  // Clear the top row of tile 0.
+  ppu_.Write(0x2001, 0x00);
+  ppu_.Write(0x2006, 0x00);
+  ppu_.Write(0x2006, 0x00);
+  ppu_.Write(0x2007, 0x00);
+  ppu_.Write(0x2005, 0x00);
+  ppu_.Write(0x2005, 0x00);
+  ppu_.Write(0x2001, 0x0A);
+  ppu_.CatchUp(60000);
+
+  EXPECT_EQ(ppu_.frame()[0], 0x0F);
+  EXPECT_EQ(ppu_.frame()[Ppu::kWidth], 0x30);
+}
+
+TEST_F(PpuTest, FrameHoldsColorsWithEmphasis) {
+  ppu_.Write(0x2006, 0x3F);
+  ppu_.Write(0x2006, 0x00);
+  ppu_.Write(0x2007, 0x21);
+  // Emphasize green and blue, with rendering off, then grayscale as well.
+  ppu_.Write(0x2001, 0xC0);
+  ppu_.CatchUp(30000);
+  EXPECT_EQ(ppu_.frame()[0], 0x180 | 0x21);
+
+  ppu_.Write(0x2001, 0xC1);
+  ppu_.CatchUp(60000);
+  EXPECT_EQ(ppu_.frame()[0], 0x180 | 0x20);
+}
+
+TEST_F(PpuTest, SpriteOverflowFollowsOamAndSpriteHeight) {
+  // Eight sprites on scanlines 100-107, and a ninth above them that only
+  // reaches them when 16 rows tall. Everything else is off screen.
+  ppu_.Write(0x2003, 0x00);
+  for (int i = 0; i < 256; ++i) {
+    uint8_t data = 0xF0;
+    if (i < 32) data = i % 4 == 0 ? 100 : 0;
+    if (i == 32) data = 92;
+    ppu_.Write(0x2004, data);
+  }
+  ppu_.Write(0x2001, 0x10);
+  // Scanline 120 of frame `frame`, give or take a dot.
+  auto scanline_120 = [](uint64_t frame) {
+    return (frame * 262 + 120) * Ppu::kDotsPerScanline / 3;
+  };
+
+  ppu_.CatchUp(scanline_120(0));
+  EXPECT_EQ(ppu_.Read(0x2002) & 0x20, 0);
+
+  ppu_.Write(0x2000, 0x20);
+  ppu_.CatchUp(scanline_120(1));
+  EXPECT_EQ(ppu_.Read(0x2002) & 0x20, 0x20);
+
+  ppu_.Write(0x2003, 32);
+  ppu_.Write(0x2004, 0xF0);
+  ppu_.CatchUp(scanline_120(2));
+  EXPECT_EQ(ppu_.Read(0x2002) & 0x20, 0);
+}
+
+TEST_F(PpuTest, DataPortBuffersReadsExceptFromPalette) {
+  // $2400 mirrors $2000 horizontally.
+  ppu_.Write(0x2006, 0x20);
+  ppu_.Write(0x2006, 0x00);
+  ppu_.Write(0x2007, 0x11);
+  ppu_.Write(0x2007, 0x22);
+  ppu_.Write(0x2006, 0x24);
+  ppu_.Write(0x2006, 0x00);
+  ppu_.Read(0x2007);
+  EXPECT_EQ(ppu_.Read(0x2007), 0x11);
+  EXPECT_EQ(ppu_.Read(0x2007), 0x22);
+
+  // $3F10 mirrors the backdrop color at $3F00.
+  ppu_.Write(0x2006, 0x3F);
+  ppu_.Write(0x2006, 0x10);
+  ppu_.Write(0x2007, 0x2C);
+  ppu_.Write(0x2006, 0x3F);
+  ppu_.Write(0x2006, 0x00);
+  EXPECT_EQ(ppu_.Read(0x2007) & 0x3F, 0x2C);
+}
+
+}  // namespace
+}  // namespace purenes
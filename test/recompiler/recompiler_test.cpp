@@ -0,0 +1,296 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bus.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "purenes_test_rom_code.h"
+#include "recompiler.h"
+#include "system.h"
+
+namespace purenes {
+namespace {
+
+constexpr uint16_t kBase = 0x8000;
+
+class RecompilerTest : public ::testing::Test {
+ protected:
+  // Maps `program` at kBase in bank 0, padded with JAM to `size` bytes, and
+  // analyzes it from kBase.
+  void Analyze(std::initializer_list<uint8_t> program, size_t size = 0x100) {
+    std::vector<uint8_t> rom(program);
+    rom.resize(size, 0x02);
+    recompiler_.AddRegion(0, kBase, rom);
+    recompiler_.AddEntryPoint(0, kBase);
+    recompiler_.Analyze();
+  }
+
+  bool Found(uint16_t address) const {
+    const std::vector<uint16_t> instructions = recompiler_.Instructions(0);
+    return std::find(instructions.begin(), instructions.end(), address) !=
+           instructions.end();
+  }
+
+  Recompiler recompiler_;
+};
+
+TEST_F(RecompilerTest, FollowsBranchesJumpsAndCalls) {
+  Analyze({
+      0x20, 0x0C, 0x80,  // JSR $800C
+      0xD0, 0x04,        // BNE $8009
+      0x4C, 0x0A, 0x80,  // JMP $800A
+      0xFF,              // (data)
+      0xE8,              // $8009: INX
+      0x00,              // $800A: BRK
+      0xFF,              // (data)
+      0x60,              // $800C: RTS
+  });
+
+  EXPECT_EQ(recompiler_.Instructions(0),
+            (std::vector<uint16_t>{0x8000, 0x8003, 0x8005, 0x8009, 0x800A,
+                                   0x800C}));
+}
+
+TEST_F(RecompilerTest, DoesNotLeaveTheRom) {
+  Analyze({
+      0x20, 0x00, 0x03,  // JSR $0300
+      0x4C, 0x00, 0xC0,  // JMP $C000
+  });
+
+  EXPECT_EQ(recompiler_.Instructions(0),
+            (std::vector<uint16_t>{0x8000, 0x8003}));
+}
+
+TEST_F(RecompilerTest, FindsJumpTableThroughJmpIndirect) {
+  Analyze({
+      0xBD, 0x10, 0x80,  // LDA $8010,X
+      0x85, 0x00,        // STA $00
+      0xBD, 0x12, 0x80,  // LDA $8012,X
+      0x85, 0x01,        // STA $01
+      0x6C, 0x00, 0x00,  // JMP ($0000)
+      0x02, 0x02, 0x02,
+      0x20, 0x21,        // $8010: low bytes
+      0x80, 0x80,        // $8012: high bytes
+      0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+      0xE8,              // $8020: INX
+      0xC8,              // $8021: INY
+  });
+
+  EXPECT_TRUE(Found(0x8020));
+  EXPECT_TRUE(Found(0x8021));
+  EXPECT_FALSE(Found(0x8010));
+}
+
+TEST_F(RecompilerTest, FindsJumpTableThroughRts) {
+  Analyze({
+      0xB9, 0x10, 0x80,  // LDA $8010,Y (high bytes)
+      0x48,              // PHA
+      0xB9, 0x11, 0x80,  // LDA $8011,Y (low bytes)
+      0x48,              // PHA
+      0x60,              // RTS
+      0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+      0x80,              // $8010: high byte
+      0x1F,              // $8011: low byte, entry points to $8020 - 1
+      0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+      0x02, 0x02,
+      0xE8,              // $8020: INX
+  });
+
+  EXPECT_TRUE(Found(0x8020));
+}
+
+TEST_F(RecompilerTest, VectorsAreEntryPoints) {
+  std::vector<uint8_t> rom(0x8000, 0x02);
+  rom[0x7FFA] = 0x00;  // NMI $8000
+  rom[0x7FFB] = 0x80;
+  rom[0x7FFC] = 0x10;  // reset $8010
+  rom[0x7FFD] = 0x80;
+  rom[0x7FFE] = 0x20;  // IRQ $8020
+  rom[0x7FFF] = 0x80;
+  recompiler_.AddRegion(0, kBase, rom);
+  recompiler_.AddVectors(0);
+  recompiler_.Analyze();
+
+  EXPECT_EQ(recompiler_.Instructions(0),
+            (std::vector<uint16_t>{0x8000, 0x8010, 0x8020}));
+}
+
+TEST_F(RecompilerTest, FollowsTargetsIntoOtherBanks) {
+  std::vector<uint8_t> low(0x4000, 0x02);
+  const uint8_t call[] = {0x20, 0x00, 0xC0};  // JSR $C000
+  std::copy(std::begin(call), std::end(call), low.begin());
+  std::vector<uint8_t> high(0x4000, 0x02);
+  high[0] = 0x60;  // RTS
+  recompiler_.AddRegion(1, 0x8000, low);
+  recompiler_.AddRegion(2, 0xC000, high);
+  recompiler_.AddEntryPoint(1, 0x8000);
+  recompiler_.Analyze();
+
+  EXPECT_EQ(recompiler_.Instructions(1),
+            (std::vector<uint16_t>{0x8000, 0x8003}));
+  EXPECT_EQ(recompiler_.Instructions(2), (std::vector<uint16_t>{0xC000}));
+}
+
+TEST_F(RecompilerTest, FollowsJumpsIntoSwitchableWindows) {
+  // UxROM: the fixed last bank is also one of those that $8000 switches
+  // between, so its jumps there may land in any bank.
+  std::vector<uint8_t> fixed(0x4000, 0x02);
+  const uint8_t jump[] = {0x4C, 0x00, 0x80};  // JMP $8000
+  std::copy(std::begin(jump), std::end(jump), fixed.begin());
+  std::vector<uint8_t> switched(0x4000, 0x02);
+  switched[0] = 0x60;  // RTS
+  recompiler_.AddRegion(1, 0x8000, switched);
+  recompiler_.AddRegion(2, 0x8000, fixed);
+  recompiler_.AddRegion(2, 0xC000, fixed);
+  recompiler_.AddEntryPoint(2, 0xC000);
+  recompiler_.Analyze();
+
+  EXPECT_EQ(recompiler_.Instructions(1), (std::vector<uint16_t>{0x8000}));
+  EXPECT_EQ(recompiler_.Instructions(2),
+            (std::vector<uint16_t>{0x8000, 0xC000}));
+}
+
+TEST_F(RecompilerTest, EmitsDirectTransfersBetweenCompiledInstructions) {
+  Analyze({
+      0xA2, 0x03,        // LDX #$03
+      0xCA,              // loop: DEX
+      0xD0, 0xFD,        // BNE loop
+      0x4C, 0x05, 0x80,  // JMP *
+  });
+  std::ostringstream source;
+  recompiler_.EmitSource("test_code", source);
+
+  const std::string text = source.str();
+  EXPECT_NE(text.find("if (cpu->pc() == 0x8002) goto at_8002;"),
+            std::string::npos);
+  EXPECT_NE(text.find("if (Cpu::ExecuteEntry<0x4C>(cpu, 0x38005)) return;\n"
+                      "  goto at_8005;"),
+            std::string::npos);
+  EXPECT_NE(text.find("const Cpu::CompiledCode test_code = {kBlocks, 4};"),
+            std::string::npos);
+}
+
+// The ROM that purenes_test_rom wrote, and that the build recompiled into
+// kTestRomCode.
+std::vector<uint8_t> ReadTestRom() {
+  std::ifstream file(PURENES_TEST_ROM, std::ios::binary);
+  return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)),
+                              std::istreambuf_iterator<char>());
+}
+
+// Blocks run per code bank.
+std::map<uint16_t, int> compiled_runs;
+
+// Runs the block of kTestRomCode at PC, counting it in compiled_runs.
+void RunCounted(Cpu* cpu) {
+  const uint16_t bank = cpu->code_bank(static_cast<uint8_t>(cpu->pc() >> 8));
+  ++compiled_runs[bank];
+  const Cpu::CompiledBlock* const end =
+      kTestRomCode.blocks + kTestRomCode.count;
+  const Cpu::CompiledBlock* const block = std::find_if(
+      kTestRomCode.blocks, end, [cpu, bank](const Cpu::CompiledBlock& b) {
+        return b.bank == bank && b.address == cpu->pc();
+      });
+  block->run(cpu);
+}
+
+// The blocks of kTestRomCode, each running through RunCounted().
+std::vector<Cpu::CompiledBlock> CountedBlocks() {
+  std::vector<Cpu::CompiledBlock> blocks(
+      kTestRomCode.blocks, kTestRomCode.blocks + kTestRomCode.count);
+  for (Cpu::CompiledBlock& block : blocks) block.run = &RunCounted;
+  return blocks;
+}
+
+TEST(RecompiledRomTest, RunsLikeTheInterpreter) {
+  const std::vector<uint8_t> rom = ReadTestRom();
+  ASSERT_EQ(rom.size(), 16u + 0x8000);
+  std::vector<uint8_t> prg(rom.begin() + 16, rom.end());
+  Bus compiled_bus;
+  compiled_bus.MapMemory(0x8000, 0x8000, prg.data(), prg.size(), false);
+  Cpu compiled(compiled_bus);
+  // The code bank ids that a Cartridge would set.
+  for (int page = 0x80; page < 0x100; ++page) {
+    compiled.SetCodeBank(static_cast<uint8_t>(page),
+                         Cartridge::PrgCodeBank(page < 0xC0 ? 0 : 1));
+  }
+  const std::vector<Cpu::CompiledBlock> blocks = CountedBlocks();
+  const Cpu::CompiledCode code = {blocks.data(), blocks.size()};
+  compiled.SetCompiledCode(&code);
+  Bus interpreted_bus;
+  interpreted_bus.MapMemory(0x8000, 0x8000, prg.data(), prg.size(), false);
+  Cpu interpreted(interpreted_bus);
+  compiled.Reset();
+  interpreted.Reset();
+
+  // Analysis found the handlers behind the jump table.
+  EXPECT_TRUE(std::any_of(blocks.begin(), blocks.end(),
+                          [](const Cpu::CompiledBlock& block) {
+                            return block.address == 0x8050;
+                          }));
+  // Frames of 29781 cycles with the NMI at their start, and an uneven
+  // slice in between.
+  compiled_runs.clear();
+  for (uint64_t frame = 1; frame <= 8; ++frame) {
+    for (uint64_t target : {frame * 29781 - 1234, frame * 29781}) {
+      ASSERT_EQ(compiled.RunUntil(target), interpreted.RunUntil(target));
+      ASSERT_EQ(compiled.pc(), interpreted.pc());
+      ASSERT_EQ(compiled.a(), interpreted.a());
+      ASSERT_EQ(compiled.x(), interpreted.x());
+      ASSERT_EQ(compiled.y(), interpreted.y());
+      ASSERT_EQ(compiled.s(), interpreted.s());
+      ASSERT_EQ(compiled.p(), interpreted.p());
+    }
+    compiled.Nmi();
+    interpreted.Nmi();
+  }
+
+  EXPECT_EQ(compiled_bus.ram(), interpreted_bus.ram());
+  EXPECT_EQ(interpreted_bus.ram()[0x10], 7);
+  EXPECT_GT(compiled_runs[Cartridge::PrgCodeBank(0)], 0);
+  EXPECT_GT(compiled_runs[Cartridge::PrgCodeBank(1)], 0);
+}
+
+std::unique_ptr<System> MakeSystem(const std::vector<uint8_t>& rom) {
+  std::string error;
+  std::unique_ptr<Cartridge> cartridge = Cartridge::FromInes(rom, &error);
+  EXPECT_NE(cartridge, nullptr) << error;
+  return std::unique_ptr<System>(new System(std::move(cartridge)));
+}
+
+TEST(RecompiledRomTest, RunsInASystem) {
+  const std::vector<uint8_t> rom = ReadTestRom();
+  std::unique_ptr<System> compiled = MakeSystem(rom);
+  const std::vector<Cpu::CompiledBlock> blocks = CountedBlocks();
+  const Cpu::CompiledCode code = {blocks.data(), blocks.size()};
+  compiled->cpu().SetCompiledCode(&code);
+  std::unique_ptr<System> interpreted = MakeSystem(rom);
+
+  compiled_runs.clear();
+  for (int frame = 0; frame < 8; ++frame) {
+    compiled->RunFrame();
+    interpreted->RunFrame();
+    ASSERT_EQ(compiled->cpu().cycles(), interpreted->cpu().cycles()) << frame;
+    ASSERT_EQ(compiled->cpu().pc(), interpreted->cpu().pc()) << frame;
+    ASSERT_EQ(compiled->bus().ram(), interpreted->bus().ram()) << frame;
+  }
+
+  // The NMI of the last VBlank is still to be taken.
+  EXPECT_EQ(interpreted->bus().ram()[0x10], 7);
+  // Blocks of both banks ran: the subroutines and the main loop.
+  EXPECT_GT(compiled_runs[Cartridge::PrgCodeBank(0)], 0);
+  EXPECT_GT(compiled_runs[Cartridge::PrgCodeBank(1)], 0);
+}
+
+}  // namespace
+}  // namespace purenes
@@ -0,0 +1,121 @@
+// purenes_test_rom: writes the iNES ROM that the tests recompile with
+// purenes_add_recompiled_rom().
+//
+//   purenes_test_rom <rom.nes>
+//
+// A 32KB NROM game without CHR ROM. Its main loop lives at $C000 and calls
+// into $8000: a subroutine that fills $0300-$03FF, and one of four handlers
+// picked through a PHA/PHA/RTS jump table, which jump back to wait for the
+// NMI handler to count the next frame.
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+constexpr size_t kHeaderSize = 16;
+constexpr size_t kPrgBankSize = 0x4000;
+
+std::vector<uint8_t> TestRom() {
+  const uint8_t low_bank[] = {
+      0xA0, 0x00,        // 8000: LDY #$00
+      0xA5, 0x10,        // 8002: LDA $10
+      0x99, 0x00, 0x03,  // 8004: STA $0300,Y
+      0x18,              // 8007: CLC
+      0x69, 0x07,        // 8008: ADC #$07
+      0x59, 0x00, 0x03,  // 800A: EOR $0300,Y
+      0xC8,              // 800D: INY
+      0xD0, 0xF4,        // 800E: BNE $8004
+      0x60,              // 8010: RTS
+  };
+  // Handlers of the jump table, 16 bytes apart from $8020.
+  const std::vector<std::vector<uint8_t>> handlers = {
+      {0xE6, 0x20,         // 8020: INC $20
+       0x4C, 0x1B, 0xC0},  // 8022: JMP $C01B
+      {0xC6, 0x21,         // 8030: DEC $21
+       0x4C, 0x1B, 0xC0},  // 8032: JMP $C01B
+      {0xA5, 0x22,         // 8040: LDA $22
+       0x38,               // 8042: SEC
+       0x2A,               // 8043: ROL A
+       0x85, 0x22,         // 8044: STA $22
+       0x4C, 0x1B, 0xC0},  // 8046: JMP $C01B
+      {0xA6, 0x23,         // 8050: LDX $23
+       0xE8,               // 8052: INX
+       0xE8,               // 8053: INX
+       0x86, 0x23,         // 8054: STX $23
+       0x4C, 0x1B, 0xC0},  // 8056: JMP $C01B
+  };
+  const uint8_t high_bank[] = {
+      0x78,              // C000: SEI
+      0xD8,              // C001: CLD
+      0xA2, 0xFF,        // C002: LDX #$FF
+      0x9A,              // C004: TXS
+      0xA9, 0x80,        // C005: LDA #$80
+      0x8D, 0x00, 0x20,  // C007: STA $2000
+      0x20, 0x00, 0x80,  // C00A: JSR $8000
+      0xA5, 0x10,        // C00D: LDA $10
+      0x29, 0x03,        // C00F: AND #$03
+      0xAA,              // C011: TAX
+      0xBD, 0x30, 0xC0,  // C012: LDA $C030,X
+      0x48,              // C015: PHA
+      0xBD, 0x34, 0xC0,  // C016: LDA $C034,X
+      0x48,              // C019: PHA
+      0x60,              // C01A: RTS
+      0xA5, 0x11,        // C01B: LDA $11
+      0xF0, 0xFC,        // C01D: BEQ $C01B
+      0xA9, 0x00,        // C01F: LDA #$00
+      0x85, 0x11,        // C021: STA $11
+      0x4C, 0x0A, 0xC0,  // C023: JMP $C00A
+      0xE6, 0x10,        // C026: NMI: INC $10
+      0xE6, 0x11,        // C028: INC $11
+      0x40,              // C02A: RTI
+  };
+
+  std::vector<uint8_t> rom(kHeaderSize + 2 * kPrgBankSize);
+  const uint8_t header[] = {'N', 'E', 'S', 0x1A, 2, 0};
+  std::copy(std::begin(header), std::end(header), rom.begin());
+  uint8_t* const prg = &rom[kHeaderSize];
+  std::copy(std::begin(low_bank), std::end(low_bank), prg);
+  for (size_t i = 0; i < handlers.size(); ++i) {
+    const uint16_t address = static_cast<uint16_t>(0x8020 + 0x10 * i);
+    std::copy(handlers[i].begin(), handlers[i].end(),
+              prg + (address - 0x8000));
+    // RTS continues after the address on the stack: the high bytes at
+    // $C030, the low bytes at $C034.
+    const uint16_t entry = static_cast<uint16_t>(address - 1);
+    prg[kPrgBankSize + 0x30 + i] = static_cast<uint8_t>(entry >> 8);
+    prg[kPrgBankSize + 0x34 + i] = static_cast<uint8_t>(entry);
+  }
+  std::copy(std::begin(high_bank), std::end(high_bank), prg + kPrgBankSize);
+
+  uint8_t* const vectors = prg + 2 * kPrgBankSize - 6;
+  const uint8_t vector_bytes[] = {
+      0x26, 0xC0,  // NMI: $C026
+      0x00, 0xC0,  // Reset: $C000
+      0x2A, 0xC0,  // IRQ: $C02A, RTI
+  };
+  std::copy(std::begin(vector_bytes), std::end(vector_bytes), vectors);
+  return rom;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    std::cerr << "usage: " << argv[0] << " <rom.nes>\n";
+    return 2;
+  }
+  const std::vector<uint8_t> rom = TestRom();
+  std::ofstream file(argv[1], std::ios::binary);
+  file.write(reinterpret_cast<const char*>(rom.data()),
+             static_cast<std::streamsize>(rom.size()));
+  if (!file) {
+    std::cerr << argv[1] << ": cannot write\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "ppu.h"
+#include "scanline_kernels.h"
+
+namespace purenes {
+namespace {
+
+// Deterministic noise.
+class Noise {
+ public:
+  uint8_t Next() {
+    state_ = state_ * 6364136223846793005u + 1442695040888963407u;
+    return static_cast<uint8_t>(state_ >> 56);
+  }
+
+ private:
+  uint64_t state_ = 1;
+};
+
+// The kernels of every Simd that the host supports, besides the scalar
+// ones.
+std::vector<Ppu::Simd> VectorSimds() {
+  std::vector<Ppu::Simd> simds;
+  for (int simd = 1; simd <= static_cast<int>(Ppu::HostSimd()); ++simd) {
+    simds.push_back(static_cast<Ppu::Simd>(simd));
+  }
+  return simds;
+}
+
+TEST(ScanlineKernelsTest, CombineTilesMatchesScalar) {
+  Noise noise;
+  std::array<std::array<uint8_t, 8>, 32> patterns;
+  const uint8_t* rows[32];
+  uint8_t attributes[32];
+  for (int i = 0; i < 32; ++i) {
+    for (uint8_t& pixel : patterns[i]) pixel = noise.Next() & 3;
+    rows[i] = patterns[i].data();
+    attributes[i] = static_cast<uint8_t>((noise.Next() & 3) << 2);
+  }
+  std::array<uint8_t, 256> expected;
+  ScanlineKernelsFor(Ppu::Simd::kNone)
+      .combine_tiles(rows, attributes, 32, expected.data());
+  EXPECT_EQ(expected[0], patterns[0][0] ? attributes[0] | patterns[0][0] : 0);
+
+  for (Ppu::Simd simd : VectorSimds()) {
+    std::array<uint8_t, 256> pixels;
+    ScanlineKernelsFor(simd).combine_tiles(rows, attributes, 32,
+                                           pixels.data());
+    EXPECT_EQ(pixels, expected) << static_cast<int>(simd);
+  }
+}
+
+TEST(ScanlineKernelsTest, ComposeMatchesScalar) {
+  Noise noise;
+  uint8_t palette[32];
+  for (uint8_t& entry : palette) entry = noise.Next() & 0x3F;
+
+  for (int line = 0; line < 16; ++line) {
+    std::array<uint8_t, Ppu::kWidth> background;
+    std::array<uint8_t, Ppu::kWidth> sprites;
+    for (int x = 0; x < Ppu::kWidth; ++x) {
+      const uint8_t pixel = noise.Next() & 3;
+      background[x] =
+          static_cast<uint8_t>(pixel ? (noise.Next() & 0x0C) | pixel : 0);
+      const uint8_t sprite = noise.Next();
+      // Sprite 0 pixels only on the odd lines.
+      const uint8_t flags =
+          sprite & (line & 1 ? kFrontPixel | kSpriteZeroPixel : kFrontPixel);
+      sprites[x] = static_cast<uint8_t>(
+          sprite & 3 ? flags | 0x10 | (sprite & 0x0F) : 0);
+    }
+    const uint8_t color_mask = line & 2 ? 0x30 : 0x3F;
+    const uint16_t emphasis = static_cast<uint16_t>(line / 2 << 6 & 0x1C0);
+
+    std::array<uint16_t, Ppu::kWidth> expected;
+    const bool expected_hit =
+        ScanlineKernelsFor(Ppu::Simd::kNone)
+            .compose(background.data(), sprites.data(), palette, color_mask,
+                     emphasis, expected.data());
+    EXPECT_EQ(expected_hit, (line & 1) != 0) << line;
+
+    for (Ppu::Simd simd : VectorSimds()) {
+      std::array<uint16_t, Ppu::kWidth> pixels;
+      const bool hit = ScanlineKernelsFor(simd).compose(
+          background.data(), sprites.data(), palette, color_mask, emphasis,
+          pixels.data());
+      EXPECT_EQ(pixels, expected) << static_cast<int>(simd) << " " << line;
+      EXPECT_EQ(hit, expected_hit) << static_cast<int>(simd) << " " << line;
+    }
+  }
+}
+
+}  // namespace
+}  // namespace purenes
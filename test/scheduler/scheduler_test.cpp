@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "cpu.h"
+#include "scheduler.h"
+
+namespace purenes {
+namespace {
+
+TEST(SchedulerTest, NextIsTheEarliestPendingEvent) {
+  Scheduler scheduler;
+  EXPECT_EQ(scheduler.next(), Scheduler::kNever);
+
+  scheduler.Schedule(Scheduler::kPpu, 300);
+  scheduler.Schedule(Scheduler::kDmc, 200);
+  scheduler.Schedule(Scheduler::kMapper, 400);
+  EXPECT_EQ(scheduler.next(), 200u);
+
+  scheduler.Cancel(Scheduler::kDmc);
+  EXPECT_EQ(scheduler.next(), 300u);
+  scheduler.Schedule(Scheduler::kPpu, 500);
+  EXPECT_EQ(scheduler.next(), 400u);
+  EXPECT_EQ(scheduler.scheduled(Scheduler::kDmc), Scheduler::kNever);
+}
+
+TEST(SchedulerTest, RunDueRunsHandlersInCycleOrder) {
+  Scheduler scheduler;
+  std::vector<std::pair<int, uint64_t>> runs;
+  scheduler.SetHandler(Scheduler::kPpu,
+                       [&](uint64_t cycle) { runs.emplace_back(0, cycle); });
+  scheduler.SetHandler(Scheduler::kApuFrameCounter, [&](uint64_t cycle) {
+    runs.emplace_back(1, cycle);
+    // Periodic events schedule their next occurrence.
+    scheduler.Schedule(Scheduler::kApuFrameCounter, cycle + 100);
+  });
+  scheduler.Schedule(Scheduler::kPpu, 150);
+  scheduler.Schedule(Scheduler::kApuFrameCounter, 100);
+
+  scheduler.RunDue(250);
+
+  EXPECT_EQ(runs, (std::vector<std::pair<int, uint64_t>>{
+                      {1, 100}, {0, 150}, {1, 200}}));
+  EXPECT_EQ(scheduler.next(), 300u);
+}
+
+// 64KB of flat memory whose $4000 schedules a mapper event when written,
+// the given number of cycles later.
+class TimerMemory : public CpuBus {
+ public:
+  uint8_t Read(uint16_t address) override { return data[address]; }
+  void Write(uint16_t address, uint8_t value) override {
+    data[address] = value;
+    if (address == 0x4000) {
+      scheduler->Schedule(Scheduler::kMapper, cpu->cycles() + value);
+    }
+  }
+
+  std::array<uint8_t, 0x10000> data{};
+  Cpu* cpu = nullptr;
+  Scheduler* scheduler = nullptr;
+};
+
+class SchedulerCpuTest : public ::testing::Test {
+ protected:
+  SchedulerCpuTest() : cpu_(memory_) {
+    memory_.cpu = &cpu_;
+    memory_.scheduler = &scheduler_;
+    cpu_.SetScheduler(&scheduler_);
+  }
+
+  // Places `program` at $8000 with an NMI and IRQ handler at $9000 that
+  // counts interrupts in $10, and resets the CPU.
+  void Load(std::initializer_list<uint8_t> program) {
+    uint16_t address = 0x8000;
+    for (uint8_t byte : program) memory_.data[address++] = byte;
+    const uint8_t handler[] = {0xE6, 0x10, 0x40};  // INC $10; RTI
+    for (int i = 0; i < 3; ++i) memory_.data[0x9000 + i] = handler[i];
+    for (uint16_t vector : {Cpu::kNmiVector, Cpu::kIrqVector}) {
+      memory_.data[vector] = 0x00;
+      memory_.data[vector + 1] = 0x90;
+    }
+    memory_.data[Cpu::kResetVector + 1] = 0x80;
+    cpu_.Reset();
+  }
+
+  TimerMemory memory_;
+  Cpu cpu_;
+  Scheduler scheduler_;
+};
+
+TEST_F(SchedulerCpuTest, RunUntilStopsOnlyAtEvents) {
+  // loop: INX; JMP loop
+  Load({0xE8, 0x4C, 0x00, 0x80});
+  std::vector<uint64_t> seen;
+  scheduler_.SetHandler(Scheduler::kPpu, [&](uint64_t cycle) {
+    seen.push_back(cpu_.cycles());
+    cpu_.Nmi();
+    scheduler_.Schedule(Scheduler::kPpu, cycle + 1000);
+  });
+  scheduler_.Schedule(Scheduler::kPpu, 500);
+
+  EXPECT_GE(cpu_.RunUntil(3000), 3000u);
+
+  // Each event runs at the first instruction boundary at or after its
+  // cycle.
+  EXPECT_EQ(seen, (std::vector<uint64_t>{502, 1500, 2500}));
+  EXPECT_EQ(memory_.data[0x0010], 3);
+  EXPECT_EQ(scheduler_.next(), 3500u);
+}
+
+TEST_F(SchedulerCpuTest, EventScheduledByBusAccessPreemptsRunUntil) {
+  // LDA #$16; STA $4000; loop: JMP loop
+  Load({0xA9, 0x16, 0x8D, 0x00, 0x40, 0x4C, 0x05, 0x80});
+  uint64_t fired = 0;
+  scheduler_.SetHandler(Scheduler::kMapper, [&](uint64_t) {
+    fired = cpu_.cycles();
+    cpu_.Nmi();
+  });
+
+  cpu_.RunUntil(100000);
+
+  // STA ends at cycle 7 + 2 + 4, so the event is due at 35 and runs at the
+  // end of the JMP that crosses it rather than at the target.
+  EXPECT_EQ(fired, 37u);
+  EXPECT_EQ(memory_.data[0x0010], 1);
+}
+
+TEST_F(SchedulerCpuTest, HandlerCanYield) {
+  // loop: JMP loop
+  Load({0x4C, 0x00, 0x80});
+  scheduler_.SetHandler(Scheduler::kPpu, [&](uint64_t) { cpu_.Yield(); });
+  scheduler_.Schedule(Scheduler::kPpu, 100);
+
+  EXPECT_EQ(cpu_.RunUntil(1000), 100u);
+  EXPECT_EQ(cpu_.RunUntil(1000), 1000u);
+}
+
+TEST(SchedulerTest, DetachesFromTheCpuWhenDestroyed) {
+  TimerMemory memory;
+  // loop: JMP loop
+  const uint8_t loop[] = {0x4C, 0x00, 0x80};
+  for (int i = 0; i < 3; ++i) memory.data[0x8000 + i] = loop[i];
+  memory.data[Cpu::kResetVector + 1] = 0x80;
+  Cpu cpu(memory);
+  cpu.Reset();
+  {
+    Scheduler scheduler;
+    cpu.SetScheduler(&scheduler);
+    scheduler.Schedule(Scheduler::kPpu, 50);
+  }
+
+  // Nothing is left to stop the CPU short of the target.
+  EXPECT_GE(cpu.RunUntil(1000), 1000u);
+}
+
+}  // namespace
+}  // namespace purenes
@@ -0,0 +1,470 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cartridge.h"
+#include "system.h"
+
+namespace purenes {
+namespace {
+
+constexpr size_t kHeaderSize = 16;
+constexpr size_t kPrgSize = 0x4000;
+
+// Offsets of the data tables in PRG ROM, which is mapped at $C000.
+constexpr size_t kPaletteTable = 0x1000;
+constexpr size_t kNametableTable = 0x1100;
+constexpr size_t kOamTable = 0x1200;
+
+// A 16KB NROM game that exercises the timing-sensitive parts of the PPU:
+// it splits the screen by changing the scroll once it sees the sprite 0 hit,
+// copies sprites with OAM DMA and moves one every frame, and has more than
+// eight sprites on some scanlines.
+std::vector<uint8_t> SplitScreenRom() {
+  const uint8_t program[] = {
+      0x78,              // C000: SEI
+      0xD8,              // C001: CLD
+      0xA2, 0x40,        // C002: LDX #$40
+      0x8E, 0x17, 0x40,  // C004: STX $4017
+      0xA2, 0xFF,        // C007: LDX #$FF
+      0x9A,              // C009: TXS
+      0xE8,              // C00A: INX
+      0x8E, 0x00, 0x20,  // C00B: STX $2000
+      0x8E, 0x01, 0x20,  // C00E: STX $2001
+      0x2C, 0x02, 0x20,  // C011: BIT $2002
+      0x10, 0xFB,        // C014: BPL $C011
+      0x2C, 0x02, 0x20,  // C016: BIT $2002
+      0x10, 0xFB,        // C019: BPL $C016
+      0xA9, 0x3F,        // C01B: LDA #$3F
+      0x8D, 0x06, 0x20,  // C01D: STA $2006
+      0xA2, 0x00,        // C020: LDX #$00
+      0x8E, 0x06, 0x20,  // C022: STX $2006
+      0xBD, 0x00, 0xD0,  // C025: LDA $D000,X
+      0x8D, 0x07, 0x20,  // C028: STA $2007
+      0xE8,              // C02B: INX
+      0xE0, 0x20,        // C02C: CPX #$20
+      0xD0, 0xF5,        // C02E: BNE $C025
+      0xA9, 0x20,        // C030: LDA #$20
+      0x8D, 0x06, 0x20,  // C032: STA $2006
+      0xA9, 0x00,        // C035: LDA #$00
+      0x8D, 0x06, 0x20,  // C037: STA $2006
+      0xAA,              // C03A: TAX
+      0xA0, 0x08,        // C03B: LDY #$08
+      0xBD, 0x00, 0xD1,  // C03D: LDA $D100,X
+      0x8D, 0x07, 0x20,  // C040: STA $2007
+      0xE8,              // C043: INX
+      0xD0, 0xF7,        // C044: BNE $C03D
+      0x88,              // C046: DEY
+      0xD0, 0xF4,        // C047: BNE $C03D
+      0xBD, 0x00, 0xD2,  // C049: LDA $D200,X
+      0x9D, 0x00, 0x02,  // C04C: STA $0200,X
+      0xE8,              // C04F: INX
+      0xD0, 0xF7,        // C050: BNE $C049
+      0xA9, 0x80,        // C052: LDA #$80
+      0x8D, 0x00, 0x20,  // C054: STA $2000
+      0xA9, 0x1E,        // C057: LDA #$1E
+      0x8D, 0x01, 0x20,  // C059: STA $2001
+      0x2C, 0x02, 0x20,  // C05C: BIT $2002
+      0x70, 0xFB,        // C05F: BVS $C05C
+      0x2C, 0x02, 0x20,  // C061: BIT $2002
+      0x50, 0xFB,        // C064: BVC $C061
+      0xA5, 0x10,        // C066: LDA $10
+      0x8D, 0x05, 0x20,  // C068: STA $2005
+      0xA9, 0x00,        // C06B: LDA #$00
+      0x8D, 0x05, 0x20,  // C06D: STA $2005
+      0x4C, 0x5C, 0xC0,  // C070: JMP $C05C
+      0x48,              // C073: NMI: PHA
+      0xA9, 0x00,        // C074: LDA #$00
+      0x8D, 0x03, 0x20,  // C076: STA $2003
+      0xA9, 0x02,        // C079: LDA #$02
+      0x8D, 0x14, 0x40,  // C07B: STA $4014
+      0xA9, 0x00,        // C07E: LDA #$00
+      0x8D, 0x05, 0x20,  // C080: STA $2005
+      0x8D, 0x05, 0x20,  // C083: STA $2005
+      0xA9, 0x80,        // C086: LDA #$80
+      0x8D, 0x00, 0x20,  // C088: STA $2000
+      0xE6, 0x10,        // C08B: INC $10
+      0xEE, 0x07, 0x02,  // C08D: INC $0207
+      0xCE, 0x04, 0x02,  // C090: DEC $0204
+      0x68,              // C093: PLA
+      0x40,              // C094: RTI
+  };
+
+  std::vector<uint8_t> rom(kHeaderSize + kPrgSize + 0x2000);
+  const uint8_t header[] = {'N', 'E', 'S', 0x1A, 1, 1, 0x01};
+  std::copy(std::begin(header), std::end(header), rom.begin());
+  uint8_t* const prg = &rom[kHeaderSize];
+  std::copy(std::begin(program), std::end(program), prg);
+
+  for (int i = 0; i < 32; ++i) {
+    prg[kPaletteTable + i] = static_cast<uint8_t>((i * 7 + 1) & 0x3F);
+  }
+  for (int i = 0; i < 256; ++i) {
+    prg[kNametableTable + i] = static_cast<uint8_t>((i * 5 + (i >> 5)) & 15);
+  }
+  uint8_t* const oam = &prg[kOamTable];
+  // Sprite 0, solid, over the background.
+  const uint8_t sprite_zero[] = {99, 1, 0x00, 100};
+  std::copy(std::begin(sprite_zero), std::end(sprite_zero), oam);
+  // The sprite that moves, flipped.
+  const uint8_t mover[] = {40, 2, 0x41, 20};
+  std::copy(std::begin(mover), std::end(mover), oam + 4);
+  for (int i = 2; i < 64; ++i) {
+    // Ten sprites on scanlines 151-158, and the rest scattered.
+    const bool crowded = i < 12;
+    oam[i * 4] = static_cast<uint8_t>(crowded ? 150 : i * 13);
+    oam[i * 4 + 1] = static_cast<uint8_t>(3 + i % 5);
+    oam[i * 4 + 2] = static_cast<uint8_t>((i & 3) | (i & 1 ? 0x20 : 0));
+    oam[i * 4 + 3] = static_cast<uint8_t>(crowded ? i * 20 : i * 9);
+  }
+
+  prg[0x3FFA] = 0x73;  // NMI: $C073
+  prg[0x3FFB] = 0xC0;
+  prg[0x3FFC] = 0x00;  // Reset: $C000
+  prg[0x3FFD] = 0xC0;
+  prg[0x3FFE] = 0x94;  // IRQ: $C094, RTI
+  prg[0x3FFF] = 0xC0;
+
+  // Tile 0 is blank, tile 1 solid and the others are noise.
+  uint8_t* const chr = &prg[kPrgSize];
+  for (int row = 0; row < 8; ++row) chr[16 + row] = 0xFF;
+  for (int tile = 2; tile < 512; ++tile) {
+    for (int row = 0; row < 8; ++row) {
+      chr[tile * 16 + row] = static_cast<uint8_t>(tile * 37 + row * 11 + 5);
+      chr[tile * 16 + 8 + row] = static_cast<uint8_t>(tile * 53 + row * 29);
+    }
+  }
+  return rom;
+}
+
+std::unique_ptr<System> MakeSystem(const std::vector<uint8_t>& rom) {
+  std::string error;
+  std::unique_ptr<Cartridge> cartridge = Cartridge::FromInes(rom, &error);
+  EXPECT_NE(cartridge, nullptr) << error;
+  return std::unique_ptr<System>(new System(std::move(cartridge)));
+}
+
+uint64_t FrameHash(const System& system) {
+  // FNV-1a.
+  uint64_t hash = 0xCBF29CE484222325;
+  const uint16_t* const pixels = system.frame();
+  for (int i = 0; i < Ppu::kWidth * Ppu::kHeight; ++i) {
+    hash = (hash ^ pixels[i]) * 0x100000001B3;
+  }
+  return hash;
+}
+
+// Runs a frame the slow way, as a reference: every instruction is stepped
+// on its own, and the PPU and APU are brought up to the CPU after each one.
+void RunFrameInLockstep(System* system) {
+  const uint64_t frame = system->ppu().frame_count();
+  while (system->ppu().frame_count() == frame) {
+    system->cpu().Step();
+    system->ppu().CatchUp(system->cpu().cycles());
+    system->apu().CatchUp(system->cpu().cycles());
+  }
+}
+
+TEST(SystemTest, CatchUpRendersTheSameFramesAsLockstep) {
+  const std::vector<uint8_t> rom = SplitScreenRom();
+  std::unique_ptr<System> catch_up = MakeSystem(rom);
+  std::unique_ptr<System> lockstep = MakeSystem(rom);
+
+  for (int frame = 0; frame < 8; ++frame) {
+    catch_up->RunFrame();
+    RunFrameInLockstep(lockstep.get());
+
+    ASSERT_EQ(FrameHash(*catch_up), FrameHash(*lockstep)) << frame;
+    ASSERT_EQ(catch_up->cpu().cycles(), lockstep->cpu().cycles()) << frame;
+    ASSERT_EQ(catch_up->cpu().pc(), lockstep->cpu().pc()) << frame;
+  }
+}
+
+TEST(SystemTest, AccuracyCanChangeBetweenFrames) {
+  const std::vector<uint8_t> rom = SplitScreenRom();
+  std::unique_ptr<System> reference = MakeSystem(rom);
+  std::unique_ptr<System> switched = MakeSystem(rom);
+  switched->SetAccuracy(Accuracy::kScanline);
+
+  for (int frame = 0; frame < 6; ++frame) {
+    if (frame == 3) switched->SetAccuracy(Accuracy::kInstruction);
+    reference->RunFrame();
+    switched->RunFrame();
+    if (frame < 3) continue;
+
+    ASSERT_EQ(FrameHash(*switched), FrameHash(*reference)) << frame;
+    ASSERT_EQ(switched->cpu().cycles(), reference->cpu().cycles()) << frame;
+  }
+  EXPECT_EQ(switched->accuracy(), Accuracy::kInstruction);
+}
+
+TEST(SystemTest, ScanlineAccuracyMovesTheSplitToAScanlineBoundary) {
+  const std::vector<uint8_t> rom = SplitScreenRom();
+  std::unique_ptr<System> exact = MakeSystem(rom);
+  std::unique_ptr<System> coarse = MakeSystem(rom);
+  coarse->SetAccuracy(Accuracy::kScanline);
+  for (int frame = 0; frame < 5; ++frame) {
+    exact->RunFrame();
+    coarse->RunFrame();
+  }
+
+  // Sprite 0 is hit halfway through scanline 100, where the fine X scroll
+  // written in response changes. Coarsely, the write only happens once
+  // scanline 101 begins, and the rest of the frame is the same.
+  const uint16_t* const pixels = coarse->frame();
+  const int split = 100 * 256;
+  EXPECT_TRUE(std::equal(pixels, pixels + split, exact->frame()));
+  EXPECT_FALSE(std::equal(pixels + split, pixels + split + 256,
+                          exact->frame() + split));
+  EXPECT_TRUE(std::equal(pixels + split + 256, pixels + 256 * 240,
+                         exact->frame() + split + 256));
+  EXPECT_EQ(coarse->cpu().cycles(), exact->cpu().cycles());
+}
+
+TEST(SystemTest, SkippedFramesRunExactly) {
+  const std::vector<uint8_t> rom = SplitScreenRom();
+  std::unique_ptr<System> reference = MakeSystem(rom);
+  std::unique_ptr<System> skipping = MakeSystem(rom);
+
+  for (int frame = 0; frame < 9; ++frame) {
+    const bool render = frame % 3 == 2;
+    reference->RunFrame();
+    skipping->RunFrame(render);
+
+    ASSERT_EQ(skipping->cpu().cycles(), reference->cpu().cycles()) << frame;
+    ASSERT_EQ(skipping->cpu().pc(), reference->cpu().pc()) << frame;
+    ASSERT_EQ(skipping->bus().ram(), reference->bus().ram()) << frame;
+    if (render) {
+      ASSERT_EQ(FrameHash(*skipping), FrameHash(*reference)) << frame;
+    }
+  }
+}
+
+TEST(SystemTest, SkipsVblankPollsExactly) {
+  const std::vector<uint8_t> rom = SplitScreenRom();
+  std::unique_ptr<System> reference = MakeSystem(rom);
+  reference->cpu().SetIdleLoopSkipping(false);
+  std::unique_ptr<System> skipping = MakeSystem(rom);
+
+  for (int frame = 0; frame < 8; ++frame) {
+    reference->RunFrame();
+    skipping->RunFrame();
+
+    ASSERT_EQ(skipping->cpu().cycles(), reference->cpu().cycles()) << frame;
+    ASSERT_EQ(skipping->cpu().pc(), reference->cpu().pc()) << frame;
+    ASSERT_EQ(skipping->bus().ram(), reference->bus().ram()) << frame;
+    ASSERT_EQ(FrameHash(*skipping), FrameHash(*reference)) << frame;
+  }
+  // The two waits for VBlank at power-on take more than a frame, and the
+  // wait for sprite 0 to clear most of every VBlank.
+  EXPECT_GT(skipping->cpu().skipped_cycles(), 40000u);
+  EXPECT_EQ(reference->cpu().skipped_cycles(), 0u);
+}
+
+TEST(SystemTest, WritesFramesToTheOutputBuffer) {
+  std::unique_ptr<System> system = MakeSystem(SplitScreenRom());
+  // Rows of BGRA pixels and padding, which has to stay untouched.
+  const ptrdiff_t row_size = Ppu::kWidth * 4;
+  const ptrdiff_t stride = row_size + 16;
+  std::vector<uint8_t> output(stride * Ppu::kHeight, 0xAB);
+  system->SetOutput(output.data(), stride, PixelFormat::kBgra8888);
+
+  std::vector<uint8_t> row(row_size);
+  for (int frame = 0; frame < 6; ++frame) {
+    const bool render = frame != 4;
+    const std::vector<uint8_t> before = output;
+    system->RunFrame(render);
+
+    if (!render) {
+      ASSERT_EQ(output, before);
+      continue;
+    }
+    for (int y = 0; y < Ppu::kHeight; ++y) {
+      ConvertPixels(system->frame() + y * Ppu::kWidth, Ppu::kWidth,
+                    PixelFormat::kBgra8888, row.data());
+      const auto start = output.begin() + y * stride;
+      ASSERT_TRUE(std::equal(row.begin(), row.end(), start)) << frame << y;
+      ASSERT_TRUE(std::all_of(start + row_size, start + stride,
+                              [](uint8_t byte) { return byte == 0xAB; }));
+    }
+  }
+}
+
+TEST(SystemTest, WritesPaletteIndicesToTheOutputBuffer) {
+  std::unique_ptr<System> system = MakeSystem(SplitScreenRom());
+  std::vector<uint16_t> output(Ppu::kWidth * Ppu::kHeight);
+  system->SetOutput(output.data(), Ppu::kWidth * sizeof(uint16_t),
+                    PixelFormat::kIndex16);
+
+  for (int frame = 0; frame < 4; ++frame) {
+    system->RunFrame();
+    ASSERT_TRUE(std::equal(output.begin(), output.end(), system->frame()))
+        << frame;
+  }
+}
+
+TEST(SystemTest, ObservesTheFramesItDraws) {
+  std::unique_ptr<System> system = MakeSystem(SplitScreenRom());
+  Observation observation;
+  system->SetObservation(&observation);
+
+  Observation expected;
+  for (int frame = 0; frame < 6; ++frame) {
+    const bool render = frame != 3;
+    system->RunFrame(render);
+    if (render) expected.AddFrame(system->frame(), frame + 1);
+    ASSERT_TRUE(std::equal(
+        observation.pixels(),
+        observation.pixels() + observation.width() * observation.height(),
+        expected.pixels()))
+        << frame;
+  }
+}
+
+TEST(SystemTest, ResetsMidFrame) {
+  std::unique_ptr<System> system = MakeSystem(SplitScreenRom());
+  for (int frame = 0; frame < 3; ++frame) system->RunFrame();
+  // Halfway down the screen, with rendering and NMIs on, and a length
+  // counter loaded.
+  system->cpu().RunUntil(system->cpu().cycles() + 15000);
+  ASSERT_GT(system->ppu().scanline(), 100);
+  ASSERT_LT(system->ppu().scanline(), 240);
+  system->bus().Write(0x4015, 0x01);
+  system->bus().Write(0x4003, 0x08);
+  ASSERT_EQ(system->bus().Read(0x4015) & 0x01, 0x01);
+  const uint64_t frames = system->ppu().frame_count();
+  const int scanline = system->ppu().scanline();
+
+  system->Reset();
+  EXPECT_EQ(system->cpu().pc(), 0xC000);
+  EXPECT_EQ(system->bus().Read(0x4015), 0x00);
+  // The PPU keeps its timing, but with NMIs off the game only waits for
+  // VBlank twice: no NMI, which would enter $C073, interrupts that.
+  EXPECT_EQ(system->ppu().scanline(), scanline);
+  while (system->cpu().pc() != 0xC01B) {
+    system->cpu().Step();
+    ASSERT_LT(system->cpu().pc(), 0xC073);
+  }
+  EXPECT_EQ(system->ppu().frame_count(), frames + 2);
+
+  // Then the game starts over and enables NMIs in the next frame. Its NMI
+  // handler counts frames in $10 again, from the VBlank that ends that
+  // frame on, each handled once the following frame starts.
+  const uint8_t counter = system->bus().Read(0x10);
+  for (int frame = 0; frame < 3; ++frame) system->RunFrame();
+  EXPECT_EQ(system->ppu().frame_count(), frames + 5);
+  EXPECT_EQ(system->bus().Read(0x10), static_cast<uint8_t>(counter + 2));
+}
+
+TEST(SystemTest, CatchUpIsExactWithEveryBackend) {
+  const std::vector<uint8_t> rom = SplitScreenRom();
+  std::unique_ptr<System> reference = MakeSystem(rom);
+  std::unique_ptr<System> fast = MakeSystem(rom);
+  fast->cpu().SetIdleLoopSkipping(true);
+  fast->cpu().SetBackend(Cpu::Backend::kJit);
+
+  for (int frame = 0; frame < 8; ++frame) {
+    reference->RunFrame();
+    fast->RunFrame();
+
+    ASSERT_EQ(FrameHash(*fast), FrameHash(*reference)) << frame;
+    ASSERT_EQ(fast->cpu().cycles(), reference->cpu().cycles()) << frame;
+  }
+}
+
+TEST(SystemTest, SpriteZeroHitSplitsTheScreen) {
+  std::unique_ptr<System> system = MakeSystem(SplitScreenRom());
+  for (int frame = 0; frame < 4; ++frame) system->RunFrame();
+  const std::vector<uint16_t> before(system->frame(),
+                                     system->frame() + 256 * 240);
+  system->RunFrame();
+
+  // NMIs were enabled during the third frame, and the NMI of the frame
+  // just completed is still pending.
+  EXPECT_EQ(system->bus().ram()[0x10], 2);
+  // Above sprite 0 the background stays put; below, it scrolls by a pixel
+  // per frame.
+  const uint16_t* const after = system->frame();
+  // Rows 2 and 121 have no sprites.
+  const int top = 2 * 256;
+  const int bottom = 121 * 256;
+  EXPECT_TRUE(std::equal(after + top, after + top + 256, &before[top]));
+  EXPECT_FALSE(std::equal(after + bottom, after + bottom + 256,
+                          &before[bottom]));
+  EXPECT_TRUE(std::equal(after + bottom, after + bottom + 255,
+                         &before[bottom + 1]));
+}
+
+TEST(SystemTest, PalGamesRunOnAPalConsole) {
+  std::vector<uint8_t> rom = SplitScreenRom();
+  rom[9] |= 0x01;
+  std::unique_ptr<System> system = MakeSystem(rom);
+  ASSERT_EQ(system->region(), Region::kPal);
+
+  for (int frame = 0; frame < 5; ++frame) system->RunFrame();
+  const uint64_t start = system->cpu().cycles();
+  const uint8_t nmis = system->bus().ram()[0x10];
+  system->RunFrame();
+
+  // A frame takes 312 * 341 / 3.2 cycles, and the CPU can overshoot the
+  // start of VBlank by an instruction.
+  EXPECT_NEAR(static_cast<double>(system->cpu().cycles() - start), 33247.5,
+              8);
+  EXPECT_EQ(system->bus().ram()[0x10], nmis + 1);
+}
+
+TEST(SystemTest, ReadsTheRegionFromNes2Headers) {
+  std::vector<uint8_t> rom = SplitScreenRom();
+  rom[7] |= 0x08;
+  rom[12] = 3;
+
+  std::string error;
+  std::unique_ptr<Cartridge> cartridge = Cartridge::FromInes(rom, &error);
+  ASSERT_NE(cartridge, nullptr) << error;
+  EXPECT_EQ(cartridge->region(), Region::kDendy);
+}
+
+TEST(SystemTest, DoesNotCacheCodeInIoPages) {
+  std::unique_ptr<System> system = MakeSystem(SplitScreenRom());
+  for (int page = 0; page < 0x100; ++page) {
+    const bool io = page >= 0x20 && page < 0x60;
+    EXPECT_EQ(system->cpu().code_bank(static_cast<uint8_t>(page)) ==
+                  Cpu::kUncachedBank,
+              io)
+        << page;
+  }
+}
+
+TEST(SystemTest, ControllersShiftOutButtonsInOrder) {
+  std::unique_ptr<System> system = MakeSystem(SplitScreenRom());
+  system->SetButtons(0, System::kButtonA | System::kButtonStart);
+  system->bus().Write(0x4016, 1);
+  system->bus().Write(0x4016, 0);
+
+  uint8_t buttons = 0;
+  for (int i = 0; i < 8; ++i) {
+    buttons |= (system->bus().Read(0x4016) & 1) << i;
+  }
+
+  EXPECT_EQ(buttons, System::kButtonA | System::kButtonStart);
+  EXPECT_EQ(system->bus().Read(0x4016) & 1, 1);
+  EXPECT_EQ(system->bus().Read(0x4017) & 1, 0);
+}
+
+TEST(SystemTest, RejectsUnsupportedMappers) {
+  std::vector<uint8_t> rom = SplitScreenRom();
+  rom[6] |= 0x40;  // Mapper 4
+
+  std::string error;
+  EXPECT_EQ(Cartridge::FromInes(rom, &error), nullptr);
+  EXPECT_EQ(error, "unsupported mapper 4");
+}
+
+}  // namespace
+}  // namespace purenes
@@ -0,0 +1,100 @@
+// purenes_recompile: translates the code of an iNES ROM to C++. It takes
+// the mappers that Cartridge supports: NROM (0), UxROM (2) and CNROM (3).
+//
+//   purenes_recompile <rom.nes> <symbol> <output>
+//
+// writes <output>.cpp, defining `const purenes::Cpu::CompiledCode <symbol>`,
+// and <output>.h declaring it. Install it with Cpu::SetCompiledCode(). The
+// purenes_add_recompiled_rom() CMake function wraps this into a library
+// target.
+
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cartridge.h"
+#include "recompiler.h"
+
+namespace {
+
+constexpr size_t kPrgBankSize = purenes::Cartridge::kPrgBankSize;
+
+bool IsIdentifier(const std::string& text) {
+  if (text.empty() || std::isdigit(static_cast<unsigned char>(text[0]))) {
+    return false;
+  }
+  for (char c : text) {
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') return false;
+  }
+  return true;
+}
+
+// Adds the PRG ROM of `cartridge` to `recompiler`, each 16KB bank with the
+// code bank id and at every address that Cartridge can map it: UxROM
+// switches any bank into $8000, and the last bank is fixed at $C000, so
+// that a 16KB NROM ROM is in both halves.
+void AddPrgBanks(const purenes::Cartridge& cartridge,
+                 purenes::Recompiler* recompiler) {
+  const size_t banks = cartridge.prg_banks();
+  for (size_t bank = 0; bank < banks; ++bank) {
+    const auto begin = cartridge.prg().begin() + bank * kPrgBankSize;
+    const std::vector<uint8_t> bytes(begin, begin + kPrgBankSize);
+    const uint16_t id = purenes::Cartridge::PrgCodeBank(bank);
+    for (uint16_t address : {0x8000, 0xC000}) {
+      if (cartridge.CanMapPrgBank(bank, address)) {
+        recompiler->AddRegion(id, address, bytes);
+      }
+    }
+    recompiler->AddVectors(id);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 4) {
+    std::cerr << "usage: " << argv[0] << " <rom.nes> <symbol> <output>\n";
+    return 2;
+  }
+  const std::string rom_path = argv[1];
+  const std::string symbol = argv[2];
+  const std::string output = argv[3];
+  if (!IsIdentifier(symbol)) {
+    std::cerr << symbol << ": not a C++ identifier\n";
+    return 1;
+  }
+
+  std::ifstream rom(rom_path, std::ios::binary);
+  if (!rom) {
+    std::cerr << rom_path << ": cannot open\n";
+    return 1;
+  }
+  const std::vector<uint8_t> file((std::istreambuf_iterator<char>(rom)),
+                                  std::istreambuf_iterator<char>());
+
+  std::string error;
+  const std::unique_ptr<purenes::Cartridge> cartridge =
+      purenes::Cartridge::FromInes(file, &error);
+  if (!cartridge) {
+    std::cerr << rom_path << ": " << error << "\n";
+    return 1;
+  }
+  purenes::Recompiler recompiler;
+  AddPrgBanks(*cartridge, &recompiler);
+  recompiler.Analyze();
+
+  std::ofstream source(output + ".cpp");
+  recompiler.EmitSource(symbol, source);
+  std::ofstream header(output + ".h");
+  purenes::Recompiler::EmitHeader(symbol, header);
+  if (!source || !header) {
+    std::cerr << output << ": cannot write output\n";
+    return 1;
+  }
+  return 0;
+}